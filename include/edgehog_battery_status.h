@@ -62,7 +62,9 @@ typedef struct {
  * @brief Update battery status info.
  *
  * @details This function updates battery status info. This function does not immediately publish
- * the update.
+ * the update, the latest update made before the publish is sent, timestamped when it was made. Up
+ * to CONFIG_EDGEHOG_BATTERY_SLOTS battery slots are tracked. It can be called from any task, also
+ * while the status is being published.
  *
  * @param edgehog_device A valid Edgehog device handle.
  * @param battery_status A battery status structure that contains current battery status. It can be
@@ -51,7 +51,11 @@ typedef enum
     EDGEHOG_TELEMETRY_SYSTEM_STATUS = 3, /**< The system status telemetry type. */
     EDGEHOG_TELEMETRY_STORAGE_USAGE = 4, /**< The storage usage telemetry type. */
     EDGEHOG_TELEMETRY_BATTERY_STATUS = 5, /**< The battery status telemetry type. */
-    EDGEHOG_TELEMETRY_GEOLOCATION_INFO = 6 /**< The geolocation info telemetry type. */
+    EDGEHOG_TELEMETRY_GEOLOCATION_INFO = 6, /**< The geolocation info telemetry type. */
+    EDGEHOG_TELEMETRY_BATTERY_ANALYTICS = 7, /**< The battery analytics telemetry type, requires
+                                                  CONFIG_EDGEHOG_BATTERY_ANALYTICS. */
+    EDGEHOG_TELEMETRY_HEAP_MONITOR = 8 /**< The heap fragmentation sampling, requires
+                                            CONFIG_EDGEHOG_HEAP_MONITOR. */
 } telemetry_type_t;
 
 /**
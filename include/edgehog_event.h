@@ -42,9 +42,41 @@ typedef enum
     EDGEHOG_INVALID_EVENT = 0, /**< An invalid event. */
     EDGEHOG_OTA_INIT_EVENT, /**< Edgehog OTA routine init. */
     EDGEHOG_OTA_FAILED_EVENT, /**< Edgehog OTA routine failed. */
-    EDGEHOG_OTA_SUCCESS_EVENT /**< Edgehog OTA routine successful. */
+    EDGEHOG_OTA_SUCCESS_EVENT, /**< Edgehog OTA routine successful. */
+    EDGEHOG_OTA_STAGED_EVENT, /**< Edgehog OTA update downloaded, waiting to be applied. */
+    EDGEHOG_OTA_APPLY_EVENT, /**< Edgehog OTA staged update being applied, the device restarts. */
+    EDGEHOG_HEAP_FRAGMENTED_EVENT, /**< A heap region reached a higher fragmentation level, the
+                                        event data is an edgehog_heap_fragmentation_event_t. */
+    EDGEHOG_HEAP_RECOVERED_EVENT /**< A heap region returned to a lower fragmentation level, the
+                                      event data is an edgehog_heap_fragmentation_event_t. */
 } edgehog_event;
 
+/**
+ * @brief Heap fragmentation levels.
+ */
+typedef enum
+{
+    EDGEHOG_HEAP_NORMAL = 0, /**< The fragmentation is below the warning threshold. */
+    EDGEHOG_HEAP_WARNING, /**< The fragmentation is above the warning threshold. */
+    EDGEHOG_HEAP_CRITICAL /**< The fragmentation is above the critical threshold. */
+} edgehog_heap_level_t;
+
+/**
+ * @brief Data of the heap fragmentation events.
+ *
+ * @details The fragmentation is 100 * (1 - largest free block / free memory), smoothed over the
+ * samples.
+ */
+typedef struct
+{
+    uint32_t caps; /**< Capabilities of the heap region, such as MALLOC_CAP_INTERNAL. */
+    edgehog_heap_level_t level; /**< The new fragmentation level. */
+    float fragmentation_percent; /**< The smoothed fragmentation. */
+    float trend_percent_per_hour; /**< The change rate of the smoothed fragmentation. */
+    uint32_t free_bytes; /**< The free memory of the region. */
+    uint32_t largest_free_block; /**< The largest free block of the region. */
+} edgehog_heap_fragmentation_event_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -55,7 +55,8 @@ void edgehog_geolocation_publish(edgehog_device_handle_t edgehog_device);
  * @brief Update geolocation info
  *
  * @details This function updates geolocation data. This function does not immediately publish
- * the update.
+ * the update, the latest update made before the publish is sent, timestamped when it was made. It
+ * can be called from any task, also while the data is being published.
  *
  * @param edgehog_device A valid Edgehog device handle.
  * @param battery_status A geolocation data structure that contains current geolocation. It can be
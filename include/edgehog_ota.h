@@ -0,0 +1,171 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file edgehog_ota.h
+ * @brief Edgehog device OTA update API.
+ */
+
+#ifndef EDGEHOG_OTA_H
+#define EDGEHOG_OTA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "edgehog_device.h"
+
+/**
+ * @brief Edgehog OTA download priority.
+ */
+typedef enum
+{
+    EDGEHOG_OTA_PRIORITY_NORMAL = 0, /**< The download is limited only by the rate limit. */
+    EDGEHOG_OTA_PRIORITY_BACKGROUND, /**< The download pauses while the application has pending
+                                          outgoing messages. */
+} edgehog_ota_priority_t;
+
+/**
+ * @brief Callback returning the number of outgoing messages queued by the application.
+ *
+ * @param user_data The user data provided in edgehog_ota_throttle_t.
+ *
+ * @return The number of pending outgoing messages.
+ */
+typedef size_t (*edgehog_ota_pending_cb_t)(void *user_data);
+
+/**
+ * @brief Callback checking the health of the application after an OTA update.
+ *
+ * @details The callback is called periodically from the OTA health task, it should not block.
+ *
+ * @param user_data The user data provided to edgehog_ota_set_health_probe.
+ *
+ * @return true if the application is healthy, false otherwise.
+ */
+typedef bool (*edgehog_ota_health_probe_t)(void *user_data);
+
+/**
+ * @brief Edgehog OTA download throttling configuration.
+ *
+ * Example:
+ *  edgehog_ota_throttle_t throttle = {
+ *      .max_bytes_per_sec = 16 * 1024,
+ *      .priority = EDGEHOG_OTA_PRIORITY_BACKGROUND,
+ *      .pending_cb = get_app_queue_len,
+ *      .pending_threshold = 4,
+ *  };
+ */
+typedef struct
+{
+    uint32_t max_bytes_per_sec; /**< Download rate limit, 0 means unlimited. */
+    edgehog_ota_priority_t priority; /**< Download priority. */
+    edgehog_ota_pending_cb_t pending_cb; /**< Pending messages callback, used in background and
+                                              before restarting into an update. */
+    void *pending_user_data; /**< User data passed to pending_cb. */
+    size_t pending_threshold; /**< The download pauses above this number of pending messages. */
+} edgehog_ota_throttle_t;
+
+/**
+ * @brief Edgehog OTA sink, receiving the image of an OTA update for an external target.
+ *
+ * @details OTA requests with a target field matching the sink target are streamed to the sink
+ * instead of the update partition. The callbacks are called from the OTA task in the order
+ * begin, write..., finish, or abort when the update fails or is canceled after begin. When a
+ * download attempt fails the next one continues from the same offset, the sink sees a single
+ * sequential stream. Updates for an external target are neither staged nor resumed after a reset.
+ */
+typedef struct
+{
+    const char *target; /**< Target name, matched with the target field of the OTA request. */
+    /** Prepares the target for a new image, image_size is -1 when unknown. */
+    edgehog_err_t (*begin)(void *user_data, int image_size);
+    /** Streams the next chunk of the image. */
+    edgehog_err_t (*write)(void *user_data, const uint8_t *data, size_t len);
+    /** Completes the transfer, the target validates and applies the image. */
+    edgehog_err_t (*finish)(void *user_data);
+    /** Discards the partial image. */
+    void (*abort)(void *user_data);
+    void *user_data; /**< User data passed to the callbacks. */
+} edgehog_ota_sink_t;
+
+/**
+ * @brief set the OTA download throttling.
+ *
+ * @details This function sets the rate limit and priority of the OTA downloads. It can be called
+ * at any time and also affects an OTA update in progress. A rate limit provided by the server in
+ * the OTA request takes precedence over the one set with this function.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param throttle The throttling configuration, it is copied.
+ * @return EDGEHOG_OK if the configuration has been applied, an edgehog_err_t otherwise.
+ */
+edgehog_err_t edgehog_ota_set_throttle(
+    edgehog_device_handle_t edgehog_device, const edgehog_ota_throttle_t *throttle);
+
+/**
+ * @brief set the OTA update health probe.
+ *
+ * @details When the bootloader rollback is enabled, an updated image is kept pending verification
+ * until the device connects to Astarte and the health probe returns true. The image is then
+ * marked valid, otherwise it is rolled back after CONFIG_EDGEHOG_OTA_HEALTH_CHECK_TIMEOUT_S.
+ * This function must be called before edgehog_device_start.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param probe The health probe, NULL to only check the Astarte connection.
+ * @param user_data User data passed to the probe.
+ * @return EDGEHOG_OK if the probe has been set, an edgehog_err_t otherwise.
+ */
+edgehog_err_t edgehog_ota_set_health_probe(
+    edgehog_device_handle_t edgehog_device, edgehog_ota_health_probe_t probe, void *user_data);
+
+/**
+ * @brief set the OTA sink of an external target.
+ *
+ * @details OTA requests without a target field update the device itself, requests with the
+ * target of the sink are streamed to it. The target field has been added by version 1.1 of the
+ * io.edgehog.devicemanager.OTARequest interface. Only one external sink can be set. This function
+ * must be called before edgehog_device_start.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param sink The sink, it is copied and its target string must remain valid. NULL removes it.
+ * @return EDGEHOG_OK if the sink has been set, an edgehog_err_t otherwise.
+ */
+edgehog_err_t edgehog_ota_set_sink(
+    edgehog_device_handle_t edgehog_device, const edgehog_ota_sink_t *sink);
+
+/**
+ * @brief apply a staged OTA update.
+ *
+ * @details An OTA update is staged when its request contains a maintenance window or when
+ * CONFIG_EDGEHOG_OTA_APPLY_REQUIRES_APPROVAL is set. The downloaded image waits in the inactive
+ * partition and EDGEHOG_OTA_STAGED_EVENT is posted. This function sets the staged image as boot
+ * partition, posts EDGEHOG_OTA_APPLY_EVENT and restarts the device.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @return Does not return if the update is applied, an edgehog_err_t otherwise.
+ */
+edgehog_err_t edgehog_ota_apply(edgehog_device_handle_t edgehog_device);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EDGEHOG_OTA_H
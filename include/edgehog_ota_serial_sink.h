@@ -0,0 +1,134 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file edgehog_ota_serial_sink.h
+ * @brief Edgehog OTA sink streaming the image to an external target over a serial link.
+ *
+ * @details The image is sent in frames:
+ *  | 0xA5 | type (1) | seq (1) | len (2, LE) | payload (len) | CRC-16/CCITT-FALSE (2, LE) |
+ * where the CRC covers type, seq, len and payload. The device sends BEGIN (payload: image size,
+ * u32 LE, 0xFFFFFFFF when unknown), DATA (image bytes), END (payload: image size and CRC-32 of
+ * the image, u32 LE each) and ABORT frames. BEGIN has seq 0, every following frame increments it.
+ * The target answers with ACK (seq of the last frame received in order), NAK (seq of the frame
+ * to send again) or ERROR (the target refuses the image) frames with an empty payload.
+ * Up to the configured window of frames is sent before waiting for an acknowledgement, frames are
+ * sent again from the oldest unacknowledged one when the acknowledgement does not arrive in time.
+ * The target acknowledges END once the image has been validated and applied.
+ */
+
+#ifndef EDGEHOG_OTA_SERIAL_SINK_H
+#define EDGEHOG_OTA_SERIAL_SINK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "edgehog_ota.h"
+#include <driver/uart.h>
+
+#define EDGEHOG_OTA_SERIAL_PAYLOAD_SIZE 256
+#define EDGEHOG_OTA_SERIAL_MAX_WINDOW 8
+
+/**
+ * @brief Serial link used by the OTA serial sink.
+ *
+ * @details edgehog_ota_serial_uart_transport provides a UART transport, other links such as SPI
+ * are supported by providing these callbacks.
+ */
+typedef struct
+{
+    /** Sends len bytes, returns the number of bytes sent or a negative value on error. */
+    int (*send)(void *ctx, const uint8_t *data, size_t len);
+    /** Receives up to len bytes, returns the number of bytes received, 0 on timeout or a negative
+     * value on error. */
+    int (*recv)(void *ctx, uint8_t *data, size_t len, uint32_t timeout_ms);
+    void *ctx; /**< Context passed to the callbacks. */
+} edgehog_ota_serial_transport_t;
+
+/**
+ * @brief Edgehog OTA serial sink configuration.
+ *
+ * Example:
+ *  edgehog_ota_serial_sink_config_t config = {
+ *      .target = "coprocessor",
+ *      .window = 4,
+ *      .ack_timeout_ms = 500,
+ *      .max_retries = 5,
+ *  };
+ *  edgehog_ota_serial_uart_transport(UART_NUM_1, &config.transport);
+ */
+typedef struct
+{
+    const char *target; /**< Target name, matched with the target field of the OTA request. */
+    edgehog_ota_serial_transport_t transport; /**< Serial link to the target. */
+    uint8_t window; /**< Frames sent before waiting for an acknowledgement, up to
+                         EDGEHOG_OTA_SERIAL_MAX_WINDOW. */
+    uint32_t ack_timeout_ms; /**< Time waited for an acknowledgement before sending again. */
+    uint8_t max_retries; /**< Consecutive timeouts after which the transfer fails. */
+} edgehog_ota_serial_sink_config_t;
+
+/**
+ * @brief Edgehog OTA serial sink state, its fields are managed by the sink.
+ */
+typedef struct
+{
+    edgehog_ota_serial_sink_config_t config;
+    uint8_t frames[EDGEHOG_OTA_SERIAL_MAX_WINDOW][EDGEHOG_OTA_SERIAL_PAYLOAD_SIZE];
+    uint16_t frame_len[EDGEHOG_OTA_SERIAL_MAX_WINDOW];
+    uint8_t frame_type[EDGEHOG_OTA_SERIAL_MAX_WINDOW];
+    uint8_t base_seq; /**< Oldest unacknowledged frame. */
+    uint8_t next_seq; /**< Next frame to send. */
+    uint32_t image_len; /**< Image bytes sent. */
+    uint32_t image_crc; /**< CRC-32 of the image bytes sent. */
+    uint32_t retransmissions; /**< Frames sent again during the transfer. */
+    int64_t start_us; /**< Start time of the transfer. */
+} edgehog_ota_serial_sink_t;
+
+/**
+ * @brief initialize an OTA serial sink.
+ *
+ * @details The returned sink can be passed to edgehog_ota_set_sink. The serial sink memory holds
+ * the frames of the window and must remain valid while the sink is set.
+ *
+ * @param serial_sink The serial sink state.
+ * @param config The serial sink configuration, it is copied.
+ * @param sink The OTA sink to initialize.
+ * @return EDGEHOG_OK if the sink has been initialized, an edgehog_err_t otherwise.
+ */
+edgehog_err_t edgehog_ota_serial_sink_init(edgehog_ota_serial_sink_t *serial_sink,
+    const edgehog_ota_serial_sink_config_t *config, edgehog_ota_sink_t *sink);
+
+/**
+ * @brief initialize a serial transport over a UART.
+ *
+ * @details The UART driver must be installed by the application.
+ *
+ * @param uart_num The UART port.
+ * @param transport The transport to initialize.
+ */
+void edgehog_ota_serial_uart_transport(
+    uart_port_t uart_num, edgehog_ota_serial_transport_t *transport);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EDGEHOG_OTA_SERIAL_SINK_H
@@ -0,0 +1,93 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EDGEHOG_BATTERY_ANALYTICS_H
+#define EDGEHOG_BATTERY_ANALYTICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "edgehog_battery_status.h"
+#include <freertos/FreeRTOS.h>
+
+extern const astarte_interface_t battery_analytics_interface;
+
+typedef struct
+{
+    int64_t time_us;
+    float level;
+} edgehog_battery_sample_t;
+
+/**
+ * @brief Battery level samples of a battery slot.
+ *
+ * @details The samples of the current charge or discharge run are kept in a ring, the window
+ * restarts when the battery state changes.
+ */
+typedef struct
+{
+    portMUX_TYPE lock;
+    edgehog_battery_sample_t samples[CONFIG_EDGEHOG_BATTERY_ANALYTICS_WINDOW];
+    uint8_t len;
+    uint8_t next;
+    edgehog_battery_state state; // State of the samples in the window
+    edgehog_battery_sample_t last; // Last sample taken, also across state changes
+    float discharged; // Level percentage discharged since the first sample, 100 per cycle
+} edgehog_battery_analytics_t;
+
+/**
+ * @brief initialize the battery analytics of a slot.
+ *
+ * @param analytics The battery analytics, zero initialized.
+ */
+void edgehog_battery_analytics_init(edgehog_battery_analytics_t *analytics);
+
+/**
+ * @brief sample a battery level.
+ *
+ * @details The level is sampled when CONFIG_EDGEHOG_BATTERY_ANALYTICS_SAMPLE_INTERVAL_S passed
+ * since the previous sample or when the state changed, otherwise it is ignored. It can be called
+ * from any task.
+ *
+ * @param analytics Valid battery analytics.
+ * @param level The charge level in [0.0%-100.0%] range.
+ * @param state The battery state.
+ */
+void edgehog_battery_analytics_add(
+    edgehog_battery_analytics_t *analytics, double level, edgehog_battery_state state);
+
+/**
+ * @brief publish the battery analytics of a slot.
+ *
+ * @details Nothing is published until the window holds two samples.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param analytics Valid battery analytics.
+ * @param path The path of the battery slot.
+ */
+void edgehog_battery_analytics_publish(edgehog_device_handle_t edgehog_device,
+    edgehog_battery_analytics_t *analytics, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EDGEHOG_BATTERY_ANALYTICS_H
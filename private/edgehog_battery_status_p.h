@@ -23,14 +23,18 @@
 
 #include "edgehog_device.h"
 
-#include <astarte_list.h>
-
 /**
  * Private API.
  */
 
+typedef struct edgehog_battery_table_t edgehog_battery_table_t;
+
 extern const astarte_interface_t battery_status_interface;
 
-void edgehog_battery_status_delete_list(astarte_list_head_t *battery_list);
+edgehog_battery_table_t *edgehog_battery_status_table_new(void);
+void edgehog_battery_status_table_destroy(edgehog_battery_table_t *battery_table);
+#if CONFIG_EDGEHOG_BATTERY_ANALYTICS
+void edgehog_battery_status_publish_analytics(edgehog_device_handle_t edgehog_device);
+#endif
 
 #endif // EDGEHOG_BATTERY_STATUS_P_H
@@ -27,13 +27,25 @@ extern "C" {
 
 #include <esp_idf_version.h>
 
+#include "edgehog_battery_status_p.h"
 #include "edgehog_device.h"
+#if CONFIG_EDGEHOG_HEAP_MONITOR
+#include "edgehog_heap_monitor.h"
+#endif
+#include "edgehog_ota.h"
+#if CONFIG_EDGEHOG_SYSTEM_STATUS_EXTENDED
+#include "edgehog_system_status.h"
+#endif
 #include "edgehog_telemetry.h"
 #if CONFIG_INDICATOR_GPIO_ENABLE
 #include "edgehog_led.h"
 #endif
 
 #include <astarte_list.h>
+#include <esp_event.h>
+
+// Wall clock times before 2020-01-01 are considered not synchronized
+#define EDGEHOG_MIN_VALID_EPOCH_S 1577836800LL
 
 struct edgehog_device_t
 {
@@ -44,9 +56,20 @@ struct edgehog_device_t
     edgehog_led_behavior_manager_handle_t led_manager;
 #endif
     edgehog_telemetry_t *edgehog_telemetry;
+    edgehog_ota_throttle_t ota_throttle;
+    edgehog_ota_health_probe_t ota_health_probe;
+    void *ota_health_probe_user_data;
+    edgehog_ota_sink_t ota_sink;
+    esp_event_handler_instance_t wifi_scan_handler;
 
-    astarte_list_head_t battery_list;
+    edgehog_battery_table_t *battery_table;
     astarte_list_head_t geolocation_list;
+#if CONFIG_EDGEHOG_SYSTEM_STATUS_EXTENDED
+    edgehog_system_status_t *system_status;
+#endif
+#if CONFIG_EDGEHOG_HEAP_MONITOR
+    edgehog_heap_monitor_t heap_monitor;
+#endif
 };
 
 /**
@@ -116,6 +139,15 @@ telemetry_periodic edgehog_device_get_telemetry_periodic(telemetry_type_t type);
  */
 telemetry_type_t edgehog_device_get_telemetry_type(const char *interface_name);
 
+/**
+ * @brief get the current time to timestamp data.
+ *
+ * @details Without a valid clock the data is timestamped by Astarte on reception.
+ *
+ * @return the milliseconds since the epoch, or 0 if the clock has not been set.
+ */
+uint64_t edgehog_device_get_timestamp_ms(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,76 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EDGEHOG_FIXED_POINT_H
+#define EDGEHOG_FIXED_POINT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <math.h>
+#include <stdint.h>
+
+// Fixed point units per degree of latitude and longitude, about 1 cm at the equator
+#define EDGEHOG_FIXED_COORDINATE_SCALE 1e7
+
+/**
+ * @brief convert a value to fixed point.
+ *
+ * @details The value is rounded to the nearest unit and clamped to [min, max].
+ *
+ * @param value The value to convert.
+ * @param scale The fixed point units per unit of the value.
+ * @param min The smallest fixed point value.
+ * @param max The largest fixed point value.
+ * @return The fixed point value, 0 if value is not a number.
+ */
+static inline int32_t edgehog_fixed_from_double(
+    double value, double scale, int32_t min, int32_t max)
+{
+    if (isnan(value)) {
+        return 0;
+    }
+    double scaled = round(value * scale);
+    if (scaled < min) {
+        return min;
+    } else if (scaled > max) {
+        return max;
+    }
+    return (int32_t) scaled;
+}
+
+/**
+ * @brief convert a fixed point value back to double.
+ *
+ * @param value The fixed point value.
+ * @param scale The fixed point units per unit of the value.
+ * @return The converted value.
+ */
+static inline double edgehog_fixed_to_double(int32_t value, double scale)
+{
+    return value / scale;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EDGEHOG_FIXED_POINT_H
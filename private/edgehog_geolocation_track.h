@@ -0,0 +1,82 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EDGEHOG_GEOLOCATION_TRACK_H
+#define EDGEHOG_GEOLOCATION_TRACK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "edgehog_device.h"
+
+typedef struct edgehog_geolocation_track_t edgehog_geolocation_track_t;
+
+extern const astarte_interface_t geolocation_track_interface;
+
+/**
+ * @brief create a geolocation track.
+ *
+ * @details The track buffers up to CONFIG_EDGEHOG_GEOLOCATION_TRACK_SIZE fixes, when it is full
+ * the fixes are simplified to make room.
+ *
+ * @return The track, or NULL if there is not enough memory.
+ */
+edgehog_geolocation_track_t *edgehog_geolocation_track_new(void);
+
+/**
+ * @brief destroy a geolocation track.
+ *
+ * @param track A track created by edgehog_geolocation_track_new, or NULL.
+ */
+void edgehog_geolocation_track_destroy(edgehog_geolocation_track_t *track);
+
+/**
+ * @brief add a fix to a geolocation track.
+ *
+ * @details Fixes without a valid clock are not recorded.
+ *
+ * @param track A valid track.
+ * @param latitude The latitude of the fix in degrees.
+ * @param longitude The longitude of the fix in degrees.
+ * @param timestamp_ms The time of the fix, as returned by edgehog_device_get_timestamp_ms.
+ */
+void edgehog_geolocation_track_append(
+    edgehog_geolocation_track_t *track, double latitude, double longitude, uint64_t timestamp_ms);
+
+/**
+ * @brief publish the simplified fixes of a geolocation track.
+ *
+ * @details The fixes are published in a single document and removed from the track once
+ * published, the last one is kept as the start of the next part of the track. On failure they are
+ * published again at the next call.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param track A valid track.
+ * @param path The path of the GPS receiver.
+ */
+void edgehog_geolocation_track_publish(
+    edgehog_device_handle_t edgehog_device, edgehog_geolocation_track_t *track, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EDGEHOG_GEOLOCATION_TRACK_H
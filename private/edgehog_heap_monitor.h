@@ -0,0 +1,73 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EDGEHOG_HEAP_MONITOR_H
+#define EDGEHOG_HEAP_MONITOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "edgehog_device.h"
+#include "edgehog_event.h"
+
+#if CONFIG_SPIRAM
+#define EDGEHOG_HEAP_MONITOR_REGIONS 2
+#else
+#define EDGEHOG_HEAP_MONITOR_REGIONS 1
+#endif
+
+extern const astarte_interface_t heap_fragmentation_interface;
+
+/**
+ * @brief Fragmentation state of a heap region.
+ */
+typedef struct
+{
+    int64_t sampled_us; // Time of the last sample, 0 before the first one
+    float fragmentation_percent; // Smoothed fragmentation
+    float trend_percent_per_hour; // Smoothed change rate of the fragmentation
+    edgehog_heap_level_t level;
+} edgehog_heap_region_state_t;
+
+/**
+ * @brief Heap fragmentation monitor state, zero initialized with the device.
+ */
+typedef struct
+{
+    edgehog_heap_region_state_t regions[EDGEHOG_HEAP_MONITOR_REGIONS];
+} edgehog_heap_monitor_t;
+
+/**
+ * @brief sample the heap fragmentation.
+ *
+ * @details This function samples the internal RAM and, when enabled, the external RAM. When the
+ * smoothed fragmentation of a region crosses a threshold, an EDGEHOG_HEAP_FRAGMENTED_EVENT or
+ * EDGEHOG_HEAP_RECOVERED_EVENT is posted and the new state is published.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ */
+void edgehog_heap_monitor_sample(edgehog_device_handle_t edgehog_device);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EDGEHOG_HEAP_MONITOR_H
@@ -18,8 +18,8 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
-#ifndef EDGEHOG_OTA_H
-#define EDGEHOG_OTA_H
+#ifndef EDGEHOG_OTA_P_H
+#define EDGEHOG_OTA_P_H
 
 #ifdef __cplusplus
 extern "C" {
@@ -58,4 +58,4 @@ edgehog_err_t edgehog_ota_event(
 }
 #endif
 
-#endif // EDGEHOG_OTA_H
+#endif // EDGEHOG_OTA_P_H
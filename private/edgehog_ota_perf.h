@@ -0,0 +1,114 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EDGEHOG_OTA_PERF_H
+#define EDGEHOG_OTA_PERF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "edgehog_device.h"
+
+// One bucket for each power of two of bytes per second, up to 2 GiB/s.
+#define EDGEHOG_OTA_PERF_HISTOGRAM_BUCKETS 32
+
+extern const astarte_interface_t ota_performance_interface;
+
+/**
+ * @brief Performance counters collected during a single OTA update request.
+ *
+ * @details All the durations are expressed in microseconds. Setup times refer to the last
+ * download attempt, while all the other counters are accumulated across retries.
+ */
+typedef struct
+{
+    int64_t start_us; /**< Timestamp of the beginning of the OTA request. */
+    int64_t dns_us; /**< Time spent resolving the server host name. */
+    int64_t connect_us; /**< Time spent establishing the TCP and TLS connection. */
+    int64_t connection_us; /**< Time spent establishing connections across all attempts. */
+    int64_t full_handshake_us; /**< Time spent in full TLS handshakes, TCP connection included. */
+    int64_t resumed_handshake_us; /**< Time spent in TLS handshakes offering a saved session. */
+    int64_t network_us; /**< Time spent waiting for data from the network. */
+    int64_t flash_us; /**< Time spent erasing and writing the flash. */
+    int64_t erase_us; /**< Time spent erasing the flash, included in flash_us. */
+    uint32_t bytes_read; /**< Total number of bytes received. */
+    uint32_t chunk_count; /**< Number of chunks received. */
+    uint32_t histogram[EDGEHOG_OTA_PERF_HISTOGRAM_BUCKETS]; /**< Chunk throughput histogram. */
+    uint8_t retries; /**< Number of failed download attempts. */
+    uint8_t connections; /**< Number of TCP and TLS connections established. */
+    uint8_t full_handshakes; /**< Number of TLS handshakes without a saved session. */
+    uint8_t resumed_handshakes; /**< Number of TLS handshakes offering a saved session. */
+} edgehog_ota_perf_t;
+
+/**
+ * @brief Reset the OTA performance counters.
+ *
+ * @param perf The performance counters to reset, the start timestamp is set to now.
+ */
+void edgehog_ota_perf_init(edgehog_ota_perf_t *perf);
+
+/**
+ * @brief Account for a chunk of the OTA image.
+ *
+ * @param perf Valid performance counters.
+ * @param bytes Size of the chunk in bytes.
+ * @param network_us Time spent receiving the chunk.
+ * @param flash_us Time spent writing the chunk to flash.
+ */
+void edgehog_ota_perf_add_chunk(
+    edgehog_ota_perf_t *perf, uint32_t bytes, int64_t network_us, int64_t flash_us);
+
+/**
+ * @brief Compute the average download throughput.
+ *
+ * @param perf Valid performance counters.
+ *
+ * @return The average throughput in bytes per second, 0 if no data has been received.
+ */
+uint32_t edgehog_ota_perf_avg_throughput(const edgehog_ota_perf_t *perf);
+
+/**
+ * @brief Compute the 95th percentile of the chunk throughput.
+ *
+ * @param perf Valid performance counters.
+ *
+ * @return The 95th percentile throughput in bytes per second, 0 if no data has been received.
+ */
+uint32_t edgehog_ota_perf_p95_throughput(const edgehog_ota_perf_t *perf);
+
+/**
+ * @brief Publish the OTA performance record to Astarte.
+ *
+ * @details The record is published only if CONFIG_EDGEHOG_OTA_PERF_TELEMETRY is set.
+ *
+ * @param edgehog_dev A valid Edgehog device handle.
+ * @param request_uuid Uuid of the OTA request.
+ * @param perf Valid performance counters.
+ * @param result Outcome of the OTA request.
+ */
+void edgehog_ota_perf_publish(edgehog_device_handle_t edgehog_dev, const char *request_uuid,
+    const edgehog_ota_perf_t *perf, edgehog_err_t result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EDGEHOG_OTA_PERF_H
@@ -0,0 +1,142 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EDGEHOG_SEQLOCK_H
+#define EDGEHOG_SEQLOCK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freertos/FreeRTOS.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/**
+ * @brief Sequence lock protecting a record shared between writer tasks and a reader.
+ *
+ * @details Writers are serialized by a spinlock held only while the record is copied, they never
+ * wait for the reader. The reader takes no lock, it copies the record and retries when a writer
+ * changed it meanwhile, so it always gets a consistent record, also across cores.
+ */
+typedef struct
+{
+    portMUX_TYPE writer_lock;
+    atomic_uint seq; // Odd while a writer is changing the record
+} edgehog_seqlock_t;
+
+/**
+ * @brief initialize a sequence lock.
+ *
+ * @param seqlock The sequence lock.
+ */
+static inline void edgehog_seqlock_init(edgehog_seqlock_t *seqlock)
+{
+    portMUX_INITIALIZE(&seqlock->writer_lock);
+    atomic_init(&seqlock->seq, 0);
+}
+
+/**
+ * @brief exclude the other writers, the record can be read freely until edgehog_seqlock_unlock.
+ *
+ * @param seqlock The sequence lock.
+ */
+static inline void edgehog_seqlock_lock(edgehog_seqlock_t *seqlock)
+{
+    portENTER_CRITICAL(&seqlock->writer_lock);
+}
+
+/**
+ * @brief release the writer lock taken by edgehog_seqlock_lock.
+ *
+ * @param seqlock The sequence lock.
+ */
+static inline void edgehog_seqlock_unlock(edgehog_seqlock_t *seqlock)
+{
+    portEXIT_CRITICAL(&seqlock->writer_lock);
+}
+
+/**
+ * @brief get the current sequence, it changes at every write.
+ *
+ * @param seqlock The sequence lock.
+ * @return The current sequence.
+ */
+static inline unsigned int edgehog_seqlock_sequence(edgehog_seqlock_t *seqlock)
+{
+    return atomic_load_explicit(&seqlock->seq, memory_order_relaxed);
+}
+
+/**
+ * @brief mark the start of a change of the record, the writer lock must be held.
+ *
+ * @param seqlock The sequence lock.
+ */
+static inline void edgehog_seqlock_write_begin(edgehog_seqlock_t *seqlock)
+{
+    unsigned int seq = atomic_load_explicit(&seqlock->seq, memory_order_relaxed);
+    atomic_store_explicit(&seqlock->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/**
+ * @brief mark the end of a change of the record, the writer lock must be held.
+ *
+ * @param seqlock The sequence lock.
+ */
+static inline void edgehog_seqlock_write_end(edgehog_seqlock_t *seqlock)
+{
+    unsigned int seq = atomic_load_explicit(&seqlock->seq, memory_order_relaxed);
+    atomic_store_explicit(&seqlock->seq, seq + 1, memory_order_release);
+}
+
+/**
+ * @brief start reading the record.
+ *
+ * @param seqlock The sequence lock.
+ * @return The sequence to pass to edgehog_seqlock_read_retry, it changes at every write.
+ */
+static inline unsigned int edgehog_seqlock_read_begin(edgehog_seqlock_t *seqlock)
+{
+    unsigned int seq;
+    while ((seq = atomic_load_explicit(&seqlock->seq, memory_order_acquire)) & 1) {
+        // A writer holds a spinlock for a few instructions, possibly on the other core
+    }
+    return seq;
+}
+
+/**
+ * @brief check whether the record read since edgehog_seqlock_read_begin must be read again.
+ *
+ * @param seqlock The sequence lock.
+ * @param seq The sequence returned by edgehog_seqlock_read_begin.
+ * @return true if a writer changed the record meanwhile, false if the copy is consistent.
+ */
+static inline bool edgehog_seqlock_read_retry(edgehog_seqlock_t *seqlock, unsigned int seq)
+{
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&seqlock->seq, memory_order_relaxed) != seq;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EDGEHOG_SEQLOCK_H
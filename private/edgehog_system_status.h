@@ -0,0 +1,67 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EDGEHOG_SYSTEM_STATUS_H
+#define EDGEHOG_SYSTEM_STATUS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "edgehog_device.h"
+
+typedef struct edgehog_system_status_t edgehog_system_status_t;
+
+extern const astarte_interface_t extended_system_status_interface;
+
+/**
+ * @brief create the extended system status state.
+ *
+ * @details The task snapshots are preallocated for up to CONFIG_EDGEHOG_SYSTEM_STATUS_MAX_TASKS
+ * tasks.
+ *
+ * @return The extended system status state, or NULL if there is not enough memory.
+ */
+edgehog_system_status_t *edgehog_system_status_new(void);
+
+/**
+ * @brief destroy the extended system status state.
+ *
+ * @param system_status A state created by edgehog_system_status_new, or NULL.
+ */
+void edgehog_system_status_destroy(edgehog_system_status_t *system_status);
+
+/**
+ * @brief publish the extended system status.
+ *
+ * @details The CPU usage of the tasks and of the idle tasks is measured since the previous call,
+ * or since boot at the first call. Only the tasks using the most CPU are published.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @param system_status A valid extended system status state.
+ */
+void edgehog_system_status_publish(
+    edgehog_device_handle_t edgehog_device, edgehog_system_status_t *system_status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EDGEHOG_SYSTEM_STATUS_H
@@ -0,0 +1,86 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef EDGEHOG_WIFI_SCAN_H
+#define EDGEHOG_WIFI_SCAN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "edgehog_device.h"
+
+extern const astarte_interface_t wifi_scan_result_interface;
+#if CONFIG_EDGEHOG_WIFI_SCAN_REMOTE_CONFIG
+extern const astarte_interface_t wifi_scan_config_interface;
+#endif
+#if CONFIG_EDGEHOG_WIFI_SCAN_BATCHED
+extern const astarte_interface_t wifi_scan_batch_interface;
+#endif
+
+/**
+ * @brief register the Wi-Fi scan done handler of a device.
+ *
+ * @details The handler stays registered until edgehog_wifi_scan_deinit and only handles the
+ * scans started by edgehog_wifi_scan_start for the same device.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ * @return EDGEHOG_OK if the handler has been registered, an edgehog_err_t otherwise.
+ */
+edgehog_err_t edgehog_wifi_scan_init(edgehog_device_handle_t edgehog_device);
+
+/**
+ * @brief unregister the Wi-Fi scan done handler of a device.
+ *
+ * @details A scan in flight for the device is abandoned, its results are discarded.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ */
+void edgehog_wifi_scan_deinit(edgehog_device_handle_t edgehog_device);
+
+/**
+ * @brief start a Wi-Fi scan.
+ *
+ * @details This function starts an asynchronous Wi-Fi scan, the access points found are
+ * published on Astarte when the scan is done. A request made while a scan is in flight is
+ * served by that scan, a scan that did not complete in time is stopped.
+ *
+ * @param edgehog_device A valid Edgehog device handle.
+ */
+void edgehog_wifi_scan_start(edgehog_device_handle_t edgehog_device);
+
+#if CONFIG_EDGEHOG_WIFI_SCAN_REMOTE_CONFIG
+/**
+ * @brief handle a Wi-Fi scan config event.
+ *
+ * @details This function updates the scan policy used by the next scans, an unset property
+ * restores the Kconfig value.
+ *
+ * @param event_request A valid Astarte device data event.
+ * @return EDGEHOG_OK if the event is handled successfully, an edgehog_err_t otherwise.
+ */
+edgehog_err_t edgehog_wifi_scan_config_event(astarte_device_data_event_t *event_request);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EDGEHOG_WIFI_SCAN_H
@@ -0,0 +1,155 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "edgehog_battery_analytics.h"
+#include "edgehog_device_private.h"
+#include <astarte_bson_serializer.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <math.h>
+
+#define SAMPLE_INTERVAL_US ((int64_t) CONFIG_EDGEHOG_BATTERY_ANALYTICS_SAMPLE_INTERVAL_S * 1000000)
+#define ESTIMATE_UNKNOWN -1
+
+static const char *TAG = "EDGEHOG_BATTERY_ANALYTICS";
+
+// Copy of the window being published, slots are published one at a time by the telemetry timer
+static edgehog_battery_sample_t samples[CONFIG_EDGEHOG_BATTERY_ANALYTICS_WINDOW];
+
+const astarte_interface_t battery_analytics_interface
+    = { .name = "io.edgehog.devicemanager.BatteryAnalytics",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+void edgehog_battery_analytics_init(edgehog_battery_analytics_t *analytics)
+{
+    portMUX_INITIALIZE(&analytics->lock);
+    analytics->state = BATTERY_INVALID;
+}
+
+void edgehog_battery_analytics_add(
+    edgehog_battery_analytics_t *analytics, double level, edgehog_battery_state state)
+{
+    if (!isfinite(level)) {
+        return;
+    }
+
+    edgehog_battery_sample_t sample = { .time_us = esp_timer_get_time(), .level = (float) level };
+    portENTER_CRITICAL(&analytics->lock);
+    if (state != analytics->state) {
+        // A rate is estimated on a single charge or discharge run
+        analytics->state = state;
+        analytics->len = 0;
+        analytics->next = 0;
+    } else if (analytics->len > 0
+        && sample.time_us - analytics->last.time_us < SAMPLE_INTERVAL_US) {
+        portEXIT_CRITICAL(&analytics->lock);
+        return;
+    }
+
+    // Cycles are counted on the samples, so that the noise between them is not accumulated
+    if (analytics->last.time_us != 0 && sample.level < analytics->last.level) {
+        analytics->discharged += analytics->last.level - sample.level;
+    }
+    analytics->last = sample;
+    analytics->samples[analytics->next] = sample;
+    analytics->next = (analytics->next + 1) % CONFIG_EDGEHOG_BATTERY_ANALYTICS_WINDOW;
+    if (analytics->len < CONFIG_EDGEHOG_BATTERY_ANALYTICS_WINDOW) {
+        analytics->len++;
+    }
+    portEXIT_CRITICAL(&analytics->lock);
+}
+
+void edgehog_battery_analytics_publish(edgehog_device_handle_t edgehog_device,
+    edgehog_battery_analytics_t *analytics, const char *path)
+{
+    // Step 1: copy the window and its state
+    portENTER_CRITICAL(&analytics->lock);
+    edgehog_battery_state state = analytics->state;
+    uint8_t len = analytics->len;
+    uint8_t oldest = (analytics->next + CONFIG_EDGEHOG_BATTERY_ANALYTICS_WINDOW - len)
+        % CONFIG_EDGEHOG_BATTERY_ANALYTICS_WINDOW;
+    for (int i = 0; i < len; i++) {
+        samples[i] = analytics->samples[(oldest + i) % CONFIG_EDGEHOG_BATTERY_ANALYTICS_WINDOW];
+    }
+    float discharged = analytics->discharged;
+    portEXIT_CRITICAL(&analytics->lock);
+
+    if (len < 2) {
+        return;
+    }
+
+    // Step 2: fit the level over time by least squares, times in seconds from the oldest sample
+    double mean_time = 0;
+    double mean_level = 0;
+    for (int i = 0; i < len; i++) {
+        mean_time += (samples[i].time_us - samples[0].time_us) / 1e6;
+        mean_level += samples[i].level;
+    }
+    mean_time /= len;
+    mean_level /= len;
+    double covariance = 0;
+    double variance = 0;
+    for (int i = 0; i < len; i++) {
+        double time = (samples[i].time_us - samples[0].time_us) / 1e6 - mean_time;
+        covariance += time * (samples[i].level - mean_level);
+        variance += time * time;
+    }
+    double rate = variance > 0 ? covariance / variance : 0; // Percentage per second
+
+    // Step 3: extrapolate from the fitted level at the newest sample, only in the direction of the
+    // reported state, a slope against it is noise or a load above the charging current
+    double window_s = (samples[len - 1].time_us - samples[0].time_us) / 1e6;
+    double level = fmin(fmax(mean_level + rate * (window_s - mean_time), 0), 100);
+    int64_t time_to_empty_s = ESTIMATE_UNKNOWN;
+    int64_t time_to_full_s = ESTIMATE_UNKNOWN;
+    if (state == BATTERY_DISCHARGING && rate < 0) {
+        time_to_empty_s = llround(level / -rate);
+    } else if (state == BATTERY_CHARGING && rate > 0) {
+        time_to_full_s = llround((100 - level) / rate);
+    }
+
+    // Step 4: publish the estimates
+    astarte_bson_serializer_handle_t bs = astarte_bson_serializer_new();
+    astarte_bson_serializer_append_double(bs, "ratePercentPerHour", rate * 3600);
+    astarte_bson_serializer_append_int64(bs, "timeToEmptySeconds", time_to_empty_s);
+    astarte_bson_serializer_append_int64(bs, "timeToFullSeconds", time_to_full_s);
+    astarte_bson_serializer_append_double(bs, "chargeCycles", discharged / 100.0);
+    astarte_bson_serializer_append_int32(bs, "windowSeconds", (int32_t) window_s);
+    astarte_bson_serializer_append_end_of_document(bs);
+
+    const void *doc = astarte_bson_serializer_get_document(bs, NULL);
+    uint64_t timestamp_ms = edgehog_device_get_timestamp_ms();
+    astarte_err_t res;
+    if (timestamp_ms > 0) {
+        res = astarte_device_stream_aggregate_with_timestamp(edgehog_device->astarte_device,
+            battery_analytics_interface.name, path, doc, timestamp_ms, 0);
+    } else {
+        res = astarte_device_stream_aggregate(
+            edgehog_device->astarte_device, battery_analytics_interface.name, path, doc, 0);
+    }
+    astarte_bson_serializer_destroy(bs);
+
+    if (res != ASTARTE_OK) {
+        ESP_LOGW(TAG, "Unable to publish the battery analytics of %s", path);
+    }
+}
@@ -19,12 +19,28 @@
  */
 
 #include "edgehog_battery_status.h"
+#if CONFIG_EDGEHOG_BATTERY_ANALYTICS
+#include "edgehog_battery_analytics.h"
+#endif
 #include "edgehog_battery_status_p.h"
 #include "edgehog_device_private.h"
+#if CONFIG_EDGEHOG_COMPACT_RECORDS
+#include "edgehog_fixed_point.h"
+#endif
+#include "edgehog_seqlock.h"
 #include <astarte_bson_serializer.h>
 #include <esp_log.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+
+// Buckets of the open addressing index, at most half of them are used
+#define BATTERY_INDEX_SIZE (2 * CONFIG_EDGEHOG_BATTERY_SLOTS)
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+#if CONFIG_EDGEHOG_COMPACT_RECORDS
+#define LEVEL_SCALE 2 // Half percent steps, 100% is 200
+#endif
 
 static const char *TAG = "EDGEHOG_BATTERY";
 
@@ -35,67 +51,135 @@ const astarte_interface_t battery_status_interface
           .ownership = OWNERSHIP_DEVICE,
           .type = TYPE_DATASTREAM };
 
-struct battery_status_t
+#if CONFIG_EDGEHOG_COMPACT_RECORDS
+typedef struct
+{
+    uint8_t level_percentage;
+    uint8_t level_absolute_error;
+    uint8_t battery_state;
+    uint64_t timestamp_ms; // 0 when the clock is not valid
+} battery_record_t;
+
+#define LEVEL_FROM_DOUBLE(level) edgehog_fixed_from_double(level, LEVEL_SCALE, 0, 100 * LEVEL_SCALE)
+#define LEVEL_TO_DOUBLE(level) edgehog_fixed_to_double(level, LEVEL_SCALE)
+#else
+typedef struct
 {
-    astarte_list_head_t head;
-    bool updated;
-    char *battery_slot;
     double level_percentage;
     double level_absolute_error;
     edgehog_battery_state battery_state;
+    uint64_t timestamp_ms; // 0 when the clock is not valid
+} battery_record_t;
+
+#define LEVEL_FROM_DOUBLE(level) normalize_error_level(level)
+#define LEVEL_TO_DOUBLE(level) (level)
+#endif
+
+typedef struct
+{
+    battery_record_t latest;
+    uint32_t updates; // Number of the latest update, counted from the first one
+#if CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE > 0
+    // Ring of the updates replaced by a later one, indexed by their number
+    battery_record_t history[CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE];
+#endif
+} battery_samples_t;
+
+struct battery_status_t
+{
+    uint32_t hash;
+    // Interned slot name, stored with a leading '/' to be used as path
+    char path[CONFIG_EDGEHOG_BATTERY_SLOT_NAME_MAX_LEN + 2];
+    // Writers change the record from application tasks, the publisher copies it
+    edgehog_seqlock_t seqlock;
+    battery_samples_t samples;
+    // Number of the last published update, only changed by the publisher
+    atomic_uint published;
+#if CONFIG_EDGEHOG_BATTERY_ANALYTICS
+    edgehog_battery_analytics_t analytics;
+#endif
+};
+
+struct edgehog_battery_table_t
+{
+    portMUX_TYPE lock; // Serializes the slots insertion, lookups take no lock
+    atomic_uint_least16_t count;
+    // Slot number plus one, 0 for an empty bucket
+    atomic_uint_least16_t index[BATTERY_INDEX_SIZE];
+    struct battery_status_t slots[CONFIG_EDGEHOG_BATTERY_SLOTS];
 };
 
 static const char *edgehog_battery_to_code(edgehog_battery_state state);
+#if !CONFIG_EDGEHOG_COMPACT_RECORDS
 static double normalize_error_level(double level);
+#endif
+static uint32_t hash_battery_slot(const char *battery_slot, size_t *len);
+static astarte_err_t publish_battery_record(edgehog_device_handle_t edgehog_device,
+    const char *path, const battery_record_t *record);
+static uint32_t read_battery_record(
+    struct battery_status_t *battery, uint32_t after, battery_record_t *record);
+static struct battery_status_t *find_battery(edgehog_battery_table_t *battery_table,
+    const char *battery_slot, uint32_t hash, size_t *free_bucket);
 
-void edgehog_battery_status_delete_list(astarte_list_head_t *battery_list)
+edgehog_battery_table_t *edgehog_battery_status_table_new(void)
 {
-    astarte_list_head_t *item;
-    astarte_list_head_t *tmp;
-    MUTABLE_LIST_FOR_EACH(item, tmp, battery_list)
-    {
-        struct battery_status_t *status = GET_LIST_ENTRY(item, struct battery_status_t, head);
-        free(status->battery_slot);
-        free(status);
+    // Slots are never released, the table is allocated once for the device lifetime
+    edgehog_battery_table_t *battery_table = calloc(1, sizeof(edgehog_battery_table_t));
+    if (!battery_table) {
+        return NULL;
     }
-}
 
-static struct battery_status_t *find_battery(
-    astarte_list_head_t *battery_list, const char *battery_slot)
-{
-    astarte_list_head_t *item;
-    LIST_FOR_EACH(item, battery_list)
-    {
-        struct battery_status_t *status = GET_LIST_ENTRY(item, struct battery_status_t, head);
-        if (strcmp(status->battery_slot, battery_slot) == 0) {
-            return status;
-        }
+    portMUX_INITIALIZE(&battery_table->lock);
+    for (int i = 0; i < CONFIG_EDGEHOG_BATTERY_SLOTS; i++) {
+        edgehog_seqlock_init(&battery_table->slots[i].seqlock);
+#if CONFIG_EDGEHOG_BATTERY_ANALYTICS
+        edgehog_battery_analytics_init(&battery_table->slots[i].analytics);
+#endif
     }
 
-    return NULL;
+    return battery_table;
+}
+
+void edgehog_battery_status_table_destroy(edgehog_battery_table_t *battery_table)
+{
+    free(battery_table);
 }
 
 static struct battery_status_t *get_battery_status(
-    edgehog_device_handle_t edgehog_device, const char *battery_slot)
+    edgehog_battery_table_t *battery_table, const char *battery_slot)
 {
-    struct battery_status_t *status = find_battery(&edgehog_device->battery_list, battery_slot);
-    if (!status) {
-        status = calloc(1, sizeof(struct battery_status_t));
-        if (!status) {
-            return NULL;
-        }
+    size_t len = 0;
+    uint32_t hash = hash_battery_slot(battery_slot, &len);
+    if (len > CONFIG_EDGEHOG_BATTERY_SLOT_NAME_MAX_LEN) {
+        ESP_LOGE(TAG, "Battery slot name too long: %s", battery_slot);
+        return NULL;
+    }
 
-        status->updated = false;
-        status->battery_slot = strdup(battery_slot);
-        status->level_percentage = 0;
-        status->level_absolute_error = 0;
-        status->battery_state = BATTERY_INVALID;
-        if (!status->battery_slot) {
-            free(status);
-            return NULL;
-        }
+    size_t bucket = 0;
+    struct battery_status_t *status = find_battery(battery_table, battery_slot, hash, &bucket);
+    if (status) {
+        return status;
+    }
+
+    // Look up again under the lock, another task may have added the same slot
+    portENTER_CRITICAL(&battery_table->lock);
+    status = find_battery(battery_table, battery_slot, hash, &bucket);
+    uint16_t count = atomic_load_explicit(&battery_table->count, memory_order_relaxed);
+    if (!status && count < CONFIG_EDGEHOG_BATTERY_SLOTS) {
+        status = &battery_table->slots[count];
+        status->hash = hash;
+        status->path[0] = '/';
+        memcpy(status->path + 1, battery_slot, len + 1);
+        status->samples.latest.battery_state = BATTERY_INVALID;
+        // The slot is visible to lookups and to the publisher once fully initialized
+        atomic_store_explicit(&battery_table->index[bucket], count + 1, memory_order_release);
+        atomic_store_explicit(&battery_table->count, count + 1, memory_order_release);
+    }
+    portEXIT_CRITICAL(&battery_table->lock);
 
-        astarte_list_append(&edgehog_device->battery_list, &status->head);
+    if (!status) {
+        ESP_LOGE(TAG, "Unable to add battery slot %s, all %d slots are in use", battery_slot,
+            CONFIG_EDGEHOG_BATTERY_SLOTS);
     }
 
     return status;
@@ -104,63 +188,135 @@ static struct battery_status_t *get_battery_status(
 void edgehog_battery_status_update(
     edgehog_device_handle_t edgehog_device, const edgehog_battery_status_t *update)
 {
-    struct battery_status_t *status = get_battery_status(edgehog_device, update->battery_slot);
+    struct battery_status_t *status
+        = get_battery_status(edgehog_device->battery_table, update->battery_slot);
     if (!status) {
-        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
         return;
     }
 
-    double normal_level_percentage = normalize_error_level(update->level_percentage);
-    double normal_level_absolute_error = normalize_error_level(update->level_absolute_error);
+    battery_record_t record = {
+        .level_percentage = LEVEL_FROM_DOUBLE(update->level_percentage),
+        .level_absolute_error = LEVEL_FROM_DOUBLE(update->level_absolute_error),
+        .battery_state = update->battery_state,
+        .timestamp_ms = edgehog_device_get_timestamp_ms(),
+    };
+
+#if CONFIG_EDGEHOG_BATTERY_ANALYTICS
+    edgehog_battery_analytics_add(
+        &status->analytics, update->level_percentage, update->battery_state);
+#endif
 
-    if (!status->updated
-        && (status->level_percentage != normal_level_percentage
-            || status->level_absolute_error != normal_level_absolute_error
-            || status->battery_state != update->battery_state)) {
-        status->updated = true;
-        status->level_percentage = normal_level_percentage;
-        status->level_absolute_error = normal_level_absolute_error;
-        status->battery_state = update->battery_state;
+    // The latest update wins, the ones it replaces are optionally kept
+    edgehog_seqlock_lock(&status->seqlock);
+    battery_samples_t *samples = &status->samples;
+    if (samples->latest.level_percentage == record.level_percentage
+        && samples->latest.level_absolute_error == record.level_absolute_error
+        && samples->latest.battery_state == record.battery_state) {
+        edgehog_seqlock_unlock(&status->seqlock);
+        return;
+    }
+    edgehog_seqlock_write_begin(&status->seqlock);
+#if CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE > 0
+    if (samples->updates > 0) {
+        samples->history[samples->updates % CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE] = samples->latest;
     }
+#endif
+    samples->latest = record;
+    samples->updates++;
+    edgehog_seqlock_write_end(&status->seqlock);
+    edgehog_seqlock_unlock(&status->seqlock);
 }
 
 void edgehog_battery_status_publish(edgehog_device_handle_t edgehog_device)
 {
-    astarte_list_head_t *item;
-    LIST_FOR_EACH(item, &edgehog_device->battery_list)
-    {
-        struct battery_status_t *battery = GET_LIST_ENTRY(item, struct battery_status_t, head);
+    edgehog_battery_table_t *battery_table = edgehog_device->battery_table;
+    uint16_t count = atomic_load_explicit(&battery_table->count, memory_order_acquire);
+    for (int i = 0; i < count; i++) {
+        struct battery_status_t *battery = &battery_table->slots[i];
 
-        if (!battery->updated) {
-            continue;
+        // The records are copied one at a time, the number of the last published one is kept so
+        // that the updates written meanwhile are published once, at most a ring more per call
+        uint32_t published = atomic_load_explicit(&battery->published, memory_order_relaxed);
+        for (int j = 0; j <= CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE; j++) {
+            battery_record_t record;
+            uint32_t number = read_battery_record(battery, published, &record);
+            if (number == published) {
+                break;
+            }
+            if (number - published > 1) {
+                ESP_LOGD(TAG, "Battery slot %s: %u updates replaced before being published",
+                    battery->path + 1, (unsigned int) (number - published - 1));
+            }
+            if (publish_battery_record(edgehog_device, battery->path, &record) != ASTARTE_OK) {
+                break;
+            }
+            published = number;
         }
+        atomic_store_explicit(&battery->published, published, memory_order_relaxed);
+    }
+}
 
-        astarte_bson_serializer_handle_t bs = astarte_bson_serializer_new();
-        astarte_bson_serializer_append_double(bs, "levelPercentage", battery->level_percentage);
-        astarte_bson_serializer_append_double(
-            bs, "levelAbsoluteError", battery->level_absolute_error);
-        const char *battery_status = edgehog_battery_to_code(battery->battery_state);
-        astarte_bson_serializer_append_string(bs, "status", battery_status);
-        astarte_bson_serializer_append_end_of_document(bs);
-
-        size_t path_size = strlen(battery->battery_slot) + 2;
-        char *path = malloc(path_size);
-        if (!path) {
-            ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
-            return;
-        }
-        snprintf(path, path_size, "/%s", battery->battery_slot);
+#if CONFIG_EDGEHOG_BATTERY_ANALYTICS
+void edgehog_battery_status_publish_analytics(edgehog_device_handle_t edgehog_device)
+{
+    edgehog_battery_table_t *battery_table = edgehog_device->battery_table;
+    uint16_t count = atomic_load_explicit(&battery_table->count, memory_order_acquire);
+    for (int i = 0; i < count; i++) {
+        struct battery_status_t *battery = &battery_table->slots[i];
+        edgehog_battery_analytics_publish(edgehog_device, &battery->analytics, battery->path);
+    }
+}
+#endif
 
-        const void *doc = astarte_bson_serializer_get_document(bs, NULL);
-        astarte_err_t res = astarte_device_stream_aggregate(
+static astarte_err_t publish_battery_record(edgehog_device_handle_t edgehog_device,
+    const char *path, const battery_record_t *record)
+{
+    astarte_bson_serializer_handle_t bs = astarte_bson_serializer_new();
+    astarte_bson_serializer_append_double(
+        bs, "levelPercentage", LEVEL_TO_DOUBLE(record->level_percentage));
+    astarte_bson_serializer_append_double(
+        bs, "levelAbsoluteError", LEVEL_TO_DOUBLE(record->level_absolute_error));
+    const char *battery_status = edgehog_battery_to_code(record->battery_state);
+    astarte_bson_serializer_append_string(bs, "status", battery_status);
+    astarte_bson_serializer_append_end_of_document(bs);
+
+    const void *doc = astarte_bson_serializer_get_document(bs, NULL);
+    astarte_err_t res;
+    if (record->timestamp_ms > 0) {
+        res = astarte_device_stream_aggregate_with_timestamp(edgehog_device->astarte_device,
+            battery_status_interface.name, path, doc, record->timestamp_ms, 0);
+    } else {
+        res = astarte_device_stream_aggregate(
             edgehog_device->astarte_device, battery_status_interface.name, path, doc, 0);
-        astarte_bson_serializer_destroy(bs);
-        free(path);
+    }
+    astarte_bson_serializer_destroy(bs);
+    return res;
+}
 
-        if (res == ASTARTE_OK) {
-            battery->updated = false;
+// Copies the first update after the given number still stored, returns its number, or the given
+// number when there is no later update
+static uint32_t read_battery_record(
+    struct battery_status_t *battery, uint32_t after, battery_record_t *record)
+{
+    uint32_t number;
+    unsigned int seq;
+    do {
+        seq = edgehog_seqlock_read_begin(&battery->seqlock);
+        number = battery->samples.updates;
+#if CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE > 0
+        // The ring keeps the updates before the latest one, the older ones are lost
+        if (number - after > 1) {
+            uint32_t oldest = number - CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE;
+            number = number - after > CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE + 1 ? oldest : after + 1;
+            *record = battery->samples.history[number % CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE];
+        } else {
+            *record = battery->samples.latest;
         }
-    }
+#else
+        *record = battery->samples.latest;
+#endif
+    } while (edgehog_seqlock_read_retry(&battery->seqlock, seq));
+    return number;
 }
 
 static const char *edgehog_battery_to_code(edgehog_battery_state state)
@@ -185,6 +341,7 @@ static const char *edgehog_battery_to_code(edgehog_battery_state state)
     }
 }
 
+#if !CONFIG_EDGEHOG_COMPACT_RECORDS
 static double normalize_error_level(double level)
 {
     if (level > 100) {
@@ -194,3 +351,35 @@ static double normalize_error_level(double level)
     }
     return level;
 }
+#endif
+
+static uint32_t hash_battery_slot(const char *battery_slot, size_t *len)
+{
+    // FNV-1a, the length is measured in the same pass
+    uint32_t hash = FNV_OFFSET_BASIS;
+    const char *c = battery_slot;
+    for (; *c; c++) {
+        hash = (hash ^ (uint8_t) *c) * FNV_PRIME;
+    }
+    *len = c - battery_slot;
+    return hash;
+}
+
+static struct battery_status_t *find_battery(edgehog_battery_table_t *battery_table,
+    const char *battery_slot, uint32_t hash, size_t *free_bucket)
+{
+    // Linear probing, the index is never more than half full so an empty bucket is always found
+    size_t bucket = hash % BATTERY_INDEX_SIZE;
+    uint16_t slot;
+    while ((slot = atomic_load_explicit(&battery_table->index[bucket], memory_order_acquire))
+        != 0) {
+        struct battery_status_t *status = &battery_table->slots[slot - 1];
+        if (status->hash == hash && strcmp(status->path + 1, battery_slot) == 0) {
+            return status;
+        }
+        bucket = (bucket + 1) % BATTERY_INDEX_SIZE;
+    }
+
+    *free_bucket = bucket;
+    return NULL;
+}
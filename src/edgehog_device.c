@@ -19,6 +19,9 @@
  */
 
 #include "edgehog_base_image.h"
+#if CONFIG_EDGEHOG_BATTERY_ANALYTICS
+#include "edgehog_battery_analytics.h"
+#endif
 #include "edgehog_battery_status.h"
 #include "edgehog_battery_status_p.h"
 #include "edgehog_cellular_connection.h"
@@ -26,11 +29,16 @@
 #include "edgehog_device_private.h"
 #include "edgehog_geolocation.h"
 #include "edgehog_geolocation_p.h"
+#if CONFIG_EDGEHOG_GEOLOCATION_TRACK
+#include "edgehog_geolocation_track.h"
+#endif
 #include "edgehog_network_interface.h"
 #include "edgehog_os_info.h"
-#include "edgehog_ota.h"
+#include "edgehog_ota_p.h"
+#include "edgehog_ota_perf.h"
 #include "edgehog_runtime_info.h"
 #include "edgehog_storage_usage.h"
+#include "edgehog_wifi_scan.h"
 #include "esp_system.h"
 #include <astarte_bson_serializer.h>
 #if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
@@ -40,9 +48,8 @@
 #include <esp_heap_caps.h>
 #include <esp_log.h>
 #include <esp_timer.h>
-#include <esp_wifi.h>
-#include <esp_wifi_types.h>
 #include <string.h>
+#include <sys/time.h>
 #include <uuid.h>
 
 #define SYSTEM_NAMESPACE "eh_system"
@@ -56,13 +63,6 @@ const static astarte_interface_t hardware_info_interface
           .ownership = OWNERSHIP_DEVICE,
           .type = TYPE_PROPERTIES };
 
-const static astarte_interface_t wifi_scan_result_interface
-    = { .name = "io.edgehog.devicemanager.WiFiScanResults",
-          .major_version = 0,
-          .minor_version = 2,
-          .ownership = OWNERSHIP_DEVICE,
-          .type = TYPE_DATASTREAM };
-
 const static astarte_interface_t system_status_status_interface
     = { .name = "io.edgehog.devicemanager.SystemStatus",
           .major_version = 0,
@@ -82,30 +82,6 @@ ESP_EVENT_DEFINE_BASE(EDGEHOG_EVENTS);
 static esp_err_t add_interfaces(astarte_device_handle_t astarte_device);
 static void publish_device_hardware_info(edgehog_device_handle_t edgehog_device);
 static void publish_system_status(edgehog_device_handle_t edgehog_device);
-static void publish_wifi_ap(edgehog_device_handle_t edgehog_device);
-static void scan_wifi_ap(edgehog_device_handle_t edgehog_device);
-static inline bool compare_mac_address(const uint8_t a[], const uint8_t b[]);
-
-static void edgehog_event_handler(
-    void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
-{
-    if (!arg || !event_data) {
-        return;
-    }
-
-    // this if statement could become a double nested switch statement in the future
-    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE) {
-        wifi_event_sta_scan_done_t *wifi_event_sta_scan_done
-            = (wifi_event_sta_scan_done_t *) event_data;
-        edgehog_device_handle_t edgehog_device = (edgehog_device_handle_t) arg;
-        if (wifi_event_sta_scan_done->status == 0) {
-            // status of scanning APs: 0 — success, 1 - failure
-            publish_wifi_ap(edgehog_device);
-            esp_event_handler_instance_unregister(
-                WIFI_EVENT, WIFI_EVENT_SCAN_DONE, edgehog_event_handler);
-        }
-    }
-}
 
 void edgehog_device_astarte_event_handler(
     edgehog_device_handle_t edgehog_device, astarte_device_data_event_t *event)
@@ -131,6 +107,13 @@ void edgehog_device_astarte_event_handler(
             ESP_LOGI(TAG, "Telemetry config update handled successfully");
         }
     }
+#if CONFIG_EDGEHOG_WIFI_SCAN_REMOTE_CONFIG
+    if (strcmp(event->interface_name, wifi_scan_config_interface.name) == 0) {
+        if (edgehog_wifi_scan_config_event(event) != EDGEHOG_OK) {
+            ESP_LOGE(TAG, "Unable to handle Wi-Fi scan config request");
+        }
+    }
+#endif
 #if CONFIG_INDICATOR_GPIO_ENABLE
     if (strcmp(event->interface_name, led_request_interface.name) == 0) {
         ESP_LOGI(TAG, "Incoming request for led behavior");
@@ -172,8 +155,23 @@ edgehog_device_handle_t edgehog_device_new(edgehog_device_config_t *config)
         edgehog_device->partition_name = NVS_DEFAULT_PART_NAME;
     }
 
-    astarte_list_init(&edgehog_device->battery_list);
     astarte_list_init(&edgehog_device->geolocation_list);
+    edgehog_device->battery_table = edgehog_battery_status_table_new();
+    if (!edgehog_device->battery_table) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        goto error;
+    }
+
+#if CONFIG_EDGEHOG_SYSTEM_STATUS_EXTENDED
+    edgehog_device->system_status = edgehog_system_status_new();
+    if (!edgehog_device->system_status) {
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        goto error;
+    }
+#endif
+
+    edgehog_device->ota_throttle.max_bytes_per_sec = CONFIG_EDGEHOG_OTA_MAX_BYTES_PER_SEC;
+    edgehog_device->ota_throttle.priority = EDGEHOG_OTA_PRIORITY_NORMAL;
 
     ESP_ERROR_CHECK(add_interfaces(config->astarte_device));
 #if CONFIG_INDICATOR_GPIO_ENABLE
@@ -187,6 +185,10 @@ edgehog_device_handle_t edgehog_device_new(edgehog_device_config_t *config)
     }
     edgehog_device->edgehog_telemetry = edgehog_telemetry;
 
+    if (edgehog_wifi_scan_init(edgehog_device) != EDGEHOG_OK) {
+        ESP_LOGE(TAG, "Wi-Fi scan results will not be published");
+    }
+
     return edgehog_device;
 
 error:
@@ -203,7 +205,7 @@ static void edgehog_initial_publish(edgehog_device_handle_t edgehog_device)
     edgehog_device_publish_os_info(edgehog_device);
     edgehog_base_image_data_publish(edgehog_device);
     edgehog_runtime_info_publish(edgehog_device);
-    scan_wifi_ap(edgehog_device);
+    edgehog_wifi_scan_start(edgehog_device);
 }
 
 edgehog_err_t edgehog_device_start(edgehog_device_handle_t edgehog_device)
@@ -224,23 +226,44 @@ esp_err_t add_interfaces(astarte_device_handle_t device)
     const astarte_interface_t *const interfaces[]
         = { &hardware_info_interface,
               &system_status_status_interface,
+#if CONFIG_EDGEHOG_SYSTEM_STATUS_EXTENDED
+              &extended_system_status_interface,
+#endif
+#if CONFIG_EDGEHOG_HEAP_MONITOR
+              &heap_fragmentation_interface,
+#endif
               &wifi_scan_result_interface,
+#if CONFIG_EDGEHOG_WIFI_SCAN_BATCHED
+              &wifi_scan_batch_interface,
+#endif
               &system_info_interface,
               &ota_request_interface,
               &ota_event_interface,
+#if CONFIG_EDGEHOG_OTA_PERF_TELEMETRY
+              &ota_performance_interface,
+#endif
               &storage_usage_interface,
               &battery_status_interface,
+#if CONFIG_EDGEHOG_BATTERY_ANALYTICS
+              &battery_analytics_interface,
+#endif
               &commands_interface,
 #if CONFIG_INDICATOR_GPIO_ENABLE
               &led_request_interface,
 #endif
               &telemetry_config_interface,
+#if CONFIG_EDGEHOG_WIFI_SCAN_REMOTE_CONFIG
+              &wifi_scan_config_interface,
+#endif
               &os_info_interface,
               &base_image_interface,
               &runtime_info_interface,
               &cellular_connection_properties_interface,
               &cellular_connection_status_interface,
               &netif_interface,
+#if CONFIG_EDGEHOG_GEOLOCATION_TRACK
+              &geolocation_track_interface,
+#endif
               &geolocation_interface };
 
     int len = sizeof(interfaces) / sizeof(const astarte_interface_t *);
@@ -332,72 +355,10 @@ static void publish_system_status(edgehog_device_handle_t edgehog_device)
     astarte_device_stream_aggregate(edgehog_device->astarte_device,
         system_status_status_interface.name, "/systemStatus", doc, 0);
     astarte_bson_serializer_destroy(bs);
-}
-
-static void scan_wifi_ap(edgehog_device_handle_t edgehog_device)
-{
-    // Register the event at every scan and unregister it at every publish to avoid
-    // catching event generated by third party scan
-    esp_err_t ret = esp_event_handler_instance_register(
-        WIFI_EVENT, WIFI_EVENT_SCAN_DONE, edgehog_event_handler, edgehog_device, NULL);
-
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG,
-            "Unable to register to default event loop. Be sure to have called "
-            "esp_event_loop_create_default() before calling edgehog_device_new");
-        return;
-    }
-
-    wifi_scan_config_t config = { .show_hidden = true,
-        .scan_type = WIFI_SCAN_TYPE_ACTIVE,
-        .scan_time = { .active = { .max = 120 } } };
-
-    esp_wifi_scan_start(&config, false);
-}
-
-static void publish_wifi_ap(edgehog_device_handle_t edgehog_device)
-{
-    uint16_t ap_count = 0;
-    esp_err_t ret = esp_wifi_scan_get_ap_num(&ap_count);
-    if (ret != ESP_OK) {
-        return;
-    }
-
-    wifi_ap_record_t *ap_info = (wifi_ap_record_t *) malloc(ap_count * sizeof(wifi_ap_record_t));
-    if (!ap_info) {
-        ESP_LOGE(TAG, "Unable to allocate memory for %d access point records", ap_count);
-        return;
-    }
-
-    wifi_ap_record_t ap_info_connected;
-    bool ap_is_connected = esp_wifi_sta_get_ap_info(&ap_info_connected) == ESP_OK;
 
-    ret = esp_wifi_scan_get_ap_records(&ap_count, ap_info);
-    if (ret != ESP_OK) {
-        free(ap_info);
-        return;
-    }
-    for (int i = 0; i < ap_count; i++) {
-        char mac[18];
-        snprintf(mac, 18, "%02x:%02x:%02x:%02x:%02x:%02x", ap_info[i].bssid[0], ap_info[i].bssid[1],
-            ap_info[i].bssid[2], ap_info[i].bssid[3], ap_info[i].bssid[4], ap_info[i].bssid[5]);
-
-        astarte_bson_serializer_handle_t bs = astarte_bson_serializer_new();
-        astarte_bson_serializer_append_int32(bs, "channel", ap_info[i].primary);
-        astarte_bson_serializer_append_string(bs, "essid", (char *) ap_info[i].ssid);
-        astarte_bson_serializer_append_string(bs, "macAddress", mac);
-        astarte_bson_serializer_append_int32(bs, "rssi", ap_info[i].rssi);
-        astarte_bson_serializer_append_boolean(bs, "connected",
-            ap_is_connected && compare_mac_address(ap_info[i].bssid, ap_info_connected.bssid));
-        astarte_bson_serializer_append_end_of_document(bs);
-
-        const void *doc = astarte_bson_serializer_get_document(bs, NULL);
-        astarte_device_stream_aggregate(
-            edgehog_device->astarte_device, wifi_scan_result_interface.name, "/ap", doc, 0);
-        astarte_bson_serializer_destroy(bs);
-    }
-
-    free(ap_info);
+#if CONFIG_EDGEHOG_SYSTEM_STATUS_EXTENDED
+    edgehog_system_status_publish(edgehog_device, edgehog_device->system_status);
+#endif
 }
 
 static esp_err_t edgehog_nvs_set_str(const char *partition_name, const char *key, char *value)
@@ -512,10 +473,14 @@ end:
 void edgehog_device_destroy(edgehog_device_handle_t edgehog_device)
 {
     if (edgehog_device) {
+        edgehog_wifi_scan_deinit(edgehog_device);
         astarte_device_destroy(edgehog_device->astarte_device);
-        edgehog_battery_status_delete_list(&edgehog_device->battery_list);
+        edgehog_battery_status_table_destroy(edgehog_device->battery_table);
         edgehog_geolocation_delete_list(&edgehog_device->geolocation_list);
         edgehog_telemetry_destroy(edgehog_device->edgehog_telemetry);
+#if CONFIG_EDGEHOG_SYSTEM_STATUS_EXTENDED
+        edgehog_system_status_destroy(edgehog_device->system_status);
+#endif
     }
 
     free(edgehog_device);
@@ -554,7 +519,7 @@ telemetry_periodic edgehog_device_get_telemetry_periodic(telemetry_type_t type)
         case EDGEHOG_TELEMETRY_HW_INFO:
             return publish_device_hardware_info;
         case EDGEHOG_TELEMETRY_WIFI_SCAN:
-            return scan_wifi_ap;
+            return edgehog_wifi_scan_start;
         case EDGEHOG_TELEMETRY_SYSTEM_STATUS:
             return publish_system_status;
         case EDGEHOG_TELEMETRY_STORAGE_USAGE:
@@ -563,6 +528,14 @@ telemetry_periodic edgehog_device_get_telemetry_periodic(telemetry_type_t type)
             return edgehog_battery_status_publish;
         case EDGEHOG_TELEMETRY_GEOLOCATION_INFO:
             return edgehog_geolocation_publish;
+#if CONFIG_EDGEHOG_BATTERY_ANALYTICS
+        case EDGEHOG_TELEMETRY_BATTERY_ANALYTICS:
+            return edgehog_battery_status_publish_analytics;
+#endif
+#if CONFIG_EDGEHOG_HEAP_MONITOR
+        case EDGEHOG_TELEMETRY_HEAP_MONITOR:
+            return edgehog_heap_monitor_sample;
+#endif
         default:
             return NULL;
     }
@@ -582,12 +555,24 @@ telemetry_type_t edgehog_device_get_telemetry_type(const char *interface_name)
         return EDGEHOG_TELEMETRY_BATTERY_STATUS;
     } else if (strcmp(interface_name, geolocation_interface.name) == 0) {
         return EDGEHOG_TELEMETRY_GEOLOCATION_INFO;
+#if CONFIG_EDGEHOG_BATTERY_ANALYTICS
+    } else if (strcmp(interface_name, battery_analytics_interface.name) == 0) {
+        return EDGEHOG_TELEMETRY_BATTERY_ANALYTICS;
+#endif
+#if CONFIG_EDGEHOG_HEAP_MONITOR
+    } else if (strcmp(interface_name, heap_fragmentation_interface.name) == 0) {
+        return EDGEHOG_TELEMETRY_HEAP_MONITOR;
+#endif
     } else {
         return EDGEHOG_TELEMETRY_INVALID;
     }
 }
 
-static inline bool compare_mac_address(const uint8_t a[], const uint8_t b[])
+uint64_t edgehog_device_get_timestamp_ms(void)
 {
-    return memcmp(a, b, 6) == 0;
+    struct timeval now;
+    if (gettimeofday(&now, NULL) != 0 || now.tv_sec < EDGEHOG_MIN_VALID_EPOCH_S) {
+        return 0;
+    }
+    return (uint64_t) now.tv_sec * 1000 + now.tv_usec / 1000;
 }
@@ -21,8 +21,30 @@
 #include "edgehog_geolocation.h"
 #include "astarte_bson_serializer.h"
 #include "edgehog_device_private.h"
+#if CONFIG_EDGEHOG_COMPACT_RECORDS
+#include "edgehog_fixed_point.h"
+#endif
 #include "edgehog_geolocation_p.h"
+#if CONFIG_EDGEHOG_GEOLOCATION_TRACK
+#include "edgehog_geolocation_track.h"
+#endif
+#include "edgehog_seqlock.h"
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <math.h>
+
+#define EARTH_MEAN_RADIUS_M 6371008.8
+#define DEG_TO_RAD(deg) ((deg) * (M_PI / 180.0))
+#define GEOLOCATION_FILTER_ENABLED                                                                 \
+    (CONFIG_EDGEHOG_GEOLOCATION_MIN_DISTANCE_M > 0                                                 \
+        || CONFIG_EDGEHOG_GEOLOCATION_MIN_HEADING_DEG > 0                                          \
+        || CONFIG_EDGEHOG_GEOLOCATION_MIN_SPEED_CHANGE_CM_S > 0)
+#if CONFIG_EDGEHOG_COMPACT_RECORDS
+#define ACCURACY_SCALE 10 // Decimetres
+#define ALTITUDE_SCALE 1 // Metres
+#define HEADING_SCALE 10 // Tenths of degree
+#define SPEED_SCALE 100 // Centimetres per second
+#endif
 
 static const char *TAG = "EDGEHOG_GEOLOCATION";
 
@@ -32,11 +54,21 @@ const astarte_interface_t geolocation_interface = { .name = "io.edgehog.devicema
     .ownership = OWNERSHIP_DEVICE,
     .type = TYPE_DATASTREAM };
 
-struct geolocation_info_t
+#if CONFIG_EDGEHOG_COMPACT_RECORDS
+typedef struct
+{
+    int32_t longitude;
+    int32_t latitude;
+    uint16_t accuracy;
+    uint16_t altitude_accuracy;
+    int16_t altitude;
+    int16_t heading;
+    int16_t speed;
+    uint64_t timestamp_ms; // 0 when the clock is not valid
+} geolocation_record_t;
+#else
+typedef struct
 {
-    astarte_list_head_t head;
-    bool updated;
-    char *id;
     double longitude;
     double latitude;
     double accuracy;
@@ -44,8 +76,55 @@ struct geolocation_info_t
     double altitude_accuracy;
     double heading;
     double speed;
+    uint64_t timestamp_ms; // 0 when the clock is not valid
+} geolocation_record_t;
+#endif
+
+typedef struct
+{
+    geolocation_record_t latest;
+    uint32_t updates; // Number of the latest update, counted from the first one
+#if CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE > 0
+    // Ring of the updates replaced by a later one, indexed by their number
+    geolocation_record_t history[CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE];
+#endif
+} geolocation_samples_t;
+
+struct geolocation_info_t
+{
+    astarte_list_head_t head;
+    char *id;
+    // Writers change the record from application tasks, the publisher copies it
+    edgehog_seqlock_t seqlock;
+    geolocation_samples_t samples;
+    int64_t accepted_us; // Time of the last update accepted by the filter, 0 before the first one
+#if CONFIG_EDGEHOG_GEOLOCATION_TRACK
+    edgehog_geolocation_track_t *track; // Every update, published simplified
+#endif
+    // Number of the last published update, only changed by the publisher
+    atomic_uint published;
 };
 
+// Serializes the list changes and the reads of the links, entries are removed only on destroy
+static portMUX_TYPE geolocation_list_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static astarte_list_head_t *next_geolocation(astarte_list_head_t *item);
+static void free_geolocation_info(struct geolocation_info_t *status);
+static void encode_geolocation_record(
+    const edgehog_geolocation_data_t *data, geolocation_record_t *record);
+static void decode_geolocation_record(
+    const geolocation_record_t *record, edgehog_geolocation_data_t *data);
+static uint32_t read_geolocation_record(
+    struct geolocation_info_t *status, uint32_t after, geolocation_record_t *record);
+static astarte_err_t publish_geolocation_record(edgehog_device_handle_t edgehog_device,
+    const char *path, const geolocation_record_t *record);
+static bool is_significant_update(const edgehog_geolocation_data_t *previous,
+    const edgehog_geolocation_data_t *update, int64_t elapsed_us);
+#if CONFIG_EDGEHOG_GEOLOCATION_MIN_DISTANCE_M > 0
+static double haversine_distance_m(
+    const edgehog_geolocation_data_t *from, const edgehog_geolocation_data_t *to);
+#endif
+
 void edgehog_geolocation_delete_list(astarte_list_head_t *geolocation_list)
 {
     astarte_list_head_t *item;
@@ -53,17 +132,15 @@ void edgehog_geolocation_delete_list(astarte_list_head_t *geolocation_list)
     MUTABLE_LIST_FOR_EACH(item, tmp, geolocation_list)
     {
         struct geolocation_info_t *status = GET_LIST_ENTRY(item, struct geolocation_info_t, head);
-        free(status->id);
-        free(status);
+        free_geolocation_info(status);
     }
 }
 
 static struct geolocation_info_t *find_geolocation(
     astarte_list_head_t *geolocation_list, const char *gps_id)
 {
-    astarte_list_head_t *item;
-    LIST_FOR_EACH(item, geolocation_list)
-    {
+    for (astarte_list_head_t *item = next_geolocation(geolocation_list); item != geolocation_list;
+         item = next_geolocation(item)) {
         struct geolocation_info_t *status = GET_LIST_ENTRY(item, struct geolocation_info_t, head);
         if (strcmp(status->id, gps_id) == 0) {
             return status;
@@ -77,27 +154,47 @@ static struct geolocation_info_t *get_geolocation_info(
     edgehog_device_handle_t edgehog_device, const char *gps_id)
 {
     struct geolocation_info_t *status = find_geolocation(&edgehog_device->geolocation_list, gps_id);
-    if (!status) {
-        status = calloc(1, sizeof(struct geolocation_info_t));
-        if (!status) {
-            return NULL;
-        }
+    if (status) {
+        return status;
+    }
+
+    struct geolocation_info_t *new_status = calloc(1, sizeof(struct geolocation_info_t));
+    if (!new_status) {
+        return NULL;
+    }
+    new_status->id = strdup(gps_id);
+#if CONFIG_EDGEHOG_GEOLOCATION_TRACK
+    new_status->track = edgehog_geolocation_track_new();
+    if (!new_status->track) {
+        free_geolocation_info(new_status);
+        return NULL;
+    }
+#endif
+    if (!new_status->id) {
+        free_geolocation_info(new_status);
+        return NULL;
+    }
+    edgehog_seqlock_init(&new_status->seqlock);
 
-        status->updated = false;
-        status->id = strdup(gps_id);
-        status->longitude = 0;
-        status->latitude = 0;
-        status->accuracy = 0;
-        status->altitude = 0;
-        status->altitude_accuracy = 0;
-        status->heading = 0;
-        status->speed = 0;
-        if (!status->id) {
-            free(status);
-            return NULL;
+    // Look up again under the lock, another task may have added the same receiver
+    portENTER_CRITICAL(&geolocation_list_lock);
+    astarte_list_head_t *item;
+    LIST_FOR_EACH(item, &edgehog_device->geolocation_list)
+    {
+        struct geolocation_info_t *entry = GET_LIST_ENTRY(item, struct geolocation_info_t, head);
+        if (strcmp(entry->id, gps_id) == 0) {
+            status = entry;
+            break;
         }
+    }
+    if (!status) {
+        astarte_list_append(&edgehog_device->geolocation_list, &new_status->head);
+        status = new_status;
+    }
+    portEXIT_CRITICAL(&geolocation_list_lock);
 
-        astarte_list_append(&edgehog_device->geolocation_list, &status->head);
+    if (status != new_status) {
+        free_geolocation_info(new_status);
     }
 
     return status;
@@ -112,41 +209,69 @@ void edgehog_geolocation_update(
         return;
     }
 
-    if (!status->updated
-        && (status->longitude != update->longitude || status->latitude != update->latitude
-            || status->accuracy != update->accuracy || status->altitude != update->altitude
-            || status->altitude_accuracy != update->altitude_accuracy
-            || status->heading != update->heading || status->speed != update->speed)) {
-        status->updated = true;
-        status->longitude = update->longitude;
-        status->latitude = update->latitude;
-        status->accuracy = update->accuracy;
-        status->altitude = update->altitude;
-        status->altitude_accuracy = update->altitude_accuracy;
-        status->heading = update->heading;
-        status->speed = update->speed;
+    geolocation_record_t record;
+    encode_geolocation_record(update, &record);
+    record.timestamp_ms = edgehog_device_get_timestamp_ms();
+
+#if CONFIG_EDGEHOG_GEOLOCATION_TRACK
+    edgehog_geolocation_track_append(
+        status->track, update->latitude, update->longitude, record.timestamp_ms);
+#endif
+
+    // Compare with the last accepted update without taking the writer lock
+    geolocation_record_t previous;
+    int64_t accepted_us;
+    unsigned int seq;
+    do {
+        seq = edgehog_seqlock_read_begin(&status->seqlock);
+        previous = status->samples.latest;
+        accepted_us = status->accepted_us;
+    } while (edgehog_seqlock_read_retry(&status->seqlock, seq));
+    int64_t now_us = esp_timer_get_time();
+    if (accepted_us != 0) {
+        // Compare the stored values, a change below the stored resolution is not significant
+        edgehog_geolocation_data_t previous_data;
+        edgehog_geolocation_data_t record_data;
+        decode_geolocation_record(&previous, &previous_data);
+        decode_geolocation_record(&record, &record_data);
+        if (!is_significant_update(&previous_data, &record_data, now_us - accepted_us)) {
+            return;
+        }
+    }
+
+    // The latest update wins, the ones it replaces are optionally kept
+    edgehog_seqlock_lock(&status->seqlock);
+    geolocation_samples_t *samples = &status->samples;
+    edgehog_seqlock_write_begin(&status->seqlock);
+#if CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE > 0
+    if (samples->updates > 0) {
+        samples->history[samples->updates % CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE] = samples->latest;
     }
+#endif
+    samples->latest = record;
+    samples->updates++;
+    status->accepted_us = now_us;
+    edgehog_seqlock_write_end(&status->seqlock);
+    edgehog_seqlock_unlock(&status->seqlock);
 }
 
 void edgehog_geolocation_publish(edgehog_device_handle_t edgehog_device)
 {
-    astarte_list_head_t *item;
-    LIST_FOR_EACH(item, &edgehog_device->geolocation_list)
-    {
+    astarte_list_head_t *geolocation_list = &edgehog_device->geolocation_list;
+    for (astarte_list_head_t *item = next_geolocation(geolocation_list); item != geolocation_list;
+         item = next_geolocation(item)) {
         struct geolocation_info_t *data = GET_LIST_ENTRY(item, struct geolocation_info_t, head);
 
-        if (!data->updated) {
+        // The records are copied one at a time, the number of the last published one is kept so
+        // that the updates written meanwhile are published once, at most a ring more per call
+        uint32_t published = atomic_load_explicit(&data->published, memory_order_relaxed);
+        geolocation_record_t record;
+        uint32_t number = read_geolocation_record(data, published, &record);
+#if !CONFIG_EDGEHOG_GEOLOCATION_TRACK
+        if (number == published) {
             continue;
         }
-        astarte_bson_serializer_handle_t bs = astarte_bson_serializer_new();
-        astarte_bson_serializer_append_double(bs, "latitude", data->latitude);
-        astarte_bson_serializer_append_double(bs, "longitude", data->longitude);
-        astarte_bson_serializer_append_double(bs, "accuracy", data->accuracy);
-        astarte_bson_serializer_append_double(bs, "altitude", data->altitude);
-        astarte_bson_serializer_append_double(bs, "altitudeAccuracy", data->altitude_accuracy);
-        astarte_bson_serializer_append_double(bs, "heading", data->heading);
-        astarte_bson_serializer_append_double(bs, "speed", data->speed);
-        astarte_bson_serializer_append_end_of_document(bs);
+#endif
 
         size_t path_size = strlen(data->id) + 2;
         char *path = malloc(path_size);
@@ -156,15 +281,194 @@ void edgehog_geolocation_publish(edgehog_device_handle_t edgehog_device)
         }
         snprintf(path, path_size, "/%s", data->id);
 
-        const void *doc = astarte_bson_serializer_get_document(bs, NULL);
-        astarte_err_t res = astarte_device_stream_aggregate(
-            edgehog_device->astarte_device, geolocation_interface.name, path, doc, 0);
+#if CONFIG_EDGEHOG_GEOLOCATION_TRACK
+        // The track is published also while the latest record is unchanged
+        edgehog_geolocation_track_publish(edgehog_device, data->track, path);
+#endif
 
-        astarte_bson_serializer_destroy(bs);
+        for (int j = 0; j <= CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE && number != published; j++) {
+            if (number - published > 1) {
+                ESP_LOGD(TAG, "GPS receiver %s: %u updates replaced before being published",
+                    data->id, (unsigned int) (number - published - 1));
+            }
+            if (publish_geolocation_record(edgehog_device, path, &record) != ASTARTE_OK) {
+                break;
+            }
+            published = number;
+            number = read_geolocation_record(data, published, &record);
+        }
         free(path);
+        atomic_store_explicit(&data->published, published, memory_order_relaxed);
+    }
+}
 
-        if (res == ASTARTE_OK) {
-            data->updated = false;
+// Copies the first update after the given number still stored, returns its number, or the given
+// number when there is no later update
+static uint32_t read_geolocation_record(
+    struct geolocation_info_t *status, uint32_t after, geolocation_record_t *record)
+{
+    uint32_t number;
+    unsigned int seq;
+    do {
+        seq = edgehog_seqlock_read_begin(&status->seqlock);
+        number = status->samples.updates;
+#if CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE > 0
+        // The ring keeps the updates before the latest one, the older ones are lost
+        if (number - after > 1) {
+            uint32_t oldest = number - CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE;
+            number = number - after > CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE + 1 ? oldest : after + 1;
+            *record = status->samples.history[number % CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE];
+        } else {
+            *record = status->samples.latest;
         }
+#else
+        *record = status->samples.latest;
+#endif
+    } while (edgehog_seqlock_read_retry(&status->seqlock, seq));
+    return number;
+}
+
+static void encode_geolocation_record(
+    const edgehog_geolocation_data_t *data, geolocation_record_t *record)
+{
+#if CONFIG_EDGEHOG_COMPACT_RECORDS
+    record->latitude = edgehog_fixed_from_double(
+        data->latitude, EDGEHOG_FIXED_COORDINATE_SCALE, -900000000, 900000000);
+    record->longitude = edgehog_fixed_from_double(
+        data->longitude, EDGEHOG_FIXED_COORDINATE_SCALE, -1800000000, 1800000000);
+    record->accuracy = edgehog_fixed_from_double(data->accuracy, ACCURACY_SCALE, 0, UINT16_MAX);
+    record->altitude_accuracy
+        = edgehog_fixed_from_double(data->altitude_accuracy, ACCURACY_SCALE, 0, UINT16_MAX);
+    record->altitude
+        = edgehog_fixed_from_double(data->altitude, ALTITUDE_SCALE, INT16_MIN, INT16_MAX);
+    record->heading = edgehog_fixed_from_double(data->heading, HEADING_SCALE, INT16_MIN, INT16_MAX);
+    record->speed = edgehog_fixed_from_double(data->speed, SPEED_SCALE, INT16_MIN, INT16_MAX);
+#else
+    record->longitude = data->longitude;
+    record->latitude = data->latitude;
+    record->accuracy = data->accuracy;
+    record->altitude = data->altitude;
+    record->altitude_accuracy = data->altitude_accuracy;
+    record->heading = data->heading;
+    record->speed = data->speed;
+#endif
+}
+
+static void decode_geolocation_record(
+    const geolocation_record_t *record, edgehog_geolocation_data_t *data)
+{
+#if CONFIG_EDGEHOG_COMPACT_RECORDS
+    data->latitude = edgehog_fixed_to_double(record->latitude, EDGEHOG_FIXED_COORDINATE_SCALE);
+    data->longitude = edgehog_fixed_to_double(record->longitude, EDGEHOG_FIXED_COORDINATE_SCALE);
+    data->accuracy = edgehog_fixed_to_double(record->accuracy, ACCURACY_SCALE);
+    data->altitude_accuracy = edgehog_fixed_to_double(record->altitude_accuracy, ACCURACY_SCALE);
+    data->altitude = edgehog_fixed_to_double(record->altitude, ALTITUDE_SCALE);
+    data->heading = edgehog_fixed_to_double(record->heading, HEADING_SCALE);
+    data->speed = edgehog_fixed_to_double(record->speed, SPEED_SCALE);
+#else
+    data->longitude = record->longitude;
+    data->latitude = record->latitude;
+    data->accuracy = record->accuracy;
+    data->altitude = record->altitude;
+    data->altitude_accuracy = record->altitude_accuracy;
+    data->heading = record->heading;
+    data->speed = record->speed;
+#endif
+}
+
+static astarte_err_t publish_geolocation_record(edgehog_device_handle_t edgehog_device,
+    const char *path, const geolocation_record_t *record)
+{
+    edgehog_geolocation_data_t data;
+    decode_geolocation_record(record, &data);
+
+    astarte_bson_serializer_handle_t bs = astarte_bson_serializer_new();
+    astarte_bson_serializer_append_double(bs, "latitude", data.latitude);
+    astarte_bson_serializer_append_double(bs, "longitude", data.longitude);
+    astarte_bson_serializer_append_double(bs, "accuracy", data.accuracy);
+    astarte_bson_serializer_append_double(bs, "altitude", data.altitude);
+    astarte_bson_serializer_append_double(bs, "altitudeAccuracy", data.altitude_accuracy);
+    astarte_bson_serializer_append_double(bs, "heading", data.heading);
+    astarte_bson_serializer_append_double(bs, "speed", data.speed);
+    astarte_bson_serializer_append_end_of_document(bs);
+
+    const void *doc = astarte_bson_serializer_get_document(bs, NULL);
+    astarte_err_t res;
+    if (record->timestamp_ms > 0) {
+        res = astarte_device_stream_aggregate_with_timestamp(edgehog_device->astarte_device,
+            geolocation_interface.name, path, doc, record->timestamp_ms, 0);
+    } else {
+        res = astarte_device_stream_aggregate(
+            edgehog_device->astarte_device, geolocation_interface.name, path, doc, 0);
+    }
+    astarte_bson_serializer_destroy(bs);
+    return res;
+}
+
+static bool is_significant_update(const edgehog_geolocation_data_t *previous,
+    const edgehog_geolocation_data_t *record, int64_t elapsed_us)
+{
+#if CONFIG_EDGEHOG_GEOLOCATION_HEARTBEAT_S > 0
+    if (elapsed_us >= (int64_t) CONFIG_EDGEHOG_GEOLOCATION_HEARTBEAT_S * 1000000) {
+        return true;
+    }
+#endif
+#if !GEOLOCATION_FILTER_ENABLED
+    // Without thresholds any change is significant
+    return record->longitude != previous->longitude || record->latitude != previous->latitude
+        || record->accuracy != previous->accuracy || record->altitude != previous->altitude
+        || record->altitude_accuracy != previous->altitude_accuracy
+        || record->heading != previous->heading || record->speed != previous->speed;
+#else
+#if CONFIG_EDGEHOG_GEOLOCATION_MIN_DISTANCE_M > 0
+    if (haversine_distance_m(previous, record) >= CONFIG_EDGEHOG_GEOLOCATION_MIN_DISTANCE_M) {
+        return true;
+    }
+#endif
+#if CONFIG_EDGEHOG_GEOLOCATION_MIN_HEADING_DEG > 0
+    double heading_change = fabs(record->heading - previous->heading);
+    if (heading_change > 180) {
+        heading_change = 360 - heading_change;
+    }
+    if (heading_change >= CONFIG_EDGEHOG_GEOLOCATION_MIN_HEADING_DEG) {
+        return true;
+    }
+#endif
+#if CONFIG_EDGEHOG_GEOLOCATION_MIN_SPEED_CHANGE_CM_S > 0
+    if (fabs(record->speed - previous->speed) * 100
+        >= CONFIG_EDGEHOG_GEOLOCATION_MIN_SPEED_CHANGE_CM_S) {
+        return true;
     }
+#endif
+    return false;
+#endif
+}
+
+#if CONFIG_EDGEHOG_GEOLOCATION_MIN_DISTANCE_M > 0
+static double haversine_distance_m(
+    const edgehog_geolocation_data_t *from, const edgehog_geolocation_data_t *to)
+{
+    double sin_lat = sin(DEG_TO_RAD(to->latitude - from->latitude) / 2);
+    double sin_lon = sin(DEG_TO_RAD(to->longitude - from->longitude) / 2);
+    double a = sin_lat * sin_lat
+        + cos(DEG_TO_RAD(from->latitude)) * cos(DEG_TO_RAD(to->latitude)) * sin_lon * sin_lon;
+    return 2 * EARTH_MEAN_RADIUS_M * atan2(sqrt(a), sqrt(1 - a));
+}
+#endif
+
+static void free_geolocation_info(struct geolocation_info_t *status)
+{
+#if CONFIG_EDGEHOG_GEOLOCATION_TRACK
+    edgehog_geolocation_track_destroy(status->track);
+#endif
+    free(status->id);
+    free(status);
+}
+
+static astarte_list_head_t *next_geolocation(astarte_list_head_t *item)
+{
+    portENTER_CRITICAL(&geolocation_list_lock);
+    astarte_list_head_t *next = item->next;
+    portEXIT_CRITICAL(&geolocation_list_lock);
+    return next;
 }
@@ -0,0 +1,274 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "edgehog_geolocation_track.h"
+#include "edgehog_device_private.h"
+#if CONFIG_EDGEHOG_COMPACT_RECORDS
+#include "edgehog_fixed_point.h"
+#endif
+#include <astarte_bson_serializer.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <math.h>
+#include <string.h>
+
+#define EARTH_MEAN_RADIUS_M 6371008.8
+#define DEG_TO_RAD(deg) ((deg) * (M_PI / 180.0))
+
+static const char *TAG = "EDGEHOG_GEOLOCATION_TRACK";
+
+const astarte_interface_t geolocation_track_interface
+    = { .name = "io.edgehog.devicemanager.GeolocationTrack",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+#if CONFIG_EDGEHOG_COMPACT_RECORDS
+typedef struct
+{
+    int32_t latitude;
+    int32_t longitude;
+    int64_t timestamp_ms;
+} track_point_t;
+
+#define POINT_FROM_DEGREES(degrees, limit)                                                         \
+    edgehog_fixed_from_double(degrees, EDGEHOG_FIXED_COORDINATE_SCALE, -(limit), limit)
+#define POINT_TO_DEGREES(coordinate)                                                               \
+    edgehog_fixed_to_double(coordinate, EDGEHOG_FIXED_COORDINATE_SCALE)
+#else
+typedef struct
+{
+    double latitude;
+    double longitude;
+    int64_t timestamp_ms;
+} track_point_t;
+
+#define POINT_FROM_DEGREES(degrees, limit) (degrees)
+#define POINT_TO_DEGREES(coordinate) (coordinate)
+#endif
+
+struct edgehog_geolocation_track_t
+{
+    SemaphoreHandle_t mutex;
+    uint16_t len;
+    uint16_t dropped; // Fixes dropped because the track was full also after a simplification
+    bool anchored; // The first fix has already been published, it starts the next part
+    track_point_t points[CONFIG_EDGEHOG_GEOLOCATION_TRACK_SIZE];
+    // Simplification state, kept here to bound the stack usage
+    bool keep[CONFIG_EDGEHOG_GEOLOCATION_TRACK_SIZE];
+    uint16_t segments[2 * CONFIG_EDGEHOG_GEOLOCATION_TRACK_SIZE];
+};
+
+static uint16_t simplify_track(edgehog_geolocation_track_t *track);
+static double segment_distance_m(
+    const track_point_t *point, const track_point_t *first, const track_point_t *last);
+
+edgehog_geolocation_track_t *edgehog_geolocation_track_new(void)
+{
+    edgehog_geolocation_track_t *track = calloc(1, sizeof(edgehog_geolocation_track_t));
+    if (!track) {
+        return NULL;
+    }
+
+    track->mutex = xSemaphoreCreateMutex();
+    if (!track->mutex) {
+        free(track);
+        return NULL;
+    }
+
+    return track;
+}
+
+void edgehog_geolocation_track_destroy(edgehog_geolocation_track_t *track)
+{
+    if (track) {
+        vSemaphoreDelete(track->mutex);
+    }
+    free(track);
+}
+
+void edgehog_geolocation_track_append(
+    edgehog_geolocation_track_t *track, double latitude, double longitude, uint64_t timestamp_ms)
+{
+    if (timestamp_ms == 0) {
+        return;
+    }
+
+    xSemaphoreTake(track->mutex, portMAX_DELAY);
+    if (track->len == CONFIG_EDGEHOG_GEOLOCATION_TRACK_SIZE) {
+        track->len = simplify_track(track);
+    }
+    if (track->len == CONFIG_EDGEHOG_GEOLOCATION_TRACK_SIZE) {
+        // Every fix is significant, drop the oldest one not yet published
+        uint16_t first = track->anchored ? 1 : 0;
+        memmove(&track->points[first], &track->points[first + 1],
+            (track->len - first - 1) * sizeof(track_point_t));
+        track->len--;
+        track->dropped++;
+    }
+    track->points[track->len].latitude = POINT_FROM_DEGREES(latitude, 900000000);
+    track->points[track->len].longitude = POINT_FROM_DEGREES(longitude, 1800000000);
+    track->points[track->len].timestamp_ms = (int64_t) timestamp_ms;
+    track->len++;
+    xSemaphoreGive(track->mutex);
+}
+
+void edgehog_geolocation_track_publish(
+    edgehog_device_handle_t edgehog_device, edgehog_geolocation_track_t *track, const char *path)
+{
+    // Step 1: simplify the track and copy the fixes, they stay in the track until published
+    xSemaphoreTake(track->mutex, portMAX_DELAY);
+    uint16_t len = simplify_track(track);
+    uint16_t first = track->anchored ? 1 : 0;
+    int count = len - first;
+    if (count <= 0) {
+        xSemaphoreGive(track->mutex);
+        return;
+    }
+
+    uint8_t *columns = malloc(count * (2 * sizeof(double) + sizeof(int64_t)));
+    if (!columns) {
+        xSemaphoreGive(track->mutex);
+        ESP_LOGE(TAG, "Out of memory %s: %d", __FILE__, __LINE__);
+        return;
+    }
+    double *latitude = (double *) columns;
+    double *longitude = latitude + count;
+    int64_t *timestamp = (int64_t *) (longitude + count);
+    for (int i = 0; i < count; i++) {
+        latitude[i] = POINT_TO_DEGREES(track->points[first + i].latitude);
+        longitude[i] = POINT_TO_DEGREES(track->points[first + i].longitude);
+        timestamp[i] = track->points[first + i].timestamp_ms;
+    }
+    uint16_t dropped = track->dropped;
+    xSemaphoreGive(track->mutex);
+
+    // Step 2: publish the fixes
+    astarte_bson_serializer_handle_t bs = astarte_bson_serializer_new();
+    astarte_bson_serializer_append_double_array(bs, "latitude", latitude, count);
+    astarte_bson_serializer_append_double_array(bs, "longitude", longitude, count);
+    astarte_bson_serializer_append_datetime_array(bs, "timestamp", timestamp, count);
+    astarte_bson_serializer_append_end_of_document(bs);
+
+    const void *doc = astarte_bson_serializer_get_document(bs, NULL);
+    astarte_err_t res = astarte_device_stream_aggregate(
+        edgehog_device->astarte_device, geolocation_track_interface.name, path, doc, 0);
+    astarte_bson_serializer_destroy(bs);
+    int64_t last_ms = timestamp[count - 1];
+    free(columns);
+
+    if (res != ASTARTE_OK) {
+        ESP_LOGW(TAG, "Unable to publish %d track fixes of %s, retrying later", count, path);
+        return;
+    }
+
+    // Step 3: remove the published fixes, the last one starts the next part of the track. Fixes
+    // appended meanwhile are newer, the track may have also been simplified or shifted.
+    xSemaphoreTake(track->mutex, portMAX_DELAY);
+    uint16_t anchor = 0;
+    while (anchor + 1 < track->len && track->points[anchor + 1].timestamp_ms <= last_ms) {
+        anchor++;
+    }
+    memmove(
+        &track->points[0], &track->points[anchor], (track->len - anchor) * sizeof(track_point_t));
+    track->len -= anchor;
+    track->anchored = true;
+    track->dropped -= dropped;
+    xSemaphoreGive(track->mutex);
+
+    if (dropped > 0) {
+        ESP_LOGW(TAG, "%u track fixes of %s dropped, the track was full", (unsigned int) dropped,
+            path);
+    }
+}
+
+static uint16_t simplify_track(edgehog_geolocation_track_t *track)
+{
+    // Douglas-Peucker with an explicit stack of segments, the first and last fixes are kept
+    uint16_t len = track->len;
+    if (len < 3) {
+        return len;
+    }
+
+    memset(track->keep, 0, len * sizeof(bool));
+    track->keep[0] = true;
+    track->keep[len - 1] = true;
+    // The segments on the stack never overlap, so there are at most len of them
+    int top = 0;
+    track->segments[top++] = 0;
+    track->segments[top++] = len - 1;
+    while (top > 0) {
+        uint16_t last = track->segments[--top];
+        uint16_t first = track->segments[--top];
+        double max_distance = 0;
+        uint16_t farthest = first;
+        const track_point_t *points = track->points;
+        for (uint16_t i = first + 1; i < last; i++) {
+            double distance = segment_distance_m(&points[i], &points[first], &points[last]);
+            if (distance > max_distance) {
+                max_distance = distance;
+                farthest = i;
+            }
+        }
+        if (max_distance > CONFIG_EDGEHOG_GEOLOCATION_TRACK_TOLERANCE_M) {
+            track->keep[farthest] = true;
+            track->segments[top++] = first;
+            track->segments[top++] = farthest;
+            track->segments[top++] = farthest;
+            track->segments[top++] = last;
+        }
+    }
+
+    uint16_t kept = 0;
+    for (uint16_t i = 0; i < len; i++) {
+        if (track->keep[i]) {
+            track->points[kept++] = track->points[i];
+        }
+    }
+    track->len = kept;
+    return kept;
+}
+
+static double segment_distance_m(
+    const track_point_t *point, const track_point_t *first, const track_point_t *last)
+{
+    // Equirectangular projection around the first fix, accurate over the length of a segment
+    double first_latitude = POINT_TO_DEGREES(first->latitude);
+    double first_longitude = POINT_TO_DEGREES(first->longitude);
+    double scale_x = EARTH_MEAN_RADIUS_M * cos(DEG_TO_RAD(first_latitude));
+    double last_x = DEG_TO_RAD(POINT_TO_DEGREES(last->longitude) - first_longitude) * scale_x;
+    double last_y
+        = DEG_TO_RAD(POINT_TO_DEGREES(last->latitude) - first_latitude) * EARTH_MEAN_RADIUS_M;
+    double point_x = DEG_TO_RAD(POINT_TO_DEGREES(point->longitude) - first_longitude) * scale_x;
+    double point_y
+        = DEG_TO_RAD(POINT_TO_DEGREES(point->latitude) - first_latitude) * EARTH_MEAN_RADIUS_M;
+
+    double length_squared = last_x * last_x + last_y * last_y;
+    double t = 0;
+    if (length_squared > 0) {
+        t = (point_x * last_x + point_y * last_y) / length_squared;
+        t = t < 0 ? 0 : (t > 1 ? 1 : t);
+    }
+    double dx = point_x - t * last_x;
+    double dy = point_y - t * last_y;
+    return sqrt(dx * dx + dy * dy);
+}
@@ -0,0 +1,169 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "edgehog_heap_monitor.h"
+#include "edgehog_device_private.h"
+#include <astarte_bson_serializer.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+// Weight of a new sample in the smoothed values
+#define SMOOTHING 0.25f
+
+static const char *TAG = "EDGEHOG_HEAP_MONITOR";
+
+const astarte_interface_t heap_fragmentation_interface
+    = { .name = "io.edgehog.devicemanager.HeapFragmentation",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+static const struct
+{
+    const char *path;
+    uint32_t caps;
+} heap_regions[EDGEHOG_HEAP_MONITOR_REGIONS] = {
+    { "/internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT },
+#if CONFIG_SPIRAM
+    { "/spiram", MALLOC_CAP_SPIRAM },
+#endif
+};
+
+static edgehog_heap_level_t get_heap_level(float fragmentation_percent, edgehog_heap_level_t level);
+static void publish_heap_fragmentation(edgehog_device_handle_t edgehog_device, const char *path,
+    const edgehog_heap_fragmentation_event_t *data);
+static const char *heap_level_to_code(edgehog_heap_level_t level);
+
+void edgehog_heap_monitor_sample(edgehog_device_handle_t edgehog_device)
+{
+    for (int i = 0; i < EDGEHOG_HEAP_MONITOR_REGIONS; i++) {
+        edgehog_heap_region_state_t *state = &edgehog_device->heap_monitor.regions[i];
+
+        // Step 1: sample the region
+        int64_t now_us = esp_timer_get_time();
+        size_t free_bytes = heap_caps_get_free_size(heap_regions[i].caps);
+        size_t largest_free_block = heap_caps_get_largest_free_block(heap_regions[i].caps);
+        float fragmentation_percent = free_bytes > 0
+            ? 100.0f * (1.0f - (float) largest_free_block / (float) free_bytes)
+            : 0;
+
+        // Step 2: update the smoothed fragmentation and its trend
+        if (state->sampled_us == 0) {
+            state->fragmentation_percent = fragmentation_percent;
+        } else {
+            float previous_percent = state->fragmentation_percent;
+            state->fragmentation_percent += SMOOTHING * (fragmentation_percent - previous_percent);
+            float hours = (float) (now_us - state->sampled_us) / 3600e6f;
+            if (hours > 0) {
+                float trend = (state->fragmentation_percent - previous_percent) / hours;
+                state->trend_percent_per_hour
+                    += SMOOTHING * (trend - state->trend_percent_per_hour);
+            }
+        }
+        state->sampled_us = now_us;
+
+        // Step 3: notify the level changes
+        edgehog_heap_level_t level = get_heap_level(state->fragmentation_percent, state->level);
+        if (level == state->level) {
+            continue;
+        }
+
+        edgehog_heap_fragmentation_event_t data = {
+            .caps = heap_regions[i].caps,
+            .level = level,
+            .fragmentation_percent = state->fragmentation_percent,
+            .trend_percent_per_hour = state->trend_percent_per_hour,
+            .free_bytes = free_bytes,
+            .largest_free_block = largest_free_block,
+        };
+        ESP_LOGW(TAG, "Heap %s fragmentation %s: %.1f%%, %u bytes free, largest block %u bytes",
+            heap_regions[i].path + 1, heap_level_to_code(level), data.fragmentation_percent,
+            (unsigned int) free_bytes, (unsigned int) largest_free_block);
+        int32_t event_id
+            = level > state->level ? EDGEHOG_HEAP_FRAGMENTED_EVENT : EDGEHOG_HEAP_RECOVERED_EVENT;
+        esp_event_post(EDGEHOG_EVENTS, event_id, &data, sizeof(data), 0);
+        state->level = level;
+        publish_heap_fragmentation(edgehog_device, heap_regions[i].path, &data);
+    }
+}
+
+static edgehog_heap_level_t get_heap_level(float fragmentation_percent, edgehog_heap_level_t level)
+{
+    // A level is left only when the fragmentation drops below its threshold by the hysteresis
+    float critical = CONFIG_EDGEHOG_HEAP_MONITOR_CRITICAL_PERCENT;
+    float warning = CONFIG_EDGEHOG_HEAP_MONITOR_WARNING_PERCENT;
+    if (level == EDGEHOG_HEAP_CRITICAL) {
+        critical -= CONFIG_EDGEHOG_HEAP_MONITOR_HYSTERESIS_PERCENT;
+    }
+    if (level >= EDGEHOG_HEAP_WARNING) {
+        warning -= CONFIG_EDGEHOG_HEAP_MONITOR_HYSTERESIS_PERCENT;
+    }
+
+    if (fragmentation_percent >= critical) {
+        return EDGEHOG_HEAP_CRITICAL;
+    } else if (fragmentation_percent >= warning) {
+        return EDGEHOG_HEAP_WARNING;
+    }
+    return EDGEHOG_HEAP_NORMAL;
+}
+
+static void publish_heap_fragmentation(edgehog_device_handle_t edgehog_device, const char *path,
+    const edgehog_heap_fragmentation_event_t *data)
+{
+    astarte_bson_serializer_handle_t bs = astarte_bson_serializer_new();
+    astarte_bson_serializer_append_string(bs, "level", heap_level_to_code(data->level));
+    astarte_bson_serializer_append_double(bs, "fragmentationPercent", data->fragmentation_percent);
+    astarte_bson_serializer_append_double(bs, "trendPercentPerHour", data->trend_percent_per_hour);
+    astarte_bson_serializer_append_int64(bs, "freeBytes", data->free_bytes);
+    astarte_bson_serializer_append_int64(bs, "largestFreeBlockBytes", data->largest_free_block);
+    astarte_bson_serializer_append_end_of_document(bs);
+
+    const void *doc = astarte_bson_serializer_get_document(bs, NULL);
+    uint64_t timestamp_ms = edgehog_device_get_timestamp_ms();
+    astarte_err_t res;
+    if (timestamp_ms > 0) {
+        res = astarte_device_stream_aggregate_with_timestamp(edgehog_device->astarte_device,
+            heap_fragmentation_interface.name, path, doc, timestamp_ms, 0);
+    } else {
+        res = astarte_device_stream_aggregate(
+            edgehog_device->astarte_device, heap_fragmentation_interface.name, path, doc, 0);
+    }
+    astarte_bson_serializer_destroy(bs);
+
+    if (res != ASTARTE_OK) {
+        ESP_LOGW(TAG, "Unable to publish the heap fragmentation of %s", path);
+    }
+}
+
+static const char *heap_level_to_code(edgehog_heap_level_t level)
+{
+    switch (level) {
+        case EDGEHOG_HEAP_NORMAL:
+            return "Normal";
+        case EDGEHOG_HEAP_WARNING:
+            return "Warning";
+        case EDGEHOG_HEAP_CRITICAL:
+            return "Critical";
+        default:
+            return "";
+    }
+}
@@ -21,18 +21,29 @@
 #include "edgehog_ota.h"
 #include "edgehog_device_private.h"
 #include "edgehog_event.h"
+#include "edgehog_ota_p.h"
+#include "edgehog_ota_perf.h"
 #include <astarte_bson.h>
 #include <astarte_bson_serializer.h>
 #include <astarte_bson_types.h>
+#include <esp_app_format.h>
 #include <esp_err.h>
-#include <esp_https_ota.h>
+#include <esp_http_client.h>
+#include <esp_image_format.h>
 #if CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
 #include <esp_crt_bundle.h>
 #endif
 #include <esp_log.h>
 #include <esp_ota_ops.h>
 #include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/timers.h>
+#include <lwip/netdb.h>
 #include <nvs.h>
+#include <strings.h>
 
 /************************************************
  *        Defines, constants and typedef        *
@@ -44,8 +55,54 @@
 #define OTA_STATE_KEY "state"
 #define OTA_PARTITION_ADDR_KEY "part_id"
 #define OTA_REQUEST_ID_KEY "req_id"
+#define OTA_STAGED_PARTITION_ADDR_KEY "stg_part"
+#define OTA_APPLY_AFTER_KEY "apply_after"
+#define OTA_APPLY_BEFORE_KEY "apply_before"
+#define OTA_APPLY_CHECK_PERIOD_MS (30 * 1000)
+#define OTA_ROLLBACK_REASON_KEY "rb_reason"
+#define OTA_ROLLBACK_TIME_KEY "rb_ms"
+#define OTA_ROLLBACK_REASON_LEN 48
+#define OTA_HEALTH_CHECK_PERIOD_MS 1000
+#define OTA_JOURNAL_KEY "journal"
+// One key for each source, so that saving them does not need a buffer
+#define OTA_SOURCE_KEY_FMT "source%u"
+#define OTA_SOURCE_KEY_LEN 16
+#define OTA_MAX_RATE_KEY "max_rate"
+#define OTA_SHUTDOWN_TIME_KEY "shutdown_ms"
+// Minimum time left to the MQTT client to send the last events before restarting
+#define OTA_REBOOT_SETTLE_MS 200
+// Time left to the MQTT client when the application does not report its pending messages, the MQTT
+// outbox is not exposed by the Astarte device
+#define OTA_REBOOT_UNTRACKED_SETTLE_MS 5000
+#define OTA_SECTOR_SIZE 4096
+// Flash encryption requires writes aligned to 16 bytes
+#define OTA_WRITE_ALIGN 16
+#define OTA_JOURNAL_READ_SIZE 256
+// Journal checkpoints are aligned to the flash sectors
+#define OTA_JOURNAL_INTERVAL                                                                       \
+    (CONFIG_EDGEHOG_OTA_JOURNAL_INTERVAL_BYTES / OTA_SECTOR_SIZE * OTA_SECTOR_SIZE)
 #define OTA_UPDATE_TASK_NAME "OTA UPDATE TASK"
-#define OTA_PROGRESS_PERC_ROUNDING_STEP 10
+#define OTA_APPLY_TASK_NAME "OTA APPLY TASK"
+#define OTA_HEALTH_TASK_NAME "OTA HEALTH TASK"
+// Minimum window used to sample the download throughput
+#define OTA_PROGRESS_SAMPLE_US (500 * 1000)
+// Weight of the latest throughput sample in the moving average, as 1/N
+#define OTA_PROGRESS_EWMA_WEIGHT 8
+#define OTA_PROGRESS_MESSAGE_LEN 64
+// Polling period used while a background download waits for the application queue to drain
+#define OTA_BACKGROUND_POLL_MS 100
+#define OTA_HOST_MAX_LEN 128
+#define OTA_URL_MAX_LEN 2048
+// Main URL plus the optional mirrors
+#define OTA_MAX_SOURCES 4
+#define OTA_BUFFER_SIZE 1024
+#define OTA_MAX_REDIRECTS 5
+#define OTA_PROBE_TIMEOUT_MS 3000
+// Period over which the throughput of a source is compared with the failover threshold
+#define OTA_FAILOVER_WINDOW_US (10 * 1000 * 1000)
+// The HTTP client saves the TLS session of its last connection and offers it to the next one
+#define OTA_SAVE_TLS_SESSION                                                                       \
+    (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0) && CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS)
 
 #define TAG "EDGEHOG_OTA"
 
@@ -54,6 +111,7 @@ typedef enum
     OTA_STATE_IDLE,
     OTA_STATE_IN_PROGRESS,
     OTA_STATE_REBOOT,
+    OTA_STATE_STAGED,
 } ota_state_t;
 
 typedef enum
@@ -68,16 +126,86 @@ typedef enum
     OTA_EVENT_FAILURE
 } ota_event_t;
 
+typedef struct
+{
+    char *url;
+    int64_t latency_us;
+} ota_source_t;
+
 typedef struct
 {
     edgehog_device_handle_t edgehog_dev;
     char *req_uuid;
-    char *ota_url;
+    ota_source_t sources[OTA_MAX_SOURCES];
+    uint8_t sources_count;
+    uint8_t source_idx;
+    char *redirect_url;
+    uint32_t req_max_bytes_per_sec;
+    int64_t apply_after_ms;
+    int64_t apply_before_ms;
+    bool staged;
+    bool resume;
+    const edgehog_ota_sink_t *sink;
+    edgehog_ota_perf_t perf;
 } ota_task_data_t;
 
+typedef struct
+{
+    const esp_partition_t *partition;
+    const edgehog_ota_sink_t *sink;
+    bool sink_open;
+    bool sink_failed;
+    bool staged;
+    edgehog_ota_perf_t *perf;
+    nvs_handle_t handle_nvs;
+    int image_size;
+    int offset;
+    uint32_t erased_end;
+    uint32_t crc;
+    uint8_t carry[OTA_WRITE_ALIGN];
+    uint8_t carry_len;
+} ota_download_t;
+
+typedef struct
+{
+    uint32_t partition_addr;
+    int32_t image_size;
+    uint32_t offset;
+    uint32_t crc;
+} ota_journal_t;
+
+typedef struct
+{
+    int64_t open_us;
+    int64_t connected_us;
+    int64_t full_handshake_us;
+    int64_t resumed_handshake_us;
+    char host[OTA_HOST_MAX_LEN];
+    int range_total;
+    uint8_t connections;
+    uint8_t full_handshakes;
+    uint8_t resumed_handshakes;
+} ota_attempt_data_t;
+
+typedef struct
+{
+    int image_size;
+    int64_t last_sent_us;
+    int last_sent_len;
+    int64_t sample_us;
+    int sample_len;
+    uint32_t throughput;
+} ota_progress_t;
+
+typedef struct
+{
+    int64_t tokens;
+    int64_t refill_us;
+} ota_token_bucket_t;
+
 const astarte_interface_t ota_request_interface = { .name = "io.edgehog.devicemanager.OTARequest",
     .major_version = 1,
-    .minor_version = 0,
+    .minor_version = 1,
     .ownership = OWNERSHIP_SERVER,
     .type = TYPE_DATASTREAM };
 
@@ -92,6 +220,37 @@ const astarte_interface_t ota_event_interface = { .name = "io.edgehog.devicemana
  ***********************************************/
 
 static ota_task_data_t ota_task_data;
+static portMUX_TYPE ota_throttle_lock = portMUX_INITIALIZER_UNLOCKED;
+static portMUX_TYPE ota_apply_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool ota_applying;
+static TimerHandle_t ota_apply_timer;
+static int64_t staged_apply_after_ms;
+static int64_t staged_apply_before_ms;
+#if CONFIG_EDGEHOG_OTA_HEALTH_CHECK
+static TimerHandle_t ota_health_timer;
+static TaskHandle_t ota_health_task;
+static char health_check_req_uuid[ASTARTE_UUID_LEN];
+#endif
+#if CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+static StackType_t ota_task_stack[CONFIG_EDGEHOG_OTA_TASK_STACK_SIZE];
+static StaticTask_t ota_task_tcb;
+static StackType_t ota_apply_task_stack[CONFIG_EDGEHOG_OTA_TASK_STACK_SIZE];
+static StaticTask_t ota_apply_task_tcb;
+#if CONFIG_EDGEHOG_OTA_HEALTH_CHECK
+static StackType_t ota_health_task_stack[CONFIG_EDGEHOG_OTA_TASK_STACK_SIZE];
+static StaticTask_t ota_health_task_tcb;
+#endif
+// Request strings, allocated sequentially and released all together by each new request
+static char ota_strings[CONFIG_EDGEHOG_OTA_STATIC_STRINGS_SIZE];
+static size_t ota_strings_len;
+static char ota_redirect_url[OTA_URL_MAX_LEN];
+static char ota_buffer[OTA_BUFFER_SIZE];
+#endif
+#if OTA_SAVE_TLS_SESSION
+// Kept across the OTA requests together with the TLS session it saved
+static esp_http_client_handle_t ota_http_client;
+static char ota_tls_session_host[OTA_HOST_MAX_LEN];
+#endif
 
 /************************************************
  *         Static functions declaration         *
@@ -112,14 +271,407 @@ static void ota_task_code(void *pvParameters);
  * @return EDGEHOG_OK if the update was successful, an edgehog_err_t otherwise.
  */
 static edgehog_err_t perform_ota(ota_task_data_t *task_data, nvs_handle_t *handle_nvs);
+/**
+ * @brief Spawn the OTA update task for the request in ota_task_data.
+ *
+ * @return EDGEHOG_OK if the task has been created, EDGEHOG_ERR_TASK_CREATE otherwise.
+ */
+static edgehog_err_t start_ota_task(void);
+/**
+ * @brief Store in NVS the OTA request parameters needed to resume it after a reset.
+ *
+ * @param[in] task_data OTA update task data.
+ * @param[in] handle_nvs Valid nvs handle.
+ */
+static void save_ota_request(ota_task_data_t *task_data, nvs_handle_t handle_nvs);
+/**
+ * @brief Load in ota_task_data an interrupted OTA request.
+ *
+ * @param[in] edgehog_dev Handle to the edgehog device instance.
+ * @param[in] handle_nvs Valid nvs handle.
+ * @param[in] req_uuid Uuid of the OTA request.
+ *
+ * @return EDGEHOG_OK if the request can be resumed, an edgehog_err_t otherwise.
+ */
+static edgehog_err_t load_ota_request(
+    edgehog_device_handle_t edgehog_dev, nvs_handle_t handle_nvs, const char *req_uuid);
+/**
+ * @brief Prepare the download, restoring the last journal checkpoint of a resumed request.
+ *
+ * @details The flash content before the checkpoint is verified against the journal checksum, the
+ * download restarts from the beginning when they do not match.
+ *
+ * @param[in] task_data OTA update task data.
+ * @param[out] download Download state, the partition must already be set.
+ * @param[in] handle_nvs Valid nvs handle.
+ */
+static void begin_ota_download(
+    ota_task_data_t *task_data, ota_download_t *download, nvs_handle_t handle_nvs);
+/**
+ * @brief Write a chunk of the OTA image at the current offset and update the journal.
+ *
+ * @param[inout] download Download state.
+ * @param[in] data Chunk of the image.
+ * @param[in] len Length of the chunk.
+ *
+ * @return EDGEHOG_OK if the chunk has been written, an edgehog_err_t otherwise.
+ */
+static edgehog_err_t write_ota_data(ota_download_t *download, const char *data, int len);
+/**
+ * @brief Program data to flash in blocks aligned to OTA_WRITE_ALIGN.
+ *
+ * @param[inout] download Download state, the unaligned tail is kept in the carry buffer.
+ * @param[in] data Data to program.
+ * @param[in] len Length of the data.
+ *
+ * @return ESP_OK on success, an esp_err_t otherwise.
+ */
+static esp_err_t program_ota_data(ota_download_t *download, const char *data, int len);
+/**
+ * @brief Write data to the update partition, erasing the sectors when first reached.
+ *
+ * @param[inout] download Download state.
+ * @param[in] address Offset in the partition.
+ * @param[in] data Data to write.
+ * @param[in] len Length of the data.
+ *
+ * @return ESP_OK on success, an esp_err_t otherwise.
+ */
+static esp_err_t flash_ota_data(
+    ota_download_t *download, uint32_t address, const void *data, size_t len);
+/**
+ * @brief Flush the pending data and set the verified image as boot partition.
+ *
+ * @details A staged image is only verified, the boot partition is set when it is applied.
+ *
+ * @param[inout] download Download state.
+ *
+ * @return EDGEHOG_OK if the image is valid, an edgehog_err_t otherwise.
+ */
+static edgehog_err_t finish_ota_download(ota_download_t *download);
+/**
+ * @brief Write a chunk of the OTA image to the selected sink or to the update partition.
+ *
+ * @details The sink is opened on the first chunk, once the image size is known.
+ *
+ * @param[inout] download Download state.
+ * @param[in] data Chunk of the image.
+ * @param[in] len Length of the chunk.
+ *
+ * @return EDGEHOG_OK if the chunk has been written, an edgehog_err_t otherwise.
+ */
+static edgehog_err_t write_ota_image(ota_download_t *download, const char *data, int len);
+/**
+ * @brief Complete the transfer of the OTA image to the selected sink or to the update partition.
+ *
+ * @param[inout] download Download state.
+ *
+ * @return EDGEHOG_OK if the image has been accepted, an edgehog_err_t otherwise.
+ */
+static edgehog_err_t finish_ota_image(ota_download_t *download);
+/**
+ * @brief Get the HTTP client used by the attempts of an OTA request.
+ *
+ * @details With OTA_SAVE_TLS_SESSION the client is created once and kept with its saved TLS
+ * session, so that the attempts and the following requests resume it.
+ *
+ * @return The HTTP client, NULL if it can not be created.
+ */
+static esp_http_client_handle_t get_ota_http_client(void);
+/**
+ * @brief Release the HTTP client at the end of an OTA request.
+ *
+ * @details The connection is closed, the client itself is only destroyed if it does not keep a
+ * TLS session.
+ *
+ * @param[in] client HTTP client returned by get_ota_http_client().
+ */
+static void release_ota_http_client(esp_http_client_handle_t client);
 /**
  * @brief Perform a single attempt to an OTA update.
  *
+ * @details The download continues from the current offset using the selected source.
+ *
  * @param[in] task_data OTA update task data.
+ * @param[in] client HTTP client of the OTA request, closed at the end of the attempt.
+ * @param[inout] download Download state of the OTA update.
+ * @param[in] allow_failover Stop the attempt when the source is too slow.
+ * @param[out] slow Set when the attempt stopped because the source is too slow.
  *
  * @return EDGEHOG_OK if the update attempt was successful, an edgehog_err_t otherwise.
  */
-static edgehog_err_t perform_ota_attempt(ota_task_data_t *task_data);
+static edgehog_err_t perform_ota_attempt(ota_task_data_t *task_data,
+    esp_http_client_handle_t client, ota_download_t *download, bool allow_failover, bool *slow);
+/**
+ * @brief Parse the optional mirrors of an OTA request and add them to the sources.
+ *
+ * @param[in] doc OTA request BSON document.
+ * @param[inout] task_data OTA update task data, the main URL must already be the first source.
+ */
+static void parse_ota_mirrors(astarte_bson_document_t doc, ota_task_data_t *task_data);
+/**
+ * @brief Check if an OTA source URL uses an allowed scheme.
+ *
+ * @param[in] url URL of the OTA image.
+ *
+ * @return true if the URL is allowed, false otherwise.
+ */
+static bool is_ota_url_allowed(const char *url);
+/**
+ * @brief Measure the first byte latency of each OTA source and sort them, fastest first.
+ *
+ * @details Unreachable sources are moved to the end of the list, keeping the requested order.
+ *
+ * @param[in] task_data OTA update task data.
+ */
+static void probe_ota_sources(ota_task_data_t *task_data);
+/**
+ * @brief Switch the download to the next OTA source.
+ *
+ * @param[in] task_data OTA update task data.
+ */
+static void select_next_ota_source(ota_task_data_t *task_data);
+/**
+ * @brief Send the HTTP request of an OTA source, following the redirections.
+ *
+ * @param[in] client HTTP client configured with the source URL.
+ * @param[inout] attempt_data Data of the current attempt, NULL when probing the sources.
+ * @param[in] range Value of the Range header, NULL to request the whole image.
+ * @param[in] buffer Scratch buffer used to drain the redirection responses.
+ * @param[in] buffer_size Size of the scratch buffer.
+ *
+ * @return The HTTP status code of the final response, -1 on a connection error.
+ */
+static int open_ota_source(esp_http_client_handle_t client, ota_attempt_data_t *attempt_data,
+    const char *range, char *buffer, int buffer_size);
+/**
+ * @brief HTTP client event handler, accounts the connections and parses the response headers.
+ *
+ * @details TLS handshakes are counted as resumed when the client offers the session saved by its
+ * last connection to the same host. The host of the next connection is taken from the Location
+ * header of the redirections.
+ *
+ * @param[in] evt HTTP client event, the user data is an ota_attempt_data_t.
+ *
+ * @return Always ESP_OK.
+ */
+static esp_err_t ota_http_event_handler(esp_http_client_event_t *evt);
+/**
+ * @brief Store the URL reached after the HTTP redirections of an OTA attempt.
+ *
+ * @details The next attempts connect directly to the redirection target, saving the connections
+ * to the intermediate servers.
+ *
+ * @param[in] task_data OTA update task data.
+ * @param[in] client HTTP client of the current attempt.
+ */
+static void cache_redirect_url(ota_task_data_t *task_data, esp_http_client_handle_t client);
+/**
+ * @brief Extract the host name from a URL.
+ *
+ * @param[in] url An absolute URL.
+ * @param[out] host Output buffer, set to an empty string if the host can not be extracted.
+ * @param[in] host_size Size of the output buffer.
+ *
+ * @return true if the host has been extracted, false otherwise.
+ */
+static bool get_ota_url_host(const char *url, char *host, size_t host_size);
+#if CONFIG_EDGEHOG_OTA_PERF_TELEMETRY
+/**
+ * @brief Resolve the host name of the OTA image URL.
+ *
+ * @details The resolved address is kept in the lwIP DNS cache, so that the following connection
+ * does not need to resolve it again.
+ *
+ * @param[in] url URL of the OTA image.
+ *
+ * @return The time spent resolving the host name in microseconds.
+ */
+static int64_t resolve_ota_host(const char *url);
+#endif
+/**
+ * @brief Update the download progress and publish it when due.
+ *
+ * @details Progress is published at most once every CONFIG_EDGEHOG_OTA_PROGRESS_MIN_INTERVAL_MS
+ * and only after at least CONFIG_EDGEHOG_OTA_PROGRESS_MIN_BYTES have been received since the last
+ * report. The published message contains the received bytes, the average throughput and, when
+ * the image size is known, the estimated time to completion.
+ *
+ * @param[in] task_data OTA update task data.
+ * @param[inout] progress Progress state of the current attempt.
+ * @param[in] read_len Number of bytes of the image received so far.
+ */
+static void update_ota_progress(ota_task_data_t *task_data, ota_progress_t *progress, int read_len);
+/**
+ * @brief Throttle the OTA download according to the rate limit and priority.
+ *
+ * @details Consumes chunk_len tokens from the bucket and waits until the bucket is refilled.
+ * Background downloads also wait until the application has no more than the configured number of
+ * pending outgoing messages.
+ *
+ * @param[in] task_data OTA update task data.
+ * @param[inout] bucket Token bucket of the current attempt.
+ * @param[in] chunk_len Number of bytes received since the last call.
+ *
+ * @return true if the OTA update has been canceled while waiting, false otherwise.
+ */
+static bool throttle_ota_download(
+    ota_task_data_t *task_data, ota_token_bucket_t *bucket, int chunk_len);
+/**
+ * @brief Read an optional timestamp from an OTA request.
+ *
+ * @param[in] doc The OTA request document.
+ * @param[in] key Key of the timestamp, its value can be a datetime or milliseconds since epoch.
+ *
+ * @return The timestamp in milliseconds since epoch, 0 if not present or invalid.
+ */
+static int64_t get_request_timestamp(astarte_bson_document_t doc, const char *key);
+/**
+ * @brief Set the updated partition as boot partition and restart the device.
+ *
+ * @param[in] edgehog_dev Handle to the edgehog device instance.
+ * @param[in] req_uuid Uuid of the OTA request.
+ * @param[in] handle_nvs Valid nvs handle, closed before restarting.
+ *
+ * @return Does not return on success, EDGEHOG_ERR_OTA_INTERNAL otherwise.
+ */
+static edgehog_err_t reboot_into_update(
+    edgehog_device_handle_t edgehog_dev, const char *req_uuid, nvs_handle_t handle_nvs);
+/**
+ * @brief Wait until the outgoing messages have been sent, or the drain deadline expires.
+ *
+ * @details The device must be connected to Astarte and the pending messages callback of the OTA
+ * throttling configuration must report no pending messages. Without a callback the MQTT client is
+ * given OTA_REBOOT_UNTRACKED_SETTLE_MS to send the last messages.
+ *
+ * @param[in] edgehog_dev Handle to the edgehog device instance.
+ *
+ * @return The time spent waiting in milliseconds.
+ */
+static uint32_t drain_before_reboot(edgehog_device_handle_t edgehog_dev);
+/**
+ * @brief Format the message of the OTA Success event published after the reboot.
+ *
+ * @param[in] handle_nvs Valid nvs handle.
+ * @param[in] verified_ms Time taken by the health check, a negative value if not performed.
+ * @param[out] message Output buffer.
+ * @param[in] message_size Size of the output buffer.
+ */
+static void format_success_message(
+    nvs_handle_t handle_nvs, int64_t verified_ms, char *message, size_t message_size);
+/**
+ * @brief Keep the downloaded image in the inactive partition until it is applied.
+ *
+ * @details The boot partition is left unchanged, so that an unexpected reset does not apply the
+ * update, and the staged state is persisted in NVS.
+ *
+ * @param[in] task_data OTA update task data.
+ * @param[in] handle_nvs Valid nvs handle.
+ *
+ * @return EDGEHOG_OK if the update has been staged, an edgehog_err_t otherwise.
+ */
+static edgehog_err_t stage_ota_update(ota_task_data_t *task_data, nvs_handle_t handle_nvs);
+/**
+ * @brief Discard a staged OTA update, notifying Astarte that its request has been canceled.
+ *
+ * @param[in] edgehog_dev Handle to the edgehog device instance.
+ * @param[in] handle_nvs Valid nvs handle.
+ * @param[in] message Message published with the Failure event.
+ */
+static void discard_staged_ota(
+    edgehog_device_handle_t edgehog_dev, nvs_handle_t handle_nvs, const char *message);
+/**
+ * @brief Cancel the staged OTA update with the given request UUID.
+ *
+ * @param[in] edgehog_dev Handle to the edgehog device instance.
+ * @param[in] req_uuid Uuid of the OTA request to cancel.
+ *
+ * @return EDGEHOG_OK if the staged update has been canceled, an edgehog_err_t otherwise.
+ */
+static edgehog_err_t cancel_staged_ota(edgehog_device_handle_t edgehog_dev, const char *req_uuid);
+/**
+ * @brief Check if the running image is still pending verification.
+ *
+ * @details The update partition holds the rollback image until the running one is verified, so it
+ * can not be overwritten, as checked by esp_ota_begin().
+ *
+ * @return True if the running image is pending verification, false otherwise.
+ */
+static bool running_image_pending_verify(void);
+/**
+ * @brief Start the timer applying the staged update in its maintenance window.
+ *
+ * @param[in] edgehog_dev Handle to the edgehog device instance.
+ */
+static void start_apply_timer(edgehog_device_handle_t edgehog_dev);
+/**
+ * @brief Timer callback, starts the apply task when the maintenance window is open.
+ *
+ * @details Applying the update verifies the image, writes NVS and waits for the outgoing messages
+ * to be sent, so it runs in its own task instead of the timer service task.
+ *
+ * @param[in] timer_handle Timer handle, its ID is the edgehog device handle.
+ */
+static void apply_timer_callback(TimerHandle_t timer_handle);
+/**
+ * @brief Code for the short-lived task applying the staged update.
+ *
+ * @param[in] ctx Handle to the edgehog device instance.
+ */
+static void apply_task_code(void *ctx);
+/**
+ * @brief Clear the OTA update state from NVS.
+ *
+ * @param[in] handle_nvs Valid nvs handle.
+ */
+static void clear_ota_state(nvs_handle_t handle_nvs);
+#if CONFIG_EDGEHOG_OTA_HEALTH_CHECK
+/**
+ * @brief Start the health check of an updated image pending verification.
+ *
+ * @param[in] edgehog_dev Handle to the edgehog device instance.
+ * @param[in] req_uuid Uuid of the OTA request.
+ */
+static void start_health_check(edgehog_device_handle_t edgehog_dev, const char *req_uuid);
+/**
+ * @brief Timer callback, wakes up the health check task.
+ *
+ * @param[in] timer_handle Timer handle.
+ */
+static void health_check_timer_callback(TimerHandle_t timer_handle);
+/**
+ * @brief Code for the task checking the Astarte connection and the application health probe.
+ *
+ * @details The image is marked valid as soon as both checks succeed, otherwise it is rolled back
+ * when CONFIG_EDGEHOG_OTA_HEALTH_CHECK_TIMEOUT_S expires.
+ *
+ * @param[in] ctx Handle to the edgehog device instance.
+ */
+static void health_check_task_code(void *ctx);
+#endif
+/**
+ * @brief Duplicate a string of the OTA request.
+ *
+ * @details With CONFIG_EDGEHOG_OTA_STATIC_MEMORY the string is stored in the static request
+ * strings area, otherwise it is allocated on the heap.
+ *
+ * @param[in] str String to duplicate.
+ *
+ * @return The duplicated string, NULL if there is not enough memory.
+ */
+static char *ota_strdup(const char *str);
+/**
+ * @brief Release a string returned by ota_strdup or cache_redirect_url.
+ *
+ * @param[in] str String to release, can be NULL.
+ */
+static void ota_free(char *str);
+/**
+ * @brief Release all the strings of the previous OTA request.
+ *
+ * @param[in] task_data OTA update task data.
+ */
+static void ota_free_request(ota_task_data_t *task_data);
 /**
  * @brief Publish an OTA update event to Astarte.
  *
@@ -137,36 +689,179 @@ static void pub_ota_event(edgehog_device_handle_t edgehog_dev, const char *reque
  *         Global functions definitions         *
  ***********************************************/
 
-void edgehog_ota_init(edgehog_device_handle_t edgehog_dev)
+edgehog_err_t edgehog_ota_set_throttle(
+    edgehog_device_handle_t edgehog_device, const edgehog_ota_throttle_t *throttle)
 {
-    esp_err_t esp_err;
-    nvs_handle_t handle_nvs;
+    if (!edgehog_device || !throttle) {
+        return EDGEHOG_ERR;
+    }
+    if (throttle->priority == EDGEHOG_OTA_PRIORITY_BACKGROUND && !throttle->pending_cb) {
+        ESP_LOGE(TAG, "Background OTA priority requires a pending messages callback");
+        return EDGEHOG_ERR;
+    }
 
-    // Step 1 open NVS
+    portENTER_CRITICAL(&ota_throttle_lock);
+    edgehog_device->ota_throttle = *throttle;
+    portEXIT_CRITICAL(&ota_throttle_lock);
+    return EDGEHOG_OK;
+}
 
-    esp_err = edgehog_device_nvs_open(edgehog_dev, OTA_NAMESPACE, &handle_nvs);
-    if (esp_err != ESP_OK) {
+edgehog_err_t edgehog_ota_set_health_probe(
+    edgehog_device_handle_t edgehog_device, edgehog_ota_health_probe_t probe, void *user_data)
+{
+    if (!edgehog_device) {
+        return EDGEHOG_ERR;
+    }
+
+    edgehog_device->ota_health_probe = probe;
+    edgehog_device->ota_health_probe_user_data = user_data;
+    return EDGEHOG_OK;
+}
+
+edgehog_err_t edgehog_ota_set_sink(
+    edgehog_device_handle_t edgehog_device, const edgehog_ota_sink_t *sink)
+{
+    if (!edgehog_device) {
+        return EDGEHOG_ERR;
+    }
+    if (!sink) {
+        memset(&edgehog_device->ota_sink, 0, sizeof(edgehog_ota_sink_t));
+        return EDGEHOG_OK;
+    }
+    if (!sink->target || !sink->begin || !sink->write || !sink->finish || !sink->abort) {
+        ESP_LOGE(TAG, "Incomplete OTA sink");
+        return EDGEHOG_ERR;
+    }
+
+    edgehog_device->ota_sink = *sink;
+    return EDGEHOG_OK;
+}
+
+edgehog_err_t edgehog_ota_apply(edgehog_device_handle_t edgehog_device)
+{
+    if (!edgehog_device) {
+        return EDGEHOG_ERR;
+    }
+
+    portENTER_CRITICAL(&ota_apply_lock);
+    bool already_applying = ota_applying;
+    ota_applying = true;
+    portEXIT_CRITICAL(&ota_apply_lock);
+    if (already_applying) {
+        return EDGEHOG_ERR_OTA_ALREADY_IN_PROGRESS;
+    }
+
+    edgehog_err_t edgehog_err = EDGEHOG_ERR_OTA_INVALID_REQUEST;
+    nvs_handle_t handle_nvs;
+    if (edgehog_device_nvs_open(edgehog_device, OTA_NAMESPACE, &handle_nvs) != ESP_OK) {
         ESP_LOGE(TAG, "Error opening the NVS OTA update namespace.");
-        return;
+        edgehog_err = EDGEHOG_ERR_NVS;
+        goto end;
     }
 
-    // Step 2 check if an UUID is present in NVS. If not there is no need to continue as there
-    // is no pending OTA update.
+    // Step 1 check that an update has been staged
 
+    uint8_t ota_state = OTA_STATE_IDLE;
+    uint32_t staged_partition_addr;
     char req_uuid[ASTARTE_UUID_LEN];
     size_t req_uuid_size = ASTARTE_UUID_LEN;
-    esp_err = nvs_get_str(handle_nvs, OTA_REQUEST_ID_KEY, req_uuid, &req_uuid_size);
-    if (esp_err != ESP_OK) {
-        if (esp_err != ESP_ERR_NVS_NOT_FOUND) {
-            ESP_LOGE(TAG, "Error fetching the OTA update request UUID from NVS.");
+    nvs_get_u8(handle_nvs, OTA_STATE_KEY, &ota_state);
+    if (ota_state != OTA_STATE_STAGED
+        || nvs_get_u32(handle_nvs, OTA_STAGED_PARTITION_ADDR_KEY, &staged_partition_addr) != ESP_OK
+        || nvs_get_str(handle_nvs, OTA_REQUEST_ID_KEY, req_uuid, &req_uuid_size) != ESP_OK) {
+        ESP_LOGW(TAG, "No staged OTA update to apply");
+        nvs_close(handle_nvs);
+        goto end;
+    }
+
+    // Step 2 boot from the staged partition, the image is verified again by the bootloader API
+
+    const esp_partition_t *staged_partition = NULL;
+    esp_partition_iterator_t partition_iterator
+        = esp_partition_find(ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_ANY, NULL);
+    while (partition_iterator) {
+        const esp_partition_t *partition_info = esp_partition_get(partition_iterator);
+        if (partition_info && partition_info->address == staged_partition_addr) {
+            staged_partition = partition_info;
+            break;
         }
+        partition_iterator = esp_partition_next(partition_iterator);
+    }
+    esp_partition_iterator_release(partition_iterator);
+    if (!staged_partition || esp_ota_set_boot_partition(staged_partition) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to boot from the staged partition");
+        discard_staged_ota(edgehog_device, handle_nvs, "Staged image is no longer valid.");
+        nvs_close(handle_nvs);
+        edgehog_err = EDGEHOG_ERR_OTA_INVALID_IMAGE;
         goto end;
     }
 
-    // Step 3 check if the OTA update state is reboot. If not notify astarte of the error.
+    // Step 3 restart into the updated partition
+
+    if (ota_apply_timer) {
+        xTimerStop(ota_apply_timer, 0);
+    }
+    esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_APPLY_EVENT, NULL, 0, 0);
+    edgehog_err = reboot_into_update(edgehog_device, req_uuid, handle_nvs);
+    nvs_close(handle_nvs);
+
+end:
+    portENTER_CRITICAL(&ota_apply_lock);
+    ota_applying = false;
+    portEXIT_CRITICAL(&ota_apply_lock);
+    return edgehog_err;
+}
+
+void edgehog_ota_init(edgehog_device_handle_t edgehog_dev)
+{
+    esp_err_t esp_err;
+    nvs_handle_t handle_nvs;
+
+    // Step 1 open NVS
+
+    esp_err = edgehog_device_nvs_open(edgehog_dev, OTA_NAMESPACE, &handle_nvs);
+    if (esp_err != ESP_OK) {
+        ESP_LOGE(TAG, "Error opening the NVS OTA update namespace.");
+        return;
+    }
+
+    // Step 2 check if an UUID is present in NVS. If not there is no need to continue as there
+    // is no pending OTA update.
+
+    char req_uuid[ASTARTE_UUID_LEN];
+    size_t req_uuid_size = ASTARTE_UUID_LEN;
+    esp_err = nvs_get_str(handle_nvs, OTA_REQUEST_ID_KEY, req_uuid, &req_uuid_size);
+    if (esp_err != ESP_OK) {
+        if (esp_err != ESP_ERR_NVS_NOT_FOUND) {
+            ESP_LOGE(TAG, "Error fetching the OTA update request UUID from NVS.");
+        }
+        goto end;
+    }
+
+    // Step 3 check if the OTA update state is reboot. If not notify astarte of the error.
 
     uint8_t ota_state;
     esp_err = nvs_get_u8(handle_nvs, OTA_STATE_KEY, &ota_state);
+    if (esp_err == ESP_OK && ota_state == OTA_STATE_STAGED) {
+        // The staged update is still waiting to be applied
+        ESP_LOGI(TAG, "OTA update %s staged, waiting to be applied", req_uuid);
+        staged_apply_after_ms = 0;
+        staged_apply_before_ms = 0;
+        nvs_get_i64(handle_nvs, OTA_APPLY_AFTER_KEY, &staged_apply_after_ms);
+        nvs_get_i64(handle_nvs, OTA_APPLY_BEFORE_KEY, &staged_apply_before_ms);
+        nvs_close(handle_nvs);
+        start_apply_timer(edgehog_dev);
+        esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_STAGED_EVENT, NULL, 0, 0);
+        return;
+    }
+    if (esp_err == ESP_OK && ota_state == OTA_STATE_IN_PROGRESS && OTA_JOURNAL_INTERVAL > 0
+        && load_ota_request(edgehog_dev, handle_nvs, req_uuid) == EDGEHOG_OK
+        && start_ota_task() == EDGEHOG_OK) {
+        // The download was interrupted by a reset, continue from the last checkpoint
+        ESP_LOGI(TAG, "Resuming OTA update %s", req_uuid);
+        nvs_close(handle_nvs);
+        return;
+    }
     if (esp_err != ESP_OK || ota_state != OTA_STATE_REBOOT) {
         pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_FAILURE, 0, EDGEHOG_ERR_OTA_INTERNAL, "");
         esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_FAILED_EVENT, NULL, 0, 0);
@@ -180,19 +875,39 @@ void edgehog_ota_init(edgehog_device_handle_t edgehog_dev)
     const esp_partition_t *running_partition_info = esp_ota_get_running_partition();
     esp_err = nvs_get_u32(handle_nvs, OTA_PARTITION_ADDR_KEY, &prev_partition_addr);
     if (esp_err == ESP_OK && prev_partition_addr != running_partition_info->address) {
-        pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_SUCCESS, 0, EDGEHOG_OK, "");
+#if CONFIG_EDGEHOG_OTA_HEALTH_CHECK
+        esp_ota_img_states_t img_state;
+        if (esp_ota_get_state_partition(running_partition_info, &img_state) == ESP_OK
+            && img_state == ESP_OTA_IMG_PENDING_VERIFY) {
+            // The verdict is given by the health check
+            nvs_close(handle_nvs);
+            start_health_check(edgehog_dev, req_uuid);
+            return;
+        }
+#endif
+        char message[OTA_PROGRESS_MESSAGE_LEN];
+        format_success_message(handle_nvs, -1, message, sizeof(message));
+        pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_SUCCESS, 0, EDGEHOG_OK, message);
         esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_SUCCESS_EVENT, NULL, 0, 0);
     } else {
         ESP_LOGE(TAG, "Unable to switch into updated partition");
+        char message[OTA_ROLLBACK_REASON_LEN + 32] = "";
+#if CONFIG_EDGEHOG_OTA_HEALTH_CHECK
+        char reason[OTA_ROLLBACK_REASON_LEN];
+        size_t reason_size = OTA_ROLLBACK_REASON_LEN;
+        int64_t rollback_ms = 0;
+        if (nvs_get_str(handle_nvs, OTA_ROLLBACK_REASON_KEY, reason, &reason_size) == ESP_OK) {
+            nvs_get_i64(handle_nvs, OTA_ROLLBACK_TIME_KEY, &rollback_ms);
+            snprintf(message, sizeof(message), "%s after %lld ms", reason, (long long) rollback_ms);
+        }
+#endif
         pub_ota_event(
-            edgehog_dev, req_uuid, OTA_EVENT_FAILURE, 0, EDGEHOG_ERR_OTA_SYSTEM_ROLLBACK, "");
+            edgehog_dev, req_uuid, OTA_EVENT_FAILURE, 0, EDGEHOG_ERR_OTA_SYSTEM_ROLLBACK, message);
         esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_FAILED_EVENT, NULL, 0, 0);
     }
 
 end:
-    nvs_erase_key(handle_nvs, OTA_REQUEST_ID_KEY);
-    nvs_set_u8(handle_nvs, OTA_STATE_KEY, OTA_STATE_IDLE);
-    nvs_commit(handle_nvs);
+    clear_ota_state(handle_nvs);
     nvs_close(handle_nvs);
 }
 
@@ -214,9 +929,7 @@ edgehog_err_t edgehog_ota_event(
         return EDGEHOG_ERR_OTA_INVALID_REQUEST;
     }
 
-    uint32_t req_uuid_len;
-    const char *req_uuid
-        = astarte_bson_deserializer_element_to_string(req_uuid_element, &req_uuid_len);
+    const char *req_uuid = astarte_bson_deserializer_element_to_string(req_uuid_element, NULL);
     ESP_LOGI(TAG, "OTA UPDATE REQUEST UUID : %s", req_uuid);
 
     astarte_bson_element_t url_element;
@@ -228,8 +941,14 @@ edgehog_err_t edgehog_ota_event(
         esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_FAILED_EVENT, NULL, 0, 0);
         return EDGEHOG_ERR_OTA_INVALID_REQUEST;
     }
-    uint32_t ota_url_len;
-    const char *ota_url = astarte_bson_deserializer_element_to_string(url_element, &ota_url_len);
+    const char *ota_url = astarte_bson_deserializer_element_to_string(url_element, NULL);
+    if (!is_ota_url_allowed(ota_url)) {
+        ESP_LOGE(TAG, "OTA URL scheme not allowed");
+        pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_FAILURE, 0, EDGEHOG_ERR_OTA_INVALID_REQUEST,
+            "URL scheme not allowed.");
+        esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_FAILED_EVENT, NULL, 0, 0);
+        return EDGEHOG_ERR_OTA_INVALID_REQUEST;
+    }
 
     astarte_bson_element_t operation_element;
     astarte_err = astarte_bson_deserializer_element_lookup(doc, "operation", &operation_element);
@@ -243,6 +962,45 @@ edgehog_err_t edgehog_ota_event(
     const char *ota_operation
         = astarte_bson_deserializer_element_to_string(operation_element, NULL);
 
+    // The download rate limit is optional
+    uint32_t req_max_bytes_per_sec = 0;
+    astarte_bson_element_t rate_element;
+    if (astarte_bson_deserializer_element_lookup(doc, "maxBytesPerSecond", &rate_element)
+        == ASTARTE_OK) {
+        int64_t rate = 0;
+        if (rate_element.type == BSON_TYPE_INT32) {
+            rate = astarte_bson_deserializer_element_to_int32(rate_element);
+        } else if (rate_element.type == BSON_TYPE_INT64) {
+            rate = astarte_bson_deserializer_element_to_int64(rate_element);
+        }
+        if (rate > 0 && rate <= UINT32_MAX) {
+            req_max_bytes_per_sec = (uint32_t) rate;
+        }
+    }
+
+    // The maintenance window is optional, when present the update is staged
+    int64_t apply_after_ms = get_request_timestamp(doc, "applyAfter");
+    int64_t apply_before_ms = get_request_timestamp(doc, "applyBefore");
+    if (apply_before_ms > 0 && apply_after_ms == 0) {
+        apply_after_ms = EDGEHOG_MIN_VALID_EPOCH_S * 1000;
+    }
+
+    // The target is optional, requests without it update the device itself
+    const edgehog_ota_sink_t *sink = NULL;
+    astarte_bson_element_t target_element;
+    if (astarte_bson_deserializer_element_lookup(doc, "target", &target_element) == ASTARTE_OK
+        && target_element.type == BSON_TYPE_STRING) {
+        const char *target = astarte_bson_deserializer_element_to_string(target_element, NULL);
+        if (!edgehog_dev->ota_sink.target || strcmp(target, edgehog_dev->ota_sink.target) != 0) {
+            ESP_LOGE(TAG, "Unknown OTA target %s", target);
+            pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_FAILURE, 0,
+                EDGEHOG_ERR_OTA_INVALID_REQUEST, "Unknown OTA target.");
+            esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_FAILED_EVENT, NULL, 0, 0);
+            return EDGEHOG_ERR_OTA_INVALID_REQUEST;
+        }
+        sink = &edgehog_dev->ota_sink;
+    }
+
     // Step 2 Perform the requested Update or Cancel operation.
 
     if (strcmp("Update", ota_operation) == 0) {
@@ -254,15 +1012,26 @@ edgehog_err_t edgehog_ota_event(
         }
         // Spawn a new task that will perform the update
         ota_task_data.edgehog_dev = edgehog_dev;
-        ota_task_data.req_uuid = (char *) malloc((req_uuid_len + 1) * sizeof(char));
-        strcpy(ota_task_data.req_uuid, req_uuid);
-        ota_task_data.ota_url = (char *) malloc((ota_url_len + 1) * sizeof(char));
-        strcpy(ota_task_data.ota_url, ota_url);
-        TaskHandle_t ota_task_handle = NULL;
-        BaseType_t ota_task_ret = xTaskCreate(ota_task_code, OTA_UPDATE_TASK_NAME, 4096,
-            &ota_task_data, tskIDLE_PRIORITY, &ota_task_handle);
-        if (ota_task_ret != pdPASS) {
-            ESP_LOGE(TAG, "OTA update task creation failed.");
+        ota_task_data.req_max_bytes_per_sec = req_max_bytes_per_sec;
+        ota_task_data.apply_after_ms = apply_after_ms;
+        ota_task_data.apply_before_ms = apply_before_ms;
+        ota_task_data.resume = false;
+        ota_task_data.sink = sink;
+        ota_task_data.req_uuid = ota_strdup(req_uuid);
+        ota_task_data.sources[0].url = ota_strdup(ota_url);
+        ota_task_data.sources_count = 1;
+        ota_task_data.source_idx = 0;
+        ota_task_data.redirect_url = NULL;
+        if (!ota_task_data.req_uuid || !ota_task_data.sources[0].url) {
+            ESP_LOGE(TAG, "Unable to store the OTA request.");
+            ota_free_request(&ota_task_data);
+            pub_ota_event(
+                edgehog_dev, req_uuid, OTA_EVENT_FAILURE, 0, EDGEHOG_ERR_OTA_INTERNAL, "");
+            esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_FAILED_EVENT, NULL, 0, 0);
+            return EDGEHOG_ERR_OTA_INTERNAL;
+        }
+        parse_ota_mirrors(doc, &ota_task_data);
+        if (start_ota_task() != EDGEHOG_OK) {
             pub_ota_event(
                 edgehog_dev, req_uuid, OTA_EVENT_FAILURE, 0, EDGEHOG_ERR_OTA_INTERNAL, "");
             esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_FAILED_EVENT, NULL, 0, 0);
@@ -271,6 +1040,9 @@ edgehog_err_t edgehog_ota_event(
     } else if (strcmp("Cancel", ota_operation) == 0) {
         // Verify that the update is already in progress
         TaskHandle_t ota_task = xTaskGetHandle(OTA_UPDATE_TASK_NAME);
+        if (!ota_task && cancel_staged_ota(edgehog_dev, req_uuid) == EDGEHOG_OK) {
+            return EDGEHOG_OK;
+        }
         if (!ota_task) {
             pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_FAILURE, 0,
                 EDGEHOG_ERR_OTA_INVALID_REQUEST,
@@ -326,7 +1098,10 @@ static void ota_task_code(void *pvParameters)
 
     // Step 1 acknowledge the valid update request and notify the start of the download operation.
 
-    pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_ACKNOWLEDGED, 0, EDGEHOG_OK, "");
+    edgehog_ota_perf_init(&task_data->perf);
+    if (!task_data->resume) {
+        pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_ACKNOWLEDGED, 0, EDGEHOG_OK, "");
+    }
 
     // Step 2 Open NVS namespace for the OTA update
 
@@ -342,47 +1117,87 @@ static void ota_task_code(void *pvParameters)
         goto selfdestruct;
     }
 
-    // Step 3 perform the OTA update
+    // Step 3 perform the OTA update, a new request supersedes a staged one. External targets do
+    // not use the update partition, the OTA state in NVS is left to the ESP32 updates.
+
+    if (!task_data->sink && running_image_pending_verify()) {
+        ESP_LOGE(TAG, "Running image pending verification, OTA update refused");
+        pub_ota_event(
+            edgehog_dev, req_uuid, OTA_EVENT_FAILURE, 0, EDGEHOG_ERR_OTA_INVALID_IMAGE, "");
+        esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_FAILED_EVENT, NULL, 0, 0);
+        nvs_close(handle_nvs);
+        goto selfdestruct;
+    }
+    task_data->staged = !task_data->sink && task_data->apply_after_ms > 0;
+#if CONFIG_EDGEHOG_OTA_APPLY_REQUIRES_APPROVAL
+    task_data->staged = !task_data->sink;
+#endif
+    if (!task_data->sink) {
+        uint8_t ota_state = OTA_STATE_IDLE;
+        nvs_get_u8(handle_nvs, OTA_STATE_KEY, &ota_state);
+        if (ota_state == OTA_STATE_STAGED) {
+            discard_staged_ota(edgehog_dev, handle_nvs, "Superseded by a new OTA update request.");
+        }
+        nvs_set_u8(handle_nvs, OTA_STATE_KEY, OTA_STATE_IN_PROGRESS);
+        nvs_commit(handle_nvs);
+    }
 
     ESP_LOGI(TAG, "DOWNLOAD_AND_DEPLOY");
-    nvs_set_u8(handle_nvs, OTA_STATE_KEY, OTA_STATE_IN_PROGRESS);
-    nvs_commit(handle_nvs);
 
     edgehog_err_t edgehog_err = perform_ota(task_data, &handle_nvs);
+    edgehog_ota_perf_publish(edgehog_dev, req_uuid, &task_data->perf, edgehog_err);
     if (edgehog_err == EDGEHOG_OK) {
-        pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_DEPLOYING, 0, EDGEHOG_OK, "");
-        ESP_LOGI(TAG, "OTA PREPARE REBOOT");
-        nvs_set_u8(handle_nvs, OTA_STATE_KEY, OTA_STATE_REBOOT);
-        nvs_commit(handle_nvs);
-        const esp_partition_t *partition_info = (esp_partition_t *) esp_ota_get_running_partition();
-        if (!partition_info) {
-            ESP_LOGW(TAG, "OTA FAILED");
-            pub_ota_event(
-                edgehog_dev, req_uuid, OTA_EVENT_FAILURE, 0, EDGEHOG_ERR_OTA_INTERNAL, "");
-            esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_FAILED_EVENT, NULL, 0, 0);
+        char message[OTA_PROGRESS_MESSAGE_LEN];
+        int64_t elapsed_us = esp_timer_get_time() - task_data->perf.start_us;
+        uint32_t throughput = elapsed_us > 0
+            ? (uint32_t) (((uint64_t) task_data->perf.bytes_read * 1000000) / elapsed_us)
+            : 0;
+        snprintf(message, sizeof(message), "%u bytes, %u B/s",
+            (unsigned int) task_data->perf.bytes_read, (unsigned int) throughput);
+        pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_DEPLOYING, 0, EDGEHOG_OK, message);
+        if (task_data->sink) {
+            // The external target has already validated and applied the image
+            ESP_LOGI(TAG, "OTA TARGET %s UPDATED", task_data->sink->target);
+            pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_DEPLOYED, 0, EDGEHOG_OK, "");
+            pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_SUCCESS, 0, EDGEHOG_OK, message);
+            esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_SUCCESS_EVENT, NULL, 0, 0);
+            nvs_close(handle_nvs);
             goto selfdestruct;
         }
-        nvs_set_u32(handle_nvs, OTA_PARTITION_ADDR_KEY, partition_info->address);
+        if (task_data->staged) {
+            edgehog_err = stage_ota_update(task_data, handle_nvs);
+            if (edgehog_err == EDGEHOG_OK) {
+                ESP_LOGI(TAG, "OTA STAGED");
+                nvs_close(handle_nvs);
+                pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_DEPLOYED, 0, EDGEHOG_OK,
+                    "Staged, waiting to be applied.");
+                esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_STAGED_EVENT, NULL, 0, 0);
+                goto selfdestruct;
+            }
+        } else {
+            ESP_LOGI(TAG, "OTA PREPARE REBOOT");
+            pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_DEPLOYED, 0, EDGEHOG_OK, "");
+            edgehog_err = reboot_into_update(edgehog_dev, req_uuid, handle_nvs);
+        }
+        ESP_LOGW(TAG, "OTA FAILED");
+        pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_FAILURE, 0, edgehog_err, "");
+        esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_FAILED_EVENT, NULL, 0, 0);
+        nvs_set_u8(handle_nvs, OTA_STATE_KEY, OTA_STATE_IDLE);
         nvs_commit(handle_nvs);
         nvs_close(handle_nvs);
-        pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_DEPLOYED, 0, EDGEHOG_OK, "");
-        pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_REBOOTING, 0, EDGEHOG_OK, "");
-        ESP_LOGI(TAG, "Device restart in 5 seconds");
-        vTaskDelay(pdMS_TO_TICKS(5000));
-        ESP_LOGI(TAG, "Device restart now");
-        esp_restart();
     } else {
         ESP_LOGW(TAG, "OTA FAILED");
         pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_FAILURE, 0, edgehog_err, "");
         esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_FAILED_EVENT, NULL, 0, 0);
-        nvs_set_u8(handle_nvs, OTA_STATE_KEY, OTA_STATE_IDLE);
-        nvs_commit(handle_nvs);
+        if (!task_data->sink) {
+            nvs_set_u8(handle_nvs, OTA_STATE_KEY, OTA_STATE_IDLE);
+            nvs_commit(handle_nvs);
+        }
         nvs_close(handle_nvs);
     }
 
 selfdestruct:
-    free(((ota_task_data_t *) pvParameters)->req_uuid);
-    free(((ota_task_data_t *) pvParameters)->ota_url);
+    ota_free_request(task_data);
 
     vTaskDelete(NULL);
 }
@@ -390,122 +1205,1370 @@ selfdestruct:
 static edgehog_err_t perform_ota(ota_task_data_t *task_data, nvs_handle_t *handle_nvs)
 {
     esp_err_t esp_err;
-    edgehog_err_t edgehog_err;
+    edgehog_err_t edgehog_err = EDGEHOG_ERR_OTA_INTERNAL;
+
+    // Step 1 set the request ID to the received uuid in NVS, external targets keep the ID of a
+    // staged update
+
+    if (!task_data->sink) {
+        esp_err = nvs_set_str(*handle_nvs, OTA_REQUEST_ID_KEY, task_data->req_uuid);
+        nvs_commit(*handle_nvs);
+        if (esp_err != ESP_OK) {
+            ESP_LOGE(TAG, "Unable to write OTA req_uuid into NVS, OTA canceled");
+            nvs_close(*handle_nvs);
+            return EDGEHOG_ERR_NVS;
+        }
+        if (OTA_JOURNAL_INTERVAL > 0) {
+            save_ota_request(task_data, *handle_nvs);
+        }
+    }
 
-    // Step 1 set the request ID to the received uuid in NVS
+    // Step 2 select the fastest source when mirrors are available
 
-    esp_err = nvs_set_str(*handle_nvs, OTA_REQUEST_ID_KEY, task_data->req_uuid);
-    nvs_commit(*handle_nvs);
-    if (esp_err != ESP_OK) {
-        ESP_LOGE(TAG, "Unable to write OTA req_uuid into NVS, OTA canceled");
-        nvs_close(*handle_nvs);
-        return EDGEHOG_ERR_NVS;
+    if (task_data->sources_count > 1) {
+        probe_ota_sources(task_data);
+    }
+
+    // Step 3 prepare the sink or the update partition, kept across attempts to continue from the
+    // same offset
+
+    ota_download_t download = { 0 };
+    if (task_data->sink) {
+        download.sink = task_data->sink;
+        download.image_size = -1;
+    } else {
+        download.partition = esp_ota_get_next_update_partition(NULL);
+        download.staged = task_data->staged;
+        download.perf = &task_data->perf;
+        const esp_partition_t *running_partition = esp_ota_get_running_partition();
+        if (!download.partition || download.partition == running_partition) {
+            ESP_LOGE(TAG, "Unable to find the update partition");
+            return EDGEHOG_ERR_OTA_INTERNAL;
+        }
+        begin_ota_download(task_data, &download, *handle_nvs);
     }
 
-    // Step 2 attempt OTA operation for MAX_OTA_RETRY tries
+    // Step 4 attempt OTA operation for MAX_OTA_RETRY tries, failing over to the next source. The
+    // attempts share the HTTP client, so that they resume its TLS session.
 
-    for (uint8_t update_attempts = 0; update_attempts < MAX_OTA_RETRY; update_attempts++) {
+    esp_http_client_handle_t client = get_ota_http_client();
+    if (!client) {
+        ESP_LOGE(TAG, "Unable to create the OTA HTTP client");
+        return EDGEHOG_ERR_OTA_INTERNAL;
+    }
+    uint8_t slow_sources = 0;
+    for (uint8_t update_attempts = 0; update_attempts < MAX_OTA_RETRY;) {
         pub_ota_event(
             task_data->edgehog_dev, task_data->req_uuid, OTA_EVENT_DOWNLOADING, 0, EDGEHOG_OK, "");
-        edgehog_err = perform_ota_attempt(task_data);
-        if (edgehog_err == EDGEHOG_OK || edgehog_err == EDGEHOG_ERR_OTA_CANCELED) {
+        // Once every other source has been found slow the current one is kept
+        bool allow_failover = slow_sources + 1 < task_data->sources_count;
+        bool slow = false;
+        edgehog_err = perform_ota_attempt(task_data, client, &download, allow_failover, &slow);
+        // The sink can not take the same data again, its errors are not retried
+        if (edgehog_err == EDGEHOG_OK || edgehog_err == EDGEHOG_ERR_OTA_CANCELED
+            || download.sink_failed) {
             break;
         }
+        select_next_ota_source(task_data);
+        if (slow) {
+            slow_sources++;
+            continue;
+        }
+        task_data->perf.retries++;
         vTaskDelay(pdMS_TO_TICKS(update_attempts * 2000));
         pub_ota_event(
             task_data->edgehog_dev, task_data->req_uuid, OTA_EVENT_ERROR, 0, edgehog_err, "");
         ESP_LOGW(TAG, "! OTA FAILED, ATTEMPT #%d !", update_attempts);
+        update_attempts++;
     }
+    release_ota_http_client(client);
 
-    // Step 3 check one last time if operation has been canceled
+    // Step 5 check one last time if operation has been canceled
 
     if (edgehog_err == EDGEHOG_OK
         && pdTRUE == xTaskNotifyWait(ULONG_MAX, ULONG_MAX, NULL, pdMS_TO_TICKS(0u))) {
         edgehog_err = EDGEHOG_ERR_OTA_CANCELED;
     }
-    return edgehog_err;
+    // The journal is only needed to recover from a reset during the download
+    nvs_erase_key(*handle_nvs, OTA_JOURNAL_KEY);
+    nvs_commit(*handle_nvs);
+    if (edgehog_err != EDGEHOG_OK) {
+        if (download.sink_open) {
+            download.sink->abort(download.sink->user_data);
+        }
+        return edgehog_err;
+    }
+
+    // Step 6 validate the image and boot from it unless staged, or let the sink apply it
+
+    return finish_ota_image(&download);
 }
 
-static edgehog_err_t perform_ota_attempt(ota_task_data_t *task_data)
+static esp_http_client_handle_t get_ota_http_client(void)
 {
-    esp_https_ota_handle_t https_ota_handle = NULL;
-
-    // Step 1 begin OTA update over HTTPS
+#if OTA_SAVE_TLS_SESSION
+    if (ota_http_client) {
+        return ota_http_client;
+    }
+#endif
 
+    // The URL is set by each attempt
     esp_http_client_config_t http_config
-        = {.url = task_data->ota_url,
+        = {.url = "https://localhost",
               .timeout_ms = OTA_REQ_TIMEOUT_MS,
+              .event_handler = ota_http_event_handler,
+              .keep_alive_enable = true,
 #if CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
               .crt_bundle_attach = esp_crt_bundle_attach,
+#endif
+#if OTA_SAVE_TLS_SESSION
+              .save_client_session = true,
 #endif
           };
-    esp_https_ota_config_t ota_config = {
-        .http_config = &http_config,
-    };
-    esp_err_t ota_begin_err = esp_https_ota_begin(&ota_config, &https_ota_handle);
-    if (ota_begin_err != ESP_OK || !https_ota_handle) {
-        return EDGEHOG_ERR_OTA_INTERNAL;
+    esp_http_client_handle_t client = esp_http_client_init(&http_config);
+#if OTA_SAVE_TLS_SESSION
+    ota_http_client = client;
+    ota_tls_session_host[0] = '\0';
+#endif
+    return client;
+}
+
+static void release_ota_http_client(esp_http_client_handle_t client)
+{
+#if OTA_SAVE_TLS_SESSION
+    // The transport keeps the TLS session for the next request
+    esp_http_client_close(client);
+#else
+    esp_http_client_cleanup(client);
+#endif
+}
+
+static edgehog_err_t perform_ota_attempt(ota_task_data_t *task_data,
+    esp_http_client_handle_t client, ota_download_t *download, bool allow_failover, bool *slow)
+{
+    ota_attempt_data_t attempt_data = { .range_total = -1 };
+    edgehog_err_t edgehog_err = EDGEHOG_ERR_NETWORK;
+    bool check_throughput = allow_failover && CONFIG_EDGEHOG_OTA_FAILOVER_MIN_BYTES_PER_SEC > 0;
+
+    // Step 1 connect to the source, retries skip the redirections of the first attempt
+
+    const char *url = task_data->redirect_url ? task_data->redirect_url
+                                              : task_data->sources[task_data->source_idx].url;
+#if CONFIG_EDGEHOG_OTA_PERF_TELEMETRY
+    // The blocking lookup only feeds the DNS time of the performance record
+    task_data->perf.dns_us = resolve_ota_host(url);
+#endif
+
+    get_ota_url_host(url, attempt_data.host, sizeof(attempt_data.host));
+    esp_http_client_set_user_data(client, &attempt_data);
+#if CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    char *buffer = ota_buffer;
+#else
+    char *buffer = malloc(OTA_BUFFER_SIZE);
+#endif
+    if (!buffer || esp_http_client_set_url(client, url) != ESP_OK) {
+        edgehog_err = EDGEHOG_ERR_OTA_INTERNAL;
+        goto end;
+    }
+
+    // Step 2 request the image from the current offset
+
+    char range[24];
+    snprintf(range, sizeof(range), "bytes=%d-", download->offset);
+    int64_t begin_us = esp_timer_get_time();
+    int status = open_ota_source(
+        client, &attempt_data, download->offset > 0 ? range : NULL, buffer, OTA_BUFFER_SIZE);
+    if (attempt_data.connected_us > 0) {
+        task_data->perf.connect_us = attempt_data.connected_us - begin_us;
+        task_data->perf.connection_us += task_data->perf.connect_us;
+    }
+    task_data->perf.connections += attempt_data.connections;
+    task_data->perf.full_handshakes += attempt_data.full_handshakes;
+    task_data->perf.full_handshake_us += attempt_data.full_handshake_us;
+    task_data->perf.resumed_handshakes += attempt_data.resumed_handshakes;
+    task_data->perf.resumed_handshake_us += attempt_data.resumed_handshake_us;
+    ESP_LOGI(TAG, "OTA connection: %d connections, %d full and %d resumed TLS handshakes",
+        attempt_data.connections, attempt_data.full_handshakes, attempt_data.resumed_handshakes);
+    if (status != 200 && status != 206) {
+        ESP_LOGW(TAG, "OTA source answered with status %d", status);
+        // The redirection target may have expired, the next attempt starts from the source URL
+        ota_free(task_data->redirect_url);
+        task_data->redirect_url = NULL;
+        goto end;
+    }
+    if (!task_data->redirect_url) {
+        cache_redirect_url(task_data, client);
+    }
+
+    // A server ignoring the Range header sends the whole image, the known part is skipped
+    int skip_len = status == 200 ? download->offset : 0;
+    int image_size = status == 206 ? attempt_data.range_total
+                                   : (int) esp_http_client_get_content_length(client);
+    if (download->image_size > 0 && image_size > 0 && image_size != download->image_size) {
+        ESP_LOGE(TAG, "OTA source serves an image of a different size, %d", image_size);
+        edgehog_err = EDGEHOG_ERR_OTA_INVALID_IMAGE;
+        goto end;
+    }
+    if (image_size > 0) {
+        download->image_size = image_size;
     }
 
-    // Step 2 wait for OTA update to terminate
+    // Step 3 write the received data until the image is complete
 
-    esp_err_t ota_perform_err;
-    int image_size = esp_https_ota_get_image_size(https_ota_handle);
-    int read_perc;
-    int read_perc_rounded;
-    int last_perc_sent = 0;
+    int64_t now_us = esp_timer_get_time();
+    ota_progress_t progress = {
+        .image_size = download->image_size,
+        .last_sent_us = now_us,
+        .last_sent_len = download->offset,
+        .sample_us = now_us,
+        .sample_len = download->offset,
+    };
+    ota_token_bucket_t bucket = { .tokens = 0, .refill_us = now_us };
+    int64_t window_start_us = now_us;
+    int64_t window_network_us = 0;
+    int window_len = 0;
 
     while (1) {
-        if (pdFALSE == xTaskNotifyWait(ULONG_MAX, ULONG_MAX, NULL, pdMS_TO_TICKS(0u))) {
-            ota_perform_err = esp_https_ota_perform(https_ota_handle);
-            if (ota_perform_err == ESP_ERR_HTTPS_OTA_IN_PROGRESS) {
-                float read_size = (float) esp_https_ota_get_image_len_read(https_ota_handle);
-                read_perc = (int) (100 * read_size / image_size);
-                read_perc_rounded = read_perc - (read_perc % OTA_PROGRESS_PERC_ROUNDING_STEP);
-                if (read_perc_rounded != last_perc_sent) {
-                    pub_ota_event(task_data->edgehog_dev, task_data->req_uuid,
-                        OTA_EVENT_DOWNLOADING, read_perc_rounded, EDGEHOG_OK, "");
-                    ESP_LOGI(TAG, "Read perc: %d", read_perc_rounded);
-                    last_perc_sent = read_perc_rounded;
-                }
-            } else {
-                break;
+        if (pdTRUE == xTaskNotifyWait(ULONG_MAX, ULONG_MAX, NULL, pdMS_TO_TICKS(0u))) {
+            ESP_LOGD(TAG, "Update canceled.");
+            edgehog_err = EDGEHOG_ERR_OTA_CANCELED;
+            goto end;
+        }
+        int64_t read_us = esp_timer_get_time();
+        int read_len = esp_http_client_read(client, buffer, OTA_BUFFER_SIZE);
+        int64_t received_us = esp_timer_get_time();
+        if (read_len < 0) {
+            ESP_LOGD(TAG, "Error reading the OTA image.");
+            goto end;
+        }
+        if (read_len == 0) {
+            if (!esp_http_client_is_complete_data_received(client)
+                || (download->image_size > 0 && download->offset != download->image_size)) {
+                ESP_LOGD(TAG, "Complete data was not received.");
+                goto end;
             }
-        } else {
-            esp_https_ota_abort(https_ota_handle);
+            edgehog_err = EDGEHOG_OK;
+            goto end;
+        }
+
+        const char *data = buffer;
+        if (skip_len > 0) {
+            int skipped = read_len < skip_len ? read_len : skip_len;
+            skip_len -= skipped;
+            data += skipped;
+            read_len -= skipped;
+            if (read_len == 0) {
+                continue;
+            }
+        }
+        edgehog_err_t write_err = write_ota_image(download, data, read_len);
+        int64_t written_us = esp_timer_get_time();
+        if (write_err != EDGEHOG_OK) {
+            edgehog_err = write_err;
+            goto end;
+        }
+        edgehog_ota_perf_add_chunk(
+            &task_data->perf, read_len, received_us - read_us, written_us - received_us);
+        update_ota_progress(task_data, &progress, download->offset);
+        if (throttle_ota_download(task_data, &bucket, read_len)) {
             ESP_LOGD(TAG, "Update canceled.");
-            return EDGEHOG_ERR_OTA_CANCELED;
+            edgehog_err = EDGEHOG_ERR_OTA_CANCELED;
+            goto end;
+        }
+
+        // Step 4 fail over when the network throughput of the source stays below the threshold,
+        // the time spent throttling is not accounted
+
+        window_len += read_len;
+        window_network_us += received_us - read_us;
+        if (check_throughput && written_us - window_start_us >= OTA_FAILOVER_WINDOW_US) {
+            uint64_t throughput = window_network_us > 0
+                ? ((uint64_t) window_len * 1000000) / window_network_us
+                : UINT64_MAX;
+            if (throughput < CONFIG_EDGEHOG_OTA_FAILOVER_MIN_BYTES_PER_SEC) {
+                ESP_LOGW(TAG, "OTA source too slow, %llu B/s", (unsigned long long) throughput);
+                *slow = true;
+                goto end;
+            }
+            window_start_us = written_us;
+            window_network_us = 0;
+            window_len = 0;
         }
     }
 
-    // Step 3 finish the OTA update
+end:
+#if !CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    free(buffer);
+#endif
+    // The next attempt opens a new connection, offering the saved TLS session
+    esp_http_client_close(client);
+    esp_http_client_set_user_data(client, NULL);
+    return edgehog_err;
+}
+
+static void update_ota_progress(ota_task_data_t *task_data, ota_progress_t *progress, int read_len)
+{
+    int64_t now_us = esp_timer_get_time();
+
+    // Step 1 update the moving average of the throughput
 
-    if (esp_https_ota_is_complete_data_received(https_ota_handle) != true) {
-        ESP_LOGD(TAG, "Complete data was not received.");
-        return EDGEHOG_ERR_NETWORK;
+    int64_t sample_elapsed_us = now_us - progress->sample_us;
+    if (sample_elapsed_us >= OTA_PROGRESS_SAMPLE_US) {
+        int64_t sample_len = read_len - progress->sample_len;
+        uint64_t sample = (uint64_t) (sample_len * 1000000 / sample_elapsed_us);
+        if (progress->throughput > 0) {
+            sample = (progress->throughput * (OTA_PROGRESS_EWMA_WEIGHT - 1ULL) + sample)
+                / OTA_PROGRESS_EWMA_WEIGHT;
+        }
+        progress->throughput = (uint32_t) sample;
+        progress->sample_us = now_us;
+        progress->sample_len = read_len;
     }
-    esp_err_t ota_finish_err = esp_https_ota_finish(https_ota_handle);
-    // If there was an error in esp_https_ota_perform(), then it is given more precedence than and
-    // error in esp_https_ota_finish().
-    if (ota_perform_err == ESP_ERR_INVALID_VERSION
-        || ota_perform_err == ESP_ERR_OTA_VALIDATE_FAILED) {
-        ESP_LOGD(TAG, "Image validation failed, image is corrupted");
-        return EDGEHOG_ERR_OTA_INVALID_IMAGE;
-    } else if (ota_perform_err != ESP_OK) {
-        ESP_LOGD(TAG, "Update failed 0x%x", ota_perform_err);
-        return EDGEHOG_ERR_OTA_INTERNAL;
+
+    // Step 2 check if enough time has passed and enough data has been received
+
+    if (now_us - progress->last_sent_us < CONFIG_EDGEHOG_OTA_PROGRESS_MIN_INTERVAL_MS * 1000LL
+        || read_len - progress->last_sent_len < CONFIG_EDGEHOG_OTA_PROGRESS_MIN_BYTES) {
+        return;
     }
-    if (ota_finish_err == ESP_ERR_OTA_VALIDATE_FAILED) {
-        ESP_LOGD(TAG, "Image validation failed, image is corrupted");
-        return EDGEHOG_ERR_OTA_INVALID_IMAGE;
+
+    // Step 3 publish the progress, an unknown image size is reported as 0% progress
+
+    char message[OTA_PROGRESS_MESSAGE_LEN];
+    int32_t read_perc = 0;
+    if (progress->image_size > 0) {
+        read_perc = (int32_t) (((int64_t) read_len * 100) / progress->image_size);
+        if (read_perc > 100) {
+            read_perc = 100;
+        }
+        int64_t eta_s = -1;
+        if (progress->throughput > 0 && progress->image_size >= read_len) {
+            eta_s = (progress->image_size - read_len) / progress->throughput;
+        }
+        snprintf(message, sizeof(message), "%d/%d bytes, %u B/s, ETA %lld s", read_len,
+            progress->image_size, (unsigned int) progress->throughput, (long long) eta_s);
+    } else {
+        snprintf(message, sizeof(message), "%d bytes, %u B/s", read_len,
+            (unsigned int) progress->throughput);
     }
-    if (ota_finish_err != ESP_OK) {
-        ESP_LOGD(TAG, "Update failed 0x%x", ota_finish_err);
-        return EDGEHOG_ERR_OTA_INTERNAL;
+    pub_ota_event(task_data->edgehog_dev, task_data->req_uuid, OTA_EVENT_DOWNLOADING, read_perc,
+        EDGEHOG_OK, message);
+    ESP_LOGI(TAG, "Read perc: %d (%s)", (int) read_perc, message);
+    progress->last_sent_us = now_us;
+    progress->last_sent_len = read_len;
+}
+
+static bool throttle_ota_download(
+    ota_task_data_t *task_data, ota_token_bucket_t *bucket, int chunk_len)
+{
+    edgehog_device_handle_t edgehog_dev = task_data->edgehog_dev;
+    portENTER_CRITICAL(&ota_throttle_lock);
+    edgehog_ota_throttle_t throttle = edgehog_dev->ota_throttle;
+    portEXIT_CRITICAL(&ota_throttle_lock);
+    if (task_data->req_max_bytes_per_sec > 0) {
+        throttle.max_bytes_per_sec = task_data->req_max_bytes_per_sec;
     }
-    return EDGEHOG_OK;
+
+    // Step 1 wait for the application outgoing queue when running in background
+
+    if (throttle.priority == EDGEHOG_OTA_PRIORITY_BACKGROUND && throttle.pending_cb) {
+        while (throttle.pending_cb(throttle.pending_user_data) > throttle.pending_threshold) {
+            if (pdTRUE
+                == xTaskNotifyWait(
+                    ULONG_MAX, ULONG_MAX, NULL, pdMS_TO_TICKS(OTA_BACKGROUND_POLL_MS))) {
+                return true;
+            }
+        }
+    }
+
+    // Step 2 refill the bucket, allowing a burst of at most one second of data
+
+    int64_t now_us = esp_timer_get_time();
+    if (throttle.max_bytes_per_sec == 0) {
+        bucket->tokens = 0;
+        bucket->refill_us = now_us;
+        return false;
+    }
+    bucket->tokens += (now_us - bucket->refill_us) * throttle.max_bytes_per_sec / 1000000;
+    if (bucket->tokens > throttle.max_bytes_per_sec) {
+        bucket->tokens = throttle.max_bytes_per_sec;
+    }
+    bucket->refill_us = now_us;
+
+    // Step 3 consume the tokens for the received chunk and wait for the missing ones
+
+    bucket->tokens -= chunk_len;
+    if (bucket->tokens < 0) {
+        int64_t wait_ms = (-bucket->tokens * 1000) / throttle.max_bytes_per_sec;
+        TickType_t wait_ticks = pdMS_TO_TICKS(wait_ms);
+        if (wait_ticks == 0) {
+            wait_ticks = 1;
+        }
+        if (pdTRUE == xTaskNotifyWait(ULONG_MAX, ULONG_MAX, NULL, wait_ticks)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void clear_ota_state(nvs_handle_t handle_nvs)
+{
+    nvs_erase_key(handle_nvs, OTA_REQUEST_ID_KEY);
+    nvs_erase_key(handle_nvs, OTA_APPLY_AFTER_KEY);
+    nvs_erase_key(handle_nvs, OTA_APPLY_BEFORE_KEY);
+    nvs_erase_key(handle_nvs, OTA_ROLLBACK_REASON_KEY);
+    nvs_erase_key(handle_nvs, OTA_ROLLBACK_TIME_KEY);
+    nvs_erase_key(handle_nvs, OTA_JOURNAL_KEY);
+    for (unsigned int i = 0; i < OTA_MAX_SOURCES; i++) {
+        char source_key[OTA_SOURCE_KEY_LEN];
+        snprintf(source_key, sizeof(source_key), OTA_SOURCE_KEY_FMT, i);
+        nvs_erase_key(handle_nvs, source_key);
+    }
+    nvs_erase_key(handle_nvs, OTA_MAX_RATE_KEY);
+    nvs_erase_key(handle_nvs, OTA_SHUTDOWN_TIME_KEY);
+    nvs_set_u8(handle_nvs, OTA_STATE_KEY, OTA_STATE_IDLE);
+    nvs_commit(handle_nvs);
+}
+
+#if CONFIG_EDGEHOG_OTA_HEALTH_CHECK
+static void start_health_check(edgehog_device_handle_t edgehog_dev, const char *req_uuid)
+{
+    ESP_LOGI(TAG, "Updated image pending verification, starting health check");
+    strncpy(health_check_req_uuid, req_uuid, ASTARTE_UUID_LEN - 1);
+    // Without a health check the image stays pending and is rolled back at the next reset
+#if CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    ota_health_task = xTaskCreateStatic(health_check_task_code, OTA_HEALTH_TASK_NAME,
+        CONFIG_EDGEHOG_OTA_TASK_STACK_SIZE, edgehog_dev, tskIDLE_PRIORITY, ota_health_task_stack,
+        &ota_health_task_tcb);
+    BaseType_t health_task_ret = ota_health_task ? pdPASS : pdFAIL;
+#else
+    BaseType_t health_task_ret = xTaskCreate(health_check_task_code, OTA_HEALTH_TASK_NAME,
+        CONFIG_EDGEHOG_OTA_TASK_STACK_SIZE, edgehog_dev, tskIDLE_PRIORITY, &ota_health_task);
+#endif
+    if (health_task_ret != pdPASS) {
+        ESP_LOGE(TAG, "Unable to start the OTA health check");
+        ota_health_task = NULL;
+        return;
+    }
+    ota_health_timer = xTimerCreate(NULL, pdMS_TO_TICKS(OTA_HEALTH_CHECK_PERIOD_MS), pdTRUE, NULL,
+        health_check_timer_callback);
+    if (!ota_health_timer || xTimerStart(ota_health_timer, 0) != pdPASS) {
+        ESP_LOGE(TAG, "Unable to start the OTA health check");
+        vTaskDelete(ota_health_task);
+        ota_health_task = NULL;
+    }
+}
+
+static void health_check_timer_callback(TimerHandle_t timer_handle)
+{
+    (void) timer_handle;
+    xTaskNotifyGive(ota_health_task);
+}
+
+static void health_check_task_code(void *ctx)
+{
+    edgehog_device_handle_t edgehog_dev = (edgehog_device_handle_t) ctx;
+    const char *reason = NULL;
+    int64_t elapsed_ms;
+
+    // Step 1 check the Astarte connection and the application health probe at every timer period
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        elapsed_ms = esp_timer_get_time() / 1000;
+        reason = NULL;
+        if (!astarte_device_is_connected(edgehog_dev->astarte_device)) {
+            reason = "Astarte connection timeout";
+        } else if (edgehog_dev->ota_health_probe
+            && !edgehog_dev->ota_health_probe(edgehog_dev->ota_health_probe_user_data)) {
+            reason = "Health probe failed";
+        }
+        if (!reason || elapsed_ms >= CONFIG_EDGEHOG_OTA_HEALTH_CHECK_TIMEOUT_S * 1000LL) {
+            break;
+        }
+    }
+    xTimerDelete(ota_health_timer, 0);
+    ota_health_timer = NULL;
+
+    nvs_handle_t handle_nvs;
+    bool nvs_opened = edgehog_device_nvs_open(edgehog_dev, OTA_NAMESPACE, &handle_nvs) == ESP_OK;
+
+    // Step 2 mark the image as valid and notify Astarte
+
+    if (!reason) {
+        esp_ota_mark_app_valid_cancel_rollback();
+        ESP_LOGI(TAG, "Updated image verified after %lld ms", (long long) elapsed_ms);
+        char message[OTA_PROGRESS_MESSAGE_LEN];
+        if (nvs_opened) {
+            format_success_message(handle_nvs, elapsed_ms, message, sizeof(message));
+            clear_ota_state(handle_nvs);
+            nvs_close(handle_nvs);
+        } else {
+            snprintf(message, sizeof(message), "Verified after %lld ms", (long long) elapsed_ms);
+        }
+        pub_ota_event(
+            edgehog_dev, health_check_req_uuid, OTA_EVENT_SUCCESS, 0, EDGEHOG_OK, message);
+        esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_SUCCESS_EVENT, NULL, 0, 0);
+        goto end;
+    }
+
+    // Step 3 roll back when the deadline expires, the failure is published after the reboot
+
+    ESP_LOGE(TAG, "%s, rolling back the update", reason);
+    if (nvs_opened) {
+        nvs_set_str(handle_nvs, OTA_ROLLBACK_REASON_KEY, reason);
+        nvs_set_i64(handle_nvs, OTA_ROLLBACK_TIME_KEY, elapsed_ms);
+        nvs_commit(handle_nvs);
+        nvs_close(handle_nvs);
+    }
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+    ESP_LOGE(TAG, "Unable to roll back the update");
+
+end:
+    ota_health_task = NULL;
+    vTaskDelete(NULL);
+}
+#endif
+
+static int64_t get_request_timestamp(astarte_bson_document_t doc, const char *key)
+{
+    astarte_bson_element_t element;
+    if (astarte_bson_deserializer_element_lookup(doc, key, &element) != ASTARTE_OK) {
+        return 0;
+    }
+
+    int64_t timestamp_ms = 0;
+    if (element.type == BSON_TYPE_DATETIME) {
+        timestamp_ms = astarte_bson_deserializer_element_to_datetime(element);
+    } else if (element.type == BSON_TYPE_INT64) {
+        timestamp_ms = astarte_bson_deserializer_element_to_int64(element);
+    }
+    return timestamp_ms > 0 ? timestamp_ms : 0;
 }
 
+static edgehog_err_t reboot_into_update(
+    edgehog_device_handle_t edgehog_dev, const char *req_uuid, nvs_handle_t handle_nvs)
+{
+    const esp_partition_t *partition_info = esp_ota_get_running_partition();
+    if (!partition_info) {
+        return EDGEHOG_ERR_OTA_INTERNAL;
+    }
+    nvs_set_u8(handle_nvs, OTA_STATE_KEY, OTA_STATE_REBOOT);
+    nvs_set_u32(handle_nvs, OTA_PARTITION_ADDR_KEY, partition_info->address);
+    nvs_erase_key(handle_nvs, OTA_STAGED_PARTITION_ADDR_KEY);
+    nvs_commit(handle_nvs);
+    pub_ota_event(edgehog_dev, req_uuid, OTA_EVENT_REBOOTING, 0, EDGEHOG_OK, "");
+    uint32_t shutdown_ms = drain_before_reboot(edgehog_dev);
+    nvs_set_u32(handle_nvs, OTA_SHUTDOWN_TIME_KEY, shutdown_ms);
+    nvs_commit(handle_nvs);
+    nvs_close(handle_nvs);
+    ESP_LOGI(TAG, "Device restart now, shutdown took %u ms", (unsigned int) shutdown_ms);
+    esp_restart();
+    return EDGEHOG_ERR_OTA_INTERNAL;
+}
+
+static uint32_t drain_before_reboot(edgehog_device_handle_t edgehog_dev)
+{
+    int64_t start_us = esp_timer_get_time();
+    while (1) {
+        int64_t elapsed_ms = (esp_timer_get_time() - start_us) / 1000;
+        if (elapsed_ms >= CONFIG_EDGEHOG_OTA_REBOOT_DRAIN_TIMEOUT_MS) {
+            ESP_LOGW(TAG, "Outgoing messages not drained, restarting anyway");
+            return (uint32_t) elapsed_ms;
+        }
+        if (elapsed_ms >= OTA_REBOOT_SETTLE_MS
+            && astarte_device_is_connected(edgehog_dev->astarte_device)) {
+            portENTER_CRITICAL(&ota_throttle_lock);
+            edgehog_ota_throttle_t throttle = edgehog_dev->ota_throttle;
+            portEXIT_CRITICAL(&ota_throttle_lock);
+            if (throttle.pending_cb ? throttle.pending_cb(throttle.pending_user_data) == 0
+                                    : elapsed_ms >= OTA_REBOOT_UNTRACKED_SETTLE_MS) {
+                return (uint32_t) elapsed_ms;
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(OTA_BACKGROUND_POLL_MS));
+    }
+}
+
+static void format_success_message(
+    nvs_handle_t handle_nvs, int64_t verified_ms, char *message, size_t message_size)
+{
+    uint32_t shutdown_ms;
+    bool has_shutdown = nvs_get_u32(handle_nvs, OTA_SHUTDOWN_TIME_KEY, &shutdown_ms) == ESP_OK;
+    if (has_shutdown && verified_ms >= 0) {
+        snprintf(message, message_size, "Shutdown in %u ms, verified after %lld ms",
+            (unsigned int) shutdown_ms, (long long) verified_ms);
+    } else if (has_shutdown) {
+        snprintf(message, message_size, "Shutdown in %u ms", (unsigned int) shutdown_ms);
+    } else if (verified_ms >= 0) {
+        snprintf(message, message_size, "Verified after %lld ms", (long long) verified_ms);
+    } else {
+        message[0] = '\0';
+    }
+}
+
+static edgehog_err_t stage_ota_update(ota_task_data_t *task_data, nvs_handle_t handle_nvs)
+{
+    // The OTA data partition is untouched while staging, perform_ota() wrote this same partition
+    const esp_partition_t *running_partition = esp_ota_get_running_partition();
+    const esp_partition_t *staged_partition = esp_ota_get_next_update_partition(NULL);
+    if (!running_partition || !staged_partition
+        || running_partition->address == staged_partition->address) {
+        ESP_LOGE(TAG, "Unable to find the updated partition");
+        return EDGEHOG_ERR_OTA_INTERNAL;
+    }
+
+    nvs_set_u32(handle_nvs, OTA_STAGED_PARTITION_ADDR_KEY, staged_partition->address);
+    nvs_set_i64(handle_nvs, OTA_APPLY_AFTER_KEY, task_data->apply_after_ms);
+    nvs_set_i64(handle_nvs, OTA_APPLY_BEFORE_KEY, task_data->apply_before_ms);
+    if (nvs_set_u8(handle_nvs, OTA_STATE_KEY, OTA_STATE_STAGED) != ESP_OK
+        || nvs_commit(handle_nvs) != ESP_OK) {
+        return EDGEHOG_ERR_NVS;
+    }
+
+    staged_apply_after_ms = task_data->apply_after_ms;
+    staged_apply_before_ms = task_data->apply_before_ms;
+    start_apply_timer(task_data->edgehog_dev);
+    return EDGEHOG_OK;
+}
+
+static void discard_staged_ota(
+    edgehog_device_handle_t edgehog_dev, nvs_handle_t handle_nvs, const char *message)
+{
+    if (ota_apply_timer) {
+        xTimerStop(ota_apply_timer, 0);
+    }
+
+    char req_uuid[ASTARTE_UUID_LEN];
+    size_t req_uuid_size = ASTARTE_UUID_LEN;
+    if (nvs_get_str(handle_nvs, OTA_REQUEST_ID_KEY, req_uuid, &req_uuid_size) == ESP_OK) {
+        pub_ota_event(
+            edgehog_dev, req_uuid, OTA_EVENT_FAILURE, 0, EDGEHOG_ERR_OTA_CANCELED, message);
+    }
+    esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_FAILED_EVENT, NULL, 0, 0);
+
+    nvs_erase_key(handle_nvs, OTA_REQUEST_ID_KEY);
+    nvs_erase_key(handle_nvs, OTA_STAGED_PARTITION_ADDR_KEY);
+    nvs_erase_key(handle_nvs, OTA_APPLY_AFTER_KEY);
+    nvs_erase_key(handle_nvs, OTA_APPLY_BEFORE_KEY);
+    nvs_set_u8(handle_nvs, OTA_STATE_KEY, OTA_STATE_IDLE);
+    nvs_commit(handle_nvs);
+}
+
+static edgehog_err_t cancel_staged_ota(edgehog_device_handle_t edgehog_dev, const char *req_uuid)
+{
+    nvs_handle_t handle_nvs;
+    if (edgehog_device_nvs_open(edgehog_dev, OTA_NAMESPACE, &handle_nvs) != ESP_OK) {
+        return EDGEHOG_ERR_NVS;
+    }
+
+    edgehog_err_t edgehog_err = EDGEHOG_ERR_OTA_INVALID_REQUEST;
+    uint8_t ota_state = OTA_STATE_IDLE;
+    char staged_uuid[ASTARTE_UUID_LEN];
+    size_t staged_uuid_size = ASTARTE_UUID_LEN;
+    nvs_get_u8(handle_nvs, OTA_STATE_KEY, &ota_state);
+    if (ota_state == OTA_STATE_STAGED
+        && nvs_get_str(handle_nvs, OTA_REQUEST_ID_KEY, staged_uuid, &staged_uuid_size) == ESP_OK
+        && strcmp(staged_uuid, req_uuid) == 0) {
+        discard_staged_ota(edgehog_dev, handle_nvs, "");
+        edgehog_err = EDGEHOG_OK;
+    }
+    nvs_close(handle_nvs);
+    return edgehog_err;
+}
+
+static bool running_image_pending_verify(void)
+{
+    const esp_partition_t *running_partition = esp_ota_get_running_partition();
+    esp_ota_img_states_t running_state;
+    return running_partition
+        && esp_ota_get_state_partition(running_partition, &running_state) == ESP_OK
+        && running_state == ESP_OTA_IMG_PENDING_VERIFY;
+}
+
+static void start_apply_timer(edgehog_device_handle_t edgehog_dev)
+{
+    // Without a maintenance window the update waits for edgehog_ota_apply()
+    if (staged_apply_after_ms == 0) {
+        return;
+    }
+    if (!ota_apply_timer) {
+        ota_apply_timer = xTimerCreate(NULL, pdMS_TO_TICKS(OTA_APPLY_CHECK_PERIOD_MS), pdTRUE,
+            (void *) edgehog_dev, apply_timer_callback);
+        if (!ota_apply_timer) {
+            ESP_LOGE(TAG, "Unable to create the OTA apply timer");
+            return;
+        }
+    }
+    if (xTimerStart(ota_apply_timer, 0) != pdPASS) {
+        ESP_LOGE(TAG, "Unable to start the OTA apply timer");
+    }
+}
+
+static void apply_timer_callback(TimerHandle_t timer_handle)
+{
+    edgehog_device_handle_t edgehog_dev = (edgehog_device_handle_t) pvTimerGetTimerID(timer_handle);
+    int64_t now_ms = (int64_t) edgehog_device_get_timestamp_ms();
+    if (now_ms == 0) {
+        ESP_LOGD(TAG, "Wall clock not synchronized, staged OTA update postponed");
+        return;
+    }
+
+    if (now_ms < staged_apply_after_ms) {
+        return;
+    }
+    if (staged_apply_before_ms > 0 && now_ms > staged_apply_before_ms) {
+        ESP_LOGW(TAG, "Maintenance window missed, staged OTA update waiting for approval");
+        xTimerStop(timer_handle, 0);
+        esp_event_post(EDGEHOG_EVENTS, EDGEHOG_OTA_STAGED_EVENT, NULL, 0, 0);
+        return;
+    }
+
+    portENTER_CRITICAL(&ota_apply_lock);
+    bool applying = ota_applying;
+    portEXIT_CRITICAL(&ota_apply_lock);
+    if (applying) {
+        return;
+    }
+    // When the task can not be created the update is applied at the next timer period
+#if CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    // The static stack is reused only once the previous apply task has been deleted
+    BaseType_t apply_task_ret = pdFAIL;
+    if (!xTaskGetHandle(OTA_APPLY_TASK_NAME)
+        && xTaskCreateStatic(apply_task_code, OTA_APPLY_TASK_NAME,
+            CONFIG_EDGEHOG_OTA_TASK_STACK_SIZE, edgehog_dev, tskIDLE_PRIORITY, ota_apply_task_stack,
+            &ota_apply_task_tcb)) {
+        apply_task_ret = pdPASS;
+    }
+#else
+    BaseType_t apply_task_ret = xTaskCreate(apply_task_code, OTA_APPLY_TASK_NAME,
+        CONFIG_EDGEHOG_OTA_TASK_STACK_SIZE, edgehog_dev, tskIDLE_PRIORITY, NULL);
+#endif
+    if (apply_task_ret != pdPASS) {
+        ESP_LOGW(TAG, "OTA apply task creation failed, staged OTA update postponed");
+    }
+}
+
+static void apply_task_code(void *ctx)
+{
+    edgehog_device_handle_t edgehog_dev = (edgehog_device_handle_t) ctx;
+    edgehog_err_t edgehog_err = edgehog_ota_apply(edgehog_dev);
+    if (edgehog_err != EDGEHOG_OK && edgehog_err != EDGEHOG_ERR_OTA_ALREADY_IN_PROGRESS) {
+        ESP_LOGE(TAG, "Unable to apply the staged OTA update");
+    }
+    vTaskDelete(NULL);
+}
+
+static esp_err_t ota_http_event_handler(esp_http_client_event_t *evt)
+{
+    ota_attempt_data_t *attempt_data = (ota_attempt_data_t *) evt->user_data;
+    if (!attempt_data) {
+        return ESP_OK;
+    }
+
+    switch (evt->event_id) {
+        case HTTP_EVENT_ON_CONNECTED: {
+            int64_t now_us = esp_timer_get_time();
+            if (attempt_data->connected_us == 0) {
+                attempt_data->connected_us = now_us;
+            }
+            attempt_data->connections++;
+            if (esp_http_client_get_transport_type(evt->client) != HTTP_TRANSPORT_OVER_SSL) {
+                break;
+            }
+            int64_t handshake_us = now_us - attempt_data->open_us;
+#if OTA_SAVE_TLS_SESSION
+            if (attempt_data->host[0] != '\0'
+                && strcmp(attempt_data->host, ota_tls_session_host) == 0) {
+                attempt_data->resumed_handshakes++;
+                attempt_data->resumed_handshake_us += handshake_us;
+                break;
+            }
+            // The session of this connection replaces the saved one
+            strcpy(ota_tls_session_host, attempt_data->host);
+#endif
+            attempt_data->full_handshakes++;
+            attempt_data->full_handshake_us += handshake_us;
+            break;
+        }
+        case HTTP_EVENT_ON_HEADER:
+            // Content-Range: bytes <first>-<last>/<total>
+            if (strcasecmp(evt->header_key, "Content-Range") == 0) {
+                const char *total = strrchr(evt->header_value, '/');
+                attempt_data->range_total = total && total[1] != '*' ? atoi(total + 1) : -1;
+            }
+            // A relative redirection keeps the current host
+            if (strcasecmp(evt->header_key, "Location") == 0 && strstr(evt->header_value, "://")) {
+                get_ota_url_host(evt->header_value, attempt_data->host, sizeof(attempt_data->host));
+            }
+            break;
+        default:
+            break;
+    }
+    return ESP_OK;
+}
+
+static void parse_ota_mirrors(astarte_bson_document_t doc, ota_task_data_t *task_data)
+{
+    astarte_bson_element_t mirrors_element;
+    if (astarte_bson_deserializer_element_lookup(doc, "mirrors", &mirrors_element) != ASTARTE_OK
+        || mirrors_element.type != BSON_TYPE_ARRAY) {
+        return;
+    }
+
+    astarte_bson_document_t mirrors
+        = astarte_bson_deserializer_element_to_array(mirrors_element);
+    astarte_bson_element_t mirror_element;
+    astarte_err_t astarte_err = astarte_bson_deserializer_first_element(mirrors, &mirror_element);
+    while (astarte_err == ASTARTE_OK && task_data->sources_count < OTA_MAX_SOURCES) {
+        if (mirror_element.type == BSON_TYPE_STRING) {
+            const char *url = astarte_bson_deserializer_element_to_string(mirror_element, NULL);
+            if (is_ota_url_allowed(url)) {
+                task_data->sources[task_data->sources_count].url = ota_strdup(url);
+                if (task_data->sources[task_data->sources_count].url) {
+                    task_data->sources_count++;
+                }
+            } else {
+                ESP_LOGW(TAG, "Ignoring OTA mirror, URL scheme not allowed");
+            }
+        }
+        astarte_err
+            = astarte_bson_deserializer_next_element(mirrors, mirror_element, &mirror_element);
+    }
+}
+
+static bool is_ota_url_allowed(const char *url)
+{
+    if (strncasecmp(url, "https://", strlen("https://")) == 0) {
+        return true;
+    }
+#if CONFIG_EDGEHOG_OTA_ALLOW_HTTP
+    if (strncasecmp(url, "http://", strlen("http://")) == 0) {
+        return true;
+    }
+#endif
+    return false;
+}
+
+static void probe_ota_sources(ota_task_data_t *task_data)
+{
+    char buffer[64];
+
+    // Step 1 measure the time to the first byte of the image for each source
+
+    for (uint8_t i = 0; i < task_data->sources_count; i++) {
+        ota_source_t *source = &task_data->sources[i];
+        source->latency_us = -1;
+        esp_http_client_config_t http_config = {
+            .url = source->url,
+            .timeout_ms = OTA_PROBE_TIMEOUT_MS,
+#if CONFIG_MBEDTLS_CERTIFICATE_BUNDLE
+            .crt_bundle_attach = esp_crt_bundle_attach,
+#endif
+        };
+        esp_http_client_handle_t client = esp_http_client_init(&http_config);
+        if (!client) {
+            continue;
+        }
+        int64_t begin_us = esp_timer_get_time();
+        int status = open_ota_source(client, NULL, "bytes=0-0", buffer, sizeof(buffer));
+        if ((status == 200 || status == 206) && esp_http_client_read(client, buffer, 1) == 1) {
+            source->latency_us = esp_timer_get_time() - begin_us;
+        }
+        esp_http_client_cleanup(client);
+        ESP_LOGI(TAG, "OTA source %d first byte latency: %lld ms", i,
+            (long long) (source->latency_us / 1000));
+    }
+
+    // Step 2 sort the sources, the insertion sort keeps the requested order on ties
+
+    for (uint8_t i = 1; i < task_data->sources_count; i++) {
+        ota_source_t source = task_data->sources[i];
+        int j = i - 1;
+        while (j >= 0 && source.latency_us >= 0
+            && (task_data->sources[j].latency_us < 0
+                || task_data->sources[j].latency_us > source.latency_us)) {
+            task_data->sources[j + 1] = task_data->sources[j];
+            j--;
+        }
+        task_data->sources[j + 1] = source;
+    }
+    task_data->source_idx = 0;
+}
+
+static void select_next_ota_source(ota_task_data_t *task_data)
+{
+    if (task_data->sources_count < 2) {
+        return;
+    }
+    ota_free(task_data->redirect_url);
+    task_data->redirect_url = NULL;
+    task_data->source_idx = (task_data->source_idx + 1) % task_data->sources_count;
+    ESP_LOGI(TAG, "Switching to OTA source %d", task_data->source_idx);
+}
+
+static int open_ota_source(esp_http_client_handle_t client, ota_attempt_data_t *attempt_data,
+    const char *range, char *buffer, int buffer_size)
+{
+    // The client of the OTA request is reused, drop the header of the previous attempt
+    if (range) {
+        esp_http_client_set_header(client, "Range", range);
+    } else {
+        esp_http_client_delete_header(client, "Range");
+    }
+
+    for (int redirects = 0; redirects <= OTA_MAX_REDIRECTS; redirects++) {
+        if (attempt_data) {
+            attempt_data->open_us = esp_timer_get_time();
+        }
+        if (esp_http_client_open(client, 0) != ESP_OK
+            || esp_http_client_fetch_headers(client) < 0) {
+            return -1;
+        }
+        int status = esp_http_client_get_status_code(client);
+        if (status != 301 && status != 302 && status != 303 && status != 307 && status != 308) {
+            return status;
+        }
+        // Drain the redirection body so that the connection can be reused
+        while (esp_http_client_read(client, buffer, buffer_size) > 0) { }
+        if (esp_http_client_set_redirection(client) != ESP_OK) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+static edgehog_err_t start_ota_task(void)
+{
+#if CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    TaskHandle_t ota_task_handle = xTaskCreateStatic(ota_task_code, OTA_UPDATE_TASK_NAME,
+        CONFIG_EDGEHOG_OTA_TASK_STACK_SIZE, &ota_task_data, tskIDLE_PRIORITY, ota_task_stack,
+        &ota_task_tcb);
+    BaseType_t ota_task_ret = ota_task_handle ? pdPASS : pdFAIL;
+#else
+    TaskHandle_t ota_task_handle = NULL;
+    BaseType_t ota_task_ret = xTaskCreate(ota_task_code, OTA_UPDATE_TASK_NAME,
+        CONFIG_EDGEHOG_OTA_TASK_STACK_SIZE, &ota_task_data, tskIDLE_PRIORITY, &ota_task_handle);
+#endif
+    if (ota_task_ret != pdPASS) {
+        ESP_LOGE(TAG, "OTA update task creation failed.");
+        ota_free_request(&ota_task_data);
+        return EDGEHOG_ERR_TASK_CREATE;
+    }
+    return EDGEHOG_OK;
+}
+
+static void save_ota_request(ota_task_data_t *task_data, nvs_handle_t handle_nvs)
+{
+    for (unsigned int i = 0; i < OTA_MAX_SOURCES; i++) {
+        char source_key[OTA_SOURCE_KEY_LEN];
+        snprintf(source_key, sizeof(source_key), OTA_SOURCE_KEY_FMT, i);
+        if (i < task_data->sources_count) {
+            nvs_set_str(handle_nvs, source_key, task_data->sources[i].url);
+        } else {
+            nvs_erase_key(handle_nvs, source_key);
+        }
+    }
+    nvs_set_u32(handle_nvs, OTA_MAX_RATE_KEY, task_data->req_max_bytes_per_sec);
+    nvs_set_i64(handle_nvs, OTA_APPLY_AFTER_KEY, task_data->apply_after_ms);
+    nvs_set_i64(handle_nvs, OTA_APPLY_BEFORE_KEY, task_data->apply_before_ms);
+    nvs_commit(handle_nvs);
+}
+
+static edgehog_err_t load_ota_request(
+    edgehog_device_handle_t edgehog_dev, nvs_handle_t handle_nvs, const char *req_uuid)
+{
+    edgehog_err_t edgehog_err = EDGEHOG_ERR_NVS;
+    ota_journal_t journal;
+    size_t journal_size = sizeof(journal);
+    if (nvs_get_blob(handle_nvs, OTA_JOURNAL_KEY, &journal, &journal_size) != ESP_OK
+        || journal_size != sizeof(journal)) {
+        return EDGEHOG_ERR_NVS;
+    }
+#if CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    // The redirection target is not used before the request starts
+    char *url = ota_redirect_url;
+#else
+    char *url = malloc(OTA_URL_MAX_LEN);
+    if (!url) {
+        return EDGEHOG_ERR_OTA_INTERNAL;
+    }
+#endif
+
+    memset(&ota_task_data, 0, sizeof(ota_task_data));
+    ota_task_data.edgehog_dev = edgehog_dev;
+    ota_task_data.resume = true;
+    nvs_get_u32(handle_nvs, OTA_MAX_RATE_KEY, &ota_task_data.req_max_bytes_per_sec);
+    nvs_get_i64(handle_nvs, OTA_APPLY_AFTER_KEY, &ota_task_data.apply_after_ms);
+    nvs_get_i64(handle_nvs, OTA_APPLY_BEFORE_KEY, &ota_task_data.apply_before_ms);
+    ota_task_data.req_uuid = ota_strdup(req_uuid);
+    for (unsigned int i = 0; i < OTA_MAX_SOURCES; i++) {
+        char source_key[OTA_SOURCE_KEY_LEN];
+        size_t url_size = OTA_URL_MAX_LEN;
+        snprintf(source_key, sizeof(source_key), OTA_SOURCE_KEY_FMT, i);
+        if (nvs_get_str(handle_nvs, source_key, url, &url_size) != ESP_OK) {
+            break;
+        }
+        ota_task_data.sources[ota_task_data.sources_count].url = ota_strdup(url);
+        if (ota_task_data.sources[ota_task_data.sources_count].url) {
+            ota_task_data.sources_count++;
+        }
+    }
+    if (!ota_task_data.req_uuid || ota_task_data.sources_count == 0) {
+        ota_free_request(&ota_task_data);
+        goto end;
+    }
+    edgehog_err = EDGEHOG_OK;
+
+end:
+#if !CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    free(url);
+#endif
+    return edgehog_err;
+}
+
+static void begin_ota_download(
+    ota_task_data_t *task_data, ota_download_t *download, nvs_handle_t handle_nvs)
+{
+    download->image_size = -1;
+    download->handle_nvs = handle_nvs;
+    if (!task_data->resume || OTA_JOURNAL_INTERVAL == 0) {
+        return;
+    }
+
+    // Step 1 load the last checkpoint of the interrupted download
+
+    ota_journal_t journal;
+    size_t journal_size = sizeof(journal);
+    if (nvs_get_blob(handle_nvs, OTA_JOURNAL_KEY, &journal, &journal_size) != ESP_OK
+        || journal_size != sizeof(journal)
+        || journal.partition_addr != download->partition->address
+        || journal.offset % OTA_SECTOR_SIZE != 0 || journal.offset > download->partition->size) {
+        ESP_LOGW(TAG, "Invalid OTA journal, restarting the download");
+        return;
+    }
+
+    // Step 2 verify that the flash still holds the data received before the reset
+
+    uint8_t data[OTA_JOURNAL_READ_SIZE];
+    uint32_t crc = 0;
+    for (uint32_t offset = 0; offset < journal.offset; offset += sizeof(data)) {
+        if (esp_partition_read(download->partition, offset, data, sizeof(data)) != ESP_OK) {
+            ESP_LOGW(TAG, "Unable to read the OTA partition, restarting the download");
+            return;
+        }
+        crc = esp_rom_crc32_le(crc, data, sizeof(data));
+    }
+    if (crc != journal.crc) {
+        ESP_LOGW(TAG, "OTA journal checksum mismatch, restarting the download");
+        return;
+    }
+
+    download->image_size = journal.image_size;
+    download->offset = (int) journal.offset;
+    download->erased_end = journal.offset;
+    download->crc = journal.crc;
+    ESP_LOGI(TAG, "Resuming the OTA download from %d bytes", download->offset);
+}
+
+static edgehog_err_t write_ota_data(ota_download_t *download, const char *data, int len)
+{
+    if (download->offset == 0 && len > 0 && (uint8_t) data[0] != ESP_IMAGE_HEADER_MAGIC) {
+        ESP_LOGE(TAG, "Invalid OTA image magic byte");
+        return EDGEHOG_ERR_OTA_INVALID_IMAGE;
+    }
+    if ((uint32_t) download->offset + len > download->partition->size) {
+        ESP_LOGE(TAG, "OTA image larger than the update partition");
+        return EDGEHOG_ERR_OTA_INVALID_IMAGE;
+    }
+
+    while (len > 0) {
+        // Split the data at the journal checkpoints
+        int piece_len = len;
+        if (OTA_JOURNAL_INTERVAL > 0) {
+            int checkpoint = (download->offset / OTA_JOURNAL_INTERVAL + 1)
+                * OTA_JOURNAL_INTERVAL;
+            if (download->offset + piece_len > checkpoint) {
+                piece_len = checkpoint - download->offset;
+            }
+        }
+        if (program_ota_data(download, data, piece_len) != ESP_OK) {
+            return EDGEHOG_ERR_OTA_INTERNAL;
+        }
+        download->crc = esp_rom_crc32_le(download->crc, (const uint8_t *) data, piece_len);
+        download->offset += piece_len;
+        data += piece_len;
+        len -= piece_len;
+        if (OTA_JOURNAL_INTERVAL > 0
+            && download->offset % OTA_JOURNAL_INTERVAL == 0) {
+            // Checkpoints are sector aligned, all the data before them is in flash
+            ota_journal_t journal = {
+                .partition_addr = download->partition->address,
+                .image_size = download->image_size,
+                .offset = (uint32_t) download->offset,
+                .crc = download->crc,
+            };
+            nvs_set_blob(download->handle_nvs, OTA_JOURNAL_KEY, &journal, sizeof(journal));
+            nvs_commit(download->handle_nvs);
+        }
+    }
+    return EDGEHOG_OK;
+}
+
+static esp_err_t program_ota_data(ota_download_t *download, const char *data, int len)
+{
+    // The data before written is in flash, the following carry_len bytes are in the carry buffer
+    uint32_t written = download->offset - download->carry_len;
+    esp_err_t esp_err = ESP_OK;
+    while (len > 0 && esp_err == ESP_OK) {
+        if (download->carry_len > 0 || len < OTA_WRITE_ALIGN) {
+            // Encrypted partitions are written in aligned blocks, keep the tail for later
+            int copy_len = OTA_WRITE_ALIGN - download->carry_len;
+            copy_len = copy_len < len ? copy_len : len;
+            memcpy(&download->carry[download->carry_len], data, copy_len);
+            download->carry_len += copy_len;
+            data += copy_len;
+            len -= copy_len;
+            if (download->carry_len == OTA_WRITE_ALIGN) {
+                esp_err = flash_ota_data(download, written, download->carry, OTA_WRITE_ALIGN);
+                written += OTA_WRITE_ALIGN;
+                download->carry_len = 0;
+            }
+        } else {
+            int block_len = len - len % OTA_WRITE_ALIGN;
+            esp_err = flash_ota_data(download, written, data, block_len);
+            written += block_len;
+            data += block_len;
+            len -= block_len;
+        }
+    }
+    return esp_err;
+}
+
+static esp_err_t flash_ota_data(
+    ota_download_t *download, uint32_t address, const void *data, size_t len)
+{
+    if (download->erased_end < address + len) {
+        uint32_t erase_end = (address + len + OTA_SECTOR_SIZE - 1) & ~(OTA_SECTOR_SIZE - 1);
+        if (erase_end > download->partition->size) {
+            erase_end = download->partition->size;
+        }
+        int64_t erase_start_us = esp_timer_get_time();
+        esp_err_t esp_err = esp_partition_erase_range(
+            download->partition, download->erased_end, erase_end - download->erased_end);
+        download->perf->erase_us += esp_timer_get_time() - erase_start_us;
+        if (esp_err != ESP_OK) {
+            return esp_err;
+        }
+        download->erased_end = erase_end;
+    }
+    return esp_partition_write(download->partition, address, data, len);
+}
+
+static edgehog_err_t finish_ota_download(ota_download_t *download)
+{
+    if (download->carry_len > 0) {
+        memset(&download->carry[download->carry_len], 0xFF, OTA_WRITE_ALIGN - download->carry_len);
+        uint32_t written = download->offset - download->carry_len;
+        if (flash_ota_data(download, written, download->carry, OTA_WRITE_ALIGN) != ESP_OK) {
+            return EDGEHOG_ERR_OTA_INTERNAL;
+        }
+        download->carry_len = 0;
+    }
+
+    esp_err_t esp_err;
+    if (download->staged) {
+        // Setting the boot partition would mark a pending running image as new, only verify the
+        // image and its signature. The boot partition is set by edgehog_ota_apply().
+        const esp_partition_pos_t image_pos = {
+            .offset = download->partition->address,
+            .size = download->partition->size,
+        };
+        esp_image_metadata_t image_metadata;
+        esp_err = esp_image_verify(ESP_IMAGE_VERIFY, &image_pos, &image_metadata);
+        if (esp_err != ESP_OK) {
+            ESP_LOGD(TAG, "Image validation failed, image is corrupted");
+            return EDGEHOG_ERR_OTA_INVALID_IMAGE;
+        }
+        esp_app_desc_t app_desc;
+        if (esp_ota_get_partition_description(download->partition, &app_desc) == ESP_OK) {
+            ESP_LOGI(TAG, "Staged image version %s", app_desc.version);
+        }
+        return EDGEHOG_OK;
+    }
+
+    // Setting the boot partition verifies the image and its signature
+    esp_err = esp_ota_set_boot_partition(download->partition);
+    if (esp_err == ESP_ERR_OTA_VALIDATE_FAILED) {
+        ESP_LOGD(TAG, "Image validation failed, image is corrupted");
+        return EDGEHOG_ERR_OTA_INVALID_IMAGE;
+    }
+    if (esp_err != ESP_OK) {
+        ESP_LOGD(TAG, "Update failed 0x%x", esp_err);
+        return EDGEHOG_ERR_OTA_INTERNAL;
+    }
+    return EDGEHOG_OK;
+}
+
+static edgehog_err_t write_ota_image(ota_download_t *download, const char *data, int len)
+{
+    if (!download->sink) {
+        return write_ota_data(download, data, len);
+    }
+
+    const edgehog_ota_sink_t *sink = download->sink;
+    edgehog_err_t edgehog_err = EDGEHOG_OK;
+    if (!download->sink_open) {
+        edgehog_err = sink->begin(sink->user_data, download->image_size);
+        download->sink_open = edgehog_err == EDGEHOG_OK;
+    }
+    if (edgehog_err == EDGEHOG_OK) {
+        edgehog_err = sink->write(sink->user_data, (const uint8_t *) data, len);
+    }
+    if (edgehog_err != EDGEHOG_OK) {
+        ESP_LOGE(TAG, "OTA target %s failed to receive the image", sink->target);
+        download->sink_failed = true;
+        return edgehog_err;
+    }
+    download->offset += len;
+    return EDGEHOG_OK;
+}
+
+static edgehog_err_t finish_ota_image(ota_download_t *download)
+{
+    if (!download->sink) {
+        return finish_ota_download(download);
+    }
+
+    // An empty image never opened the sink
+    const edgehog_ota_sink_t *sink = download->sink;
+    if (!download->sink_open) {
+        edgehog_err_t edgehog_err = sink->begin(sink->user_data, download->image_size);
+        if (edgehog_err != EDGEHOG_OK) {
+            return edgehog_err;
+        }
+    }
+    download->sink_open = false;
+    return sink->finish(sink->user_data);
+}
+
+static void cache_redirect_url(ota_task_data_t *task_data, esp_http_client_handle_t client)
+{
+#if CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    char *url = ota_redirect_url;
+#else
+    char *url = malloc(OTA_URL_MAX_LEN);
+    if (!url) {
+        return;
+    }
+#endif
+    if (esp_http_client_get_url(client, url, OTA_URL_MAX_LEN) == ESP_OK
+        && strcmp(url, task_data->sources[task_data->source_idx].url) != 0) {
+        ESP_LOGD(TAG, "OTA request redirected, caching the target for the next attempts");
+#if CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+        task_data->redirect_url = url;
+#else
+        task_data->redirect_url = strdup(url);
+#endif
+    }
+#if !CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    free(url);
+#endif
+}
+
+static char *ota_strdup(const char *str)
+{
+#if CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    size_t size = strlen(str) + 1;
+    if (size > sizeof(ota_strings) - ota_strings_len) {
+        return NULL;
+    }
+    char *copy = &ota_strings[ota_strings_len];
+    memcpy(copy, str, size);
+    ota_strings_len += size;
+    return copy;
+#else
+    return strdup(str);
+#endif
+}
+
+static void ota_free(char *str)
+{
+#if !CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    free(str);
+#endif
+}
+
+static void ota_free_request(ota_task_data_t *task_data)
+{
+    ota_free(task_data->req_uuid);
+    task_data->req_uuid = NULL;
+    for (uint8_t i = 0; i < task_data->sources_count; i++) {
+        ota_free(task_data->sources[i].url);
+        task_data->sources[i].url = NULL;
+    }
+    task_data->sources_count = 0;
+    ota_free(task_data->redirect_url);
+    task_data->redirect_url = NULL;
+#if CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    ota_strings_len = 0;
+#endif
+}
+
+static bool get_ota_url_host(const char *url, char *host, size_t host_size)
+{
+    // Skip the scheme and the user information, then strip the port
+    const char *host_begin = strstr(url, "://");
+    host_begin = host_begin ? host_begin + 3 : url;
+    size_t authority_len = strcspn(host_begin, "/?#");
+    const char *user_info_end = memchr(host_begin, '@', authority_len);
+    if (user_info_end) {
+        authority_len -= user_info_end + 1 - host_begin;
+        host_begin = user_info_end + 1;
+    }
+    const char *host_end;
+    if (*host_begin == '[') {
+        host_begin++;
+        host_end = memchr(host_begin, ']', authority_len - 1);
+    } else {
+        host_end = memchr(host_begin, ':', authority_len);
+        if (!host_end) {
+            host_end = host_begin + authority_len;
+        }
+    }
+    if (!host_end || host_end == host_begin || (size_t) (host_end - host_begin) >= host_size) {
+        host[0] = '\0';
+        return false;
+    }
+    memcpy(host, host_begin, host_end - host_begin);
+    host[host_end - host_begin] = '\0';
+    return true;
+}
+
+#if CONFIG_EDGEHOG_OTA_PERF_TELEMETRY
+static int64_t resolve_ota_host(const char *url)
+{
+    char host[OTA_HOST_MAX_LEN];
+    if (!get_ota_url_host(url, host, sizeof(host))) {
+        ESP_LOGW(TAG, "Unable to extract the host from the OTA URL");
+        return 0;
+    }
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+    int64_t start_us = esp_timer_get_time();
+    int err = getaddrinfo(host, NULL, &hints, &res);
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+    if (err != 0 || !res) {
+        ESP_LOGW(TAG, "Unable to resolve %s, error %d", host, err);
+    }
+    if (res) {
+        freeaddrinfo(res);
+    }
+    return elapsed_us;
+}
+#endif
+
 static void pub_ota_event(edgehog_device_handle_t edgehog_dev, const char *request_uuid,
     ota_event_t event, int32_t status_progress, edgehog_err_t error, const char *message)
 {
@@ -0,0 +1,130 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "edgehog_ota_perf.h"
+#include "edgehog_device_private.h"
+#include <astarte_bson_serializer.h>
+#include <esp_timer.h>
+#include <string.h>
+
+const astarte_interface_t ota_performance_interface
+    = { .name = "io.edgehog.devicemanager.OTAPerformance",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+static inline int32_t us_to_ms(int64_t us)
+{
+    return (int32_t) (us / 1000);
+}
+
+void edgehog_ota_perf_init(edgehog_ota_perf_t *perf)
+{
+    memset(perf, 0, sizeof(edgehog_ota_perf_t));
+    perf->start_us = esp_timer_get_time();
+}
+
+void edgehog_ota_perf_add_chunk(
+    edgehog_ota_perf_t *perf, uint32_t bytes, int64_t network_us, int64_t flash_us)
+{
+    perf->bytes_read += bytes;
+    perf->network_us += network_us;
+    perf->flash_us += flash_us;
+
+    if (bytes == 0 || network_us <= 0) {
+        return;
+    }
+
+    uint64_t throughput = ((uint64_t) bytes * 1000000) / network_us;
+    int bucket = 0;
+    while (throughput > 1 && bucket < EDGEHOG_OTA_PERF_HISTOGRAM_BUCKETS - 1) {
+        throughput >>= 1;
+        bucket++;
+    }
+    perf->histogram[bucket]++;
+    perf->chunk_count++;
+}
+
+uint32_t edgehog_ota_perf_avg_throughput(const edgehog_ota_perf_t *perf)
+{
+    if (perf->network_us <= 0) {
+        return 0;
+    }
+    return (uint32_t) (((uint64_t) perf->bytes_read * 1000000) / perf->network_us);
+}
+
+uint32_t edgehog_ota_perf_p95_throughput(const edgehog_ota_perf_t *perf)
+{
+    if (perf->chunk_count == 0) {
+        return 0;
+    }
+
+    // Rank of the 95th percentile sample, rounded up
+    uint32_t rank = (perf->chunk_count * 95 + 99) / 100;
+    uint32_t cumulative = 0;
+    for (int i = 0; i < EDGEHOG_OTA_PERF_HISTOGRAM_BUCKETS; i++) {
+        if (cumulative + perf->histogram[i] >= rank) {
+            // Linear interpolation inside the [2^i, 2^(i+1)) bucket
+            uint64_t low = 1ULL << i;
+            return (uint32_t) (low + (low * (rank - cumulative)) / perf->histogram[i] - 1);
+        }
+        cumulative += perf->histogram[i];
+    }
+
+    return UINT32_MAX;
+}
+
+void edgehog_ota_perf_publish(edgehog_device_handle_t edgehog_dev, const char *request_uuid,
+    const edgehog_ota_perf_t *perf, edgehog_err_t result)
+{
+#if CONFIG_EDGEHOG_OTA_PERF_TELEMETRY
+    astarte_bson_serializer_handle_t bs = astarte_bson_serializer_new();
+    astarte_bson_serializer_append_string(bs, "requestUUID", request_uuid);
+    astarte_bson_serializer_append_boolean(bs, "success", result == EDGEHOG_OK);
+    astarte_bson_serializer_append_int32(bs, "dnsMillis", us_to_ms(perf->dns_us));
+    astarte_bson_serializer_append_int32(bs, "connectMillis", us_to_ms(perf->connect_us));
+    astarte_bson_serializer_append_int64(bs, "bytesReceived", perf->bytes_read);
+    astarte_bson_serializer_append_int64(
+        bs, "avgThroughputBytesPerSec", edgehog_ota_perf_avg_throughput(perf));
+    astarte_bson_serializer_append_int64(
+        bs, "p95ThroughputBytesPerSec", edgehog_ota_perf_p95_throughput(perf));
+    astarte_bson_serializer_append_int32(bs, "networkMillis", us_to_ms(perf->network_us));
+    astarte_bson_serializer_append_int32(bs, "flashWriteMillis", us_to_ms(perf->flash_us));
+    astarte_bson_serializer_append_int32(bs, "flashEraseMillis", us_to_ms(perf->erase_us));
+    astarte_bson_serializer_append_int32(bs, "retries", perf->retries);
+    astarte_bson_serializer_append_int32(bs, "connections", perf->connections);
+    astarte_bson_serializer_append_int32(bs, "connectionMillis", us_to_ms(perf->connection_us));
+    astarte_bson_serializer_append_int32(bs, "fullHandshakes", perf->full_handshakes);
+    astarte_bson_serializer_append_int32(
+        bs, "fullHandshakeMillis", us_to_ms(perf->full_handshake_us));
+    astarte_bson_serializer_append_int32(bs, "resumedHandshakes", perf->resumed_handshakes);
+    astarte_bson_serializer_append_int32(
+        bs, "resumedHandshakeMillis", us_to_ms(perf->resumed_handshake_us));
+    astarte_bson_serializer_append_int32(
+        bs, "totalMillis", us_to_ms(esp_timer_get_time() - perf->start_us));
+    astarte_bson_serializer_append_end_of_document(bs);
+
+    const void *doc = astarte_bson_serializer_get_document(bs, NULL);
+    astarte_device_stream_aggregate(
+        edgehog_dev->astarte_device, ota_performance_interface.name, "/performance", doc, 0);
+    astarte_bson_serializer_destroy(bs);
+#endif
+}
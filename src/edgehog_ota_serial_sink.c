@@ -0,0 +1,472 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "edgehog_ota_serial_sink.h"
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <string.h>
+
+/************************************************
+ *        Defines, constants and typedef        *
+ ***********************************************/
+
+#define OTA_SERIAL_SOF 0xA5
+#define OTA_SERIAL_HEADER_LEN 4
+#define OTA_SERIAL_RESPONSE_MAX_LEN 8
+#define OTA_SERIAL_UNKNOWN_SIZE 0xFFFFFFFF
+
+#define TAG "EDGEHOG_OTA_SERIAL"
+
+typedef enum
+{
+    OTA_SERIAL_FRAME_BEGIN = 0x01,
+    OTA_SERIAL_FRAME_DATA = 0x02,
+    OTA_SERIAL_FRAME_END = 0x03,
+    OTA_SERIAL_FRAME_ABORT = 0x04,
+    OTA_SERIAL_FRAME_ACK = 0x81,
+    OTA_SERIAL_FRAME_NAK = 0x82,
+    OTA_SERIAL_FRAME_ERROR = 0x83,
+} ota_serial_frame_t;
+
+/************************************************
+ *         Static functions declaration         *
+ ***********************************************/
+
+/**
+ * @brief OTA sink begin callback, announces the image to the target.
+ *
+ * @param user_data The serial sink.
+ * @param image_size The image size, -1 when unknown.
+ * @return EDGEHOG_OK if the target accepted the image, an edgehog_err_t otherwise.
+ */
+static edgehog_err_t serial_sink_begin(void *user_data, int image_size);
+
+/**
+ * @brief OTA sink write callback, sends the data in frames within the acknowledgement window.
+ *
+ * @param user_data The serial sink.
+ * @param data The image data.
+ * @param len The length of the data.
+ * @return EDGEHOG_OK if the data has been sent, an edgehog_err_t otherwise.
+ */
+static edgehog_err_t serial_sink_write(void *user_data, const uint8_t *data, size_t len);
+
+/**
+ * @brief OTA sink finish callback, waits for the target to validate the image.
+ *
+ * @param user_data The serial sink.
+ * @return EDGEHOG_OK if the target accepted the image, an edgehog_err_t otherwise.
+ */
+static edgehog_err_t serial_sink_finish(void *user_data);
+
+/**
+ * @brief OTA sink abort callback, tells the target to discard the partial image.
+ *
+ * @param user_data The serial sink.
+ */
+static void serial_sink_abort(void *user_data);
+
+/**
+ * @brief store a frame in the window and send it.
+ *
+ * @param serial_sink The serial sink.
+ * @param type The frame type.
+ * @param payload The frame payload.
+ * @param len The payload length, up to EDGEHOG_OTA_SERIAL_PAYLOAD_SIZE.
+ * @return EDGEHOG_OK if the frame has been sent, an edgehog_err_t otherwise.
+ */
+static edgehog_err_t queue_frame(edgehog_ota_serial_sink_t *serial_sink, ota_serial_frame_t type,
+    const uint8_t *payload, size_t len);
+
+/**
+ * @brief send a frame of the window.
+ *
+ * @param serial_sink The serial sink.
+ * @param seq The sequence number of the frame.
+ * @return true if the frame has been sent, false otherwise.
+ */
+static bool send_frame(edgehog_ota_serial_sink_t *serial_sink, uint8_t seq);
+
+/**
+ * @brief send again the frames from the oldest unacknowledged one.
+ *
+ * @param serial_sink The serial sink.
+ */
+static void resend_frames(edgehog_ota_serial_sink_t *serial_sink);
+
+/**
+ * @brief wait for the acknowledgements until at most max_in_flight frames are unacknowledged.
+ *
+ * @param serial_sink The serial sink.
+ * @param max_in_flight The number of unacknowledged frames allowed.
+ * @return EDGEHOG_OK on success, an edgehog_err_t otherwise.
+ */
+static edgehog_err_t wait_in_flight(edgehog_ota_serial_sink_t *serial_sink, uint8_t max_in_flight);
+
+/**
+ * @brief receive a frame from the target, frames with a wrong CRC are dropped.
+ *
+ * @param serial_sink The serial sink.
+ * @param type The received frame type.
+ * @param seq The received sequence number.
+ * @return 1 if a frame has been received, 0 on timeout, -1 on transport errors.
+ */
+static int receive_response(edgehog_ota_serial_sink_t *serial_sink, uint8_t *type, uint8_t *seq);
+
+/**
+ * @brief receive exactly len bytes before the deadline.
+ *
+ * @param serial_sink The serial sink.
+ * @param data The buffer receiving the data.
+ * @param len The number of bytes to receive.
+ * @param deadline_us The deadline, as returned by esp_timer_get_time.
+ * @return 1 if the data has been received, 0 on timeout, -1 on transport errors.
+ */
+static int receive_exact(
+    edgehog_ota_serial_sink_t *serial_sink, uint8_t *data, size_t len, int64_t deadline_us);
+
+/**
+ * @brief update a CRC-16/CCITT-FALSE.
+ *
+ * @param crc The current CRC, 0xFFFF for the first block.
+ * @param data The data.
+ * @param len The length of the data.
+ * @return The updated CRC.
+ */
+static uint16_t crc16_ccitt(uint16_t crc, const uint8_t *data, size_t len);
+
+/**
+ * @brief store a u32 in little endian.
+ *
+ * @param buffer The destination buffer.
+ * @param value The value.
+ */
+static void put_u32_le(uint8_t *buffer, uint32_t value);
+
+/**
+ * @brief serial transport send callback over a UART.
+ */
+static int uart_transport_send(void *ctx, const uint8_t *data, size_t len);
+
+/**
+ * @brief serial transport receive callback over a UART.
+ */
+static int uart_transport_recv(void *ctx, uint8_t *data, size_t len, uint32_t timeout_ms);
+
+/************************************************
+ *         Global functions definitions         *
+ ***********************************************/
+
+edgehog_err_t edgehog_ota_serial_sink_init(edgehog_ota_serial_sink_t *serial_sink,
+    const edgehog_ota_serial_sink_config_t *config, edgehog_ota_sink_t *sink)
+{
+    if (!serial_sink || !config || !sink || !config->target || !config->transport.send
+        || !config->transport.recv || config->window == 0
+        || config->window > EDGEHOG_OTA_SERIAL_MAX_WINDOW) {
+        ESP_LOGE(TAG, "Invalid OTA serial sink configuration");
+        return EDGEHOG_ERR;
+    }
+
+    memset(serial_sink, 0, sizeof(edgehog_ota_serial_sink_t));
+    serial_sink->config = *config;
+    sink->target = config->target;
+    sink->begin = serial_sink_begin;
+    sink->write = serial_sink_write;
+    sink->finish = serial_sink_finish;
+    sink->abort = serial_sink_abort;
+    sink->user_data = serial_sink;
+    return EDGEHOG_OK;
+}
+
+void edgehog_ota_serial_uart_transport(
+    uart_port_t uart_num, edgehog_ota_serial_transport_t *transport)
+{
+    transport->send = uart_transport_send;
+    transport->recv = uart_transport_recv;
+    transport->ctx = (void *) (intptr_t) uart_num;
+}
+
+/************************************************
+ *         Static functions definitions         *
+ ***********************************************/
+
+static edgehog_err_t serial_sink_begin(void *user_data, int image_size)
+{
+    edgehog_ota_serial_sink_t *serial_sink = (edgehog_ota_serial_sink_t *) user_data;
+    serial_sink->base_seq = 0;
+    serial_sink->next_seq = 0;
+    serial_sink->image_len = 0;
+    serial_sink->image_crc = 0;
+    serial_sink->retransmissions = 0;
+    serial_sink->start_us = esp_timer_get_time();
+
+    uint8_t payload[4];
+    put_u32_le(payload, image_size >= 0 ? (uint32_t) image_size : OTA_SERIAL_UNKNOWN_SIZE);
+    edgehog_err_t edgehog_err
+        = queue_frame(serial_sink, OTA_SERIAL_FRAME_BEGIN, payload, sizeof(payload));
+    if (edgehog_err != EDGEHOG_OK) {
+        return edgehog_err;
+    }
+    return wait_in_flight(serial_sink, 0);
+}
+
+static edgehog_err_t serial_sink_write(void *user_data, const uint8_t *data, size_t len)
+{
+    edgehog_ota_serial_sink_t *serial_sink = (edgehog_ota_serial_sink_t *) user_data;
+    while (len > 0) {
+        edgehog_err_t edgehog_err = wait_in_flight(serial_sink, serial_sink->config.window - 1);
+        if (edgehog_err != EDGEHOG_OK) {
+            return edgehog_err;
+        }
+        size_t frame_len
+            = len < EDGEHOG_OTA_SERIAL_PAYLOAD_SIZE ? len : EDGEHOG_OTA_SERIAL_PAYLOAD_SIZE;
+        edgehog_err = queue_frame(serial_sink, OTA_SERIAL_FRAME_DATA, data, frame_len);
+        if (edgehog_err != EDGEHOG_OK) {
+            return edgehog_err;
+        }
+        serial_sink->image_crc = esp_rom_crc32_le(serial_sink->image_crc, data, frame_len);
+        serial_sink->image_len += frame_len;
+        data += frame_len;
+        len -= frame_len;
+    }
+    return EDGEHOG_OK;
+}
+
+static edgehog_err_t serial_sink_finish(void *user_data)
+{
+    edgehog_ota_serial_sink_t *serial_sink = (edgehog_ota_serial_sink_t *) user_data;
+
+    // Step 1 wait for all the data to be acknowledged
+
+    edgehog_err_t edgehog_err = wait_in_flight(serial_sink, 0);
+    if (edgehog_err != EDGEHOG_OK) {
+        return edgehog_err;
+    }
+
+    // Step 2 the target acknowledges the end of the image once it has been validated
+
+    uint8_t payload[8];
+    put_u32_le(payload, serial_sink->image_len);
+    put_u32_le(&payload[4], serial_sink->image_crc);
+    edgehog_err = queue_frame(serial_sink, OTA_SERIAL_FRAME_END, payload, sizeof(payload));
+    if (edgehog_err == EDGEHOG_OK) {
+        edgehog_err = wait_in_flight(serial_sink, 0);
+    }
+    if (edgehog_err != EDGEHOG_OK) {
+        return edgehog_err;
+    }
+
+    int64_t elapsed_us = esp_timer_get_time() - serial_sink->start_us;
+    uint32_t throughput = elapsed_us > 0
+        ? (uint32_t) (((uint64_t) serial_sink->image_len * 1000000) / elapsed_us)
+        : 0;
+    ESP_LOGI(TAG, "OTA target %s updated: %u bytes in %lld ms, %u B/s, %u frames sent again",
+        serial_sink->config.target, (unsigned int) serial_sink->image_len,
+        (long long) (elapsed_us / 1000), (unsigned int) throughput,
+        (unsigned int) serial_sink->retransmissions);
+    return EDGEHOG_OK;
+}
+
+static void serial_sink_abort(void *user_data)
+{
+    edgehog_ota_serial_sink_t *serial_sink = (edgehog_ota_serial_sink_t *) user_data;
+    // The abort is not acknowledged, the target also discards the image on the next BEGIN
+    queue_frame(serial_sink, OTA_SERIAL_FRAME_ABORT, NULL, 0);
+}
+
+static edgehog_err_t queue_frame(edgehog_ota_serial_sink_t *serial_sink, ota_serial_frame_t type,
+    const uint8_t *payload, size_t len)
+{
+    uint8_t seq = serial_sink->next_seq++;
+    uint8_t idx = seq % EDGEHOG_OTA_SERIAL_MAX_WINDOW;
+    if (len > 0) {
+        memcpy(serial_sink->frames[idx], payload, len);
+    }
+    serial_sink->frame_len[idx] = (uint16_t) len;
+    serial_sink->frame_type[idx] = (uint8_t) type;
+    if (!send_frame(serial_sink, seq)) {
+        ESP_LOGE(TAG, "Unable to send a frame to the OTA target");
+        return EDGEHOG_ERR_OTA_INTERNAL;
+    }
+    return EDGEHOG_OK;
+}
+
+static bool send_frame(edgehog_ota_serial_sink_t *serial_sink, uint8_t seq)
+{
+    const edgehog_ota_serial_transport_t *transport = &serial_sink->config.transport;
+    uint8_t idx = seq % EDGEHOG_OTA_SERIAL_MAX_WINDOW;
+    uint16_t len = serial_sink->frame_len[idx];
+
+    uint8_t header[OTA_SERIAL_HEADER_LEN + 1] = { OTA_SERIAL_SOF, serial_sink->frame_type[idx], seq,
+        (uint8_t) (len & 0xFF), (uint8_t) (len >> 8) };
+    uint16_t crc = crc16_ccitt(0xFFFF, &header[1], OTA_SERIAL_HEADER_LEN);
+    crc = crc16_ccitt(crc, serial_sink->frames[idx], len);
+    uint8_t trailer[2] = { (uint8_t) (crc & 0xFF), (uint8_t) (crc >> 8) };
+
+    return transport->send(transport->ctx, header, sizeof(header)) == sizeof(header)
+        && (len == 0 || transport->send(transport->ctx, serial_sink->frames[idx], len) == len)
+        && transport->send(transport->ctx, trailer, sizeof(trailer)) == sizeof(trailer);
+}
+
+static void resend_frames(edgehog_ota_serial_sink_t *serial_sink)
+{
+    for (uint8_t seq = serial_sink->base_seq; seq != serial_sink->next_seq; seq++) {
+        send_frame(serial_sink, seq);
+        serial_sink->retransmissions++;
+    }
+}
+
+static edgehog_err_t wait_in_flight(edgehog_ota_serial_sink_t *serial_sink, uint8_t max_in_flight)
+{
+    uint8_t retries = 0;
+    while ((uint8_t) (serial_sink->next_seq - serial_sink->base_seq) > max_in_flight) {
+        uint8_t type = 0;
+        uint8_t seq = 0;
+        int received = receive_response(serial_sink, &type, &seq);
+        if (received < 0) {
+            ESP_LOGE(TAG, "Unable to receive from the OTA target");
+            return EDGEHOG_ERR_OTA_INTERNAL;
+        }
+
+        uint8_t in_flight = serial_sink->next_seq - serial_sink->base_seq;
+        uint8_t distance = seq - serial_sink->base_seq;
+        if (received > 0 && type == OTA_SERIAL_FRAME_ERROR) {
+            ESP_LOGE(TAG, "The OTA target refused the image");
+            return EDGEHOG_ERR_OTA_INVALID_IMAGE;
+        }
+        if (received > 0 && type == OTA_SERIAL_FRAME_ACK && distance < in_flight) {
+            // Acknowledgements are cumulative
+            serial_sink->base_seq = seq + 1;
+            retries = 0;
+            continue;
+        }
+        if (received > 0 && type != OTA_SERIAL_FRAME_NAK) {
+            // Stale acknowledgement
+            continue;
+        }
+
+        // No acknowledgement in time or frame requested again, go back to the oldest one
+        if (++retries > serial_sink->config.max_retries) {
+            ESP_LOGE(TAG, "No acknowledgement from the OTA target");
+            return EDGEHOG_ERR_OTA_INTERNAL;
+        }
+        if (received > 0 && distance < in_flight) {
+            serial_sink->base_seq = seq;
+        }
+        resend_frames(serial_sink);
+    }
+    return EDGEHOG_OK;
+}
+
+static int receive_response(edgehog_ota_serial_sink_t *serial_sink, uint8_t *type, uint8_t *seq)
+{
+    int64_t deadline_us
+        = esp_timer_get_time() + (int64_t) serial_sink->config.ack_timeout_ms * 1000;
+    uint8_t header[OTA_SERIAL_HEADER_LEN];
+    uint8_t payload[OTA_SERIAL_RESPONSE_MAX_LEN];
+    uint8_t trailer[2];
+
+    while (1) {
+        uint8_t sof = 0;
+        int ret = receive_exact(serial_sink, &sof, 1, deadline_us);
+        if (ret <= 0) {
+            return ret;
+        }
+        if (sof != OTA_SERIAL_SOF) {
+            continue;
+        }
+        ret = receive_exact(serial_sink, header, sizeof(header), deadline_us);
+        if (ret <= 0) {
+            return ret;
+        }
+        uint16_t len = header[2] | (header[3] << 8);
+        if (len > sizeof(payload)) {
+            // Not a response, look for the next start of frame
+            continue;
+        }
+        ret = receive_exact(serial_sink, payload, len, deadline_us);
+        if (ret > 0) {
+            ret = receive_exact(serial_sink, trailer, sizeof(trailer), deadline_us);
+        }
+        if (ret <= 0) {
+            return ret;
+        }
+        uint16_t crc = crc16_ccitt(0xFFFF, header, sizeof(header));
+        crc = crc16_ccitt(crc, payload, len);
+        if (crc != (trailer[0] | (trailer[1] << 8))) {
+            ESP_LOGD(TAG, "Dropping a frame with a wrong CRC");
+            continue;
+        }
+        *type = header[0];
+        *seq = header[1];
+        return 1;
+    }
+}
+
+static int receive_exact(
+    edgehog_ota_serial_sink_t *serial_sink, uint8_t *data, size_t len, int64_t deadline_us)
+{
+    const edgehog_ota_serial_transport_t *transport = &serial_sink->config.transport;
+    size_t received = 0;
+    while (received < len) {
+        int64_t remaining_us = deadline_us - esp_timer_get_time();
+        if (remaining_us <= 0) {
+            return 0;
+        }
+        int ret = transport->recv(transport->ctx, &data[received], len - received,
+            (uint32_t) ((remaining_us + 999) / 1000));
+        if (ret < 0) {
+            return -1;
+        }
+        received += ret;
+    }
+    return 1;
+}
+
+static uint16_t crc16_ccitt(uint16_t crc, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t) data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static void put_u32_le(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = value & 0xFF;
+    buffer[1] = (value >> 8) & 0xFF;
+    buffer[2] = (value >> 16) & 0xFF;
+    buffer[3] = (value >> 24) & 0xFF;
+}
+
+static int uart_transport_send(void *ctx, const uint8_t *data, size_t len)
+{
+    return uart_write_bytes((uart_port_t) (intptr_t) ctx, (const char *) data, len);
+}
+
+static int uart_transport_recv(void *ctx, uint8_t *data, size_t len, uint32_t timeout_ms)
+{
+    return uart_read_bytes((uart_port_t) (intptr_t) ctx, data, len, pdMS_TO_TICKS(timeout_ms));
+}
@@ -0,0 +1,236 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "edgehog_system_status.h"
+#include "edgehog_device_private.h"
+#include <astarte_bson_serializer.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <stdio.h>
+
+#define TOP_TASKS CONFIG_EDGEHOG_SYSTEM_STATUS_TOP_TASKS
+
+static const char *TAG = "EDGEHOG_SYSTEM_STATUS";
+
+const astarte_interface_t extended_system_status_interface
+    = { .name = "io.edgehog.devicemanager.ExtendedSystemStatus",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+#ifdef configRUN_TIME_COUNTER_TYPE
+typedef configRUN_TIME_COUNTER_TYPE run_time_t;
+#else
+typedef uint32_t run_time_t;
+#endif
+
+typedef struct
+{
+    UBaseType_t task_number;
+    run_time_t run_time;
+} task_run_time_t;
+
+static const struct
+{
+    const char *name;
+    uint32_t caps;
+} heap_regions[] = {
+    { "internal", MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT },
+    { "dma", MALLOC_CAP_DMA },
+#if CONFIG_SPIRAM
+    { "spiram", MALLOC_CAP_SPIRAM },
+#endif
+};
+
+#define HEAP_REGIONS (sizeof(heap_regions) / sizeof(heap_regions[0]))
+
+struct edgehog_system_status_t
+{
+    SemaphoreHandle_t mutex;
+    TaskStatus_t tasks[CONFIG_EDGEHOG_SYSTEM_STATUS_MAX_TASKS];
+    // Run time counters of the previous snapshot, the counters wrap around
+    task_run_time_t previous[CONFIG_EDGEHOG_SYSTEM_STATUS_MAX_TASKS];
+    UBaseType_t previous_len;
+    run_time_t previous_total;
+    char top_names[TOP_TASKS][configMAX_TASK_NAME_LEN];
+};
+
+static run_time_t get_previous_run_time(
+    edgehog_system_status_t *system_status, UBaseType_t task_number);
+static TaskHandle_t get_idle_task(int core);
+
+edgehog_system_status_t *edgehog_system_status_new(void)
+{
+    edgehog_system_status_t *system_status = calloc(1, sizeof(edgehog_system_status_t));
+    if (!system_status) {
+        return NULL;
+    }
+
+    system_status->mutex = xSemaphoreCreateMutex();
+    if (!system_status->mutex) {
+        free(system_status);
+        return NULL;
+    }
+
+    return system_status;
+}
+
+void edgehog_system_status_destroy(edgehog_system_status_t *system_status)
+{
+    if (system_status) {
+        vSemaphoreDelete(system_status->mutex);
+    }
+    free(system_status);
+}
+
+void edgehog_system_status_publish(
+    edgehog_device_handle_t edgehog_device, edgehog_system_status_t *system_status)
+{
+    xSemaphoreTake(system_status->mutex, portMAX_DELAY);
+
+    // Step 1: take a snapshot of the tasks
+    run_time_t total = 0;
+    UBaseType_t len = uxTaskGetSystemState(
+        system_status->tasks, CONFIG_EDGEHOG_SYSTEM_STATUS_MAX_TASKS, &total);
+    if (len == 0) {
+        ESP_LOGW(TAG, "More than %d tasks, the task usage is not published",
+            CONFIG_EDGEHOG_SYSTEM_STATUS_MAX_TASKS);
+    }
+
+    // Step 2: compute the CPU usage since the previous snapshot, per task and per core idle task
+    run_time_t elapsed = total - system_status->previous_total;
+    double idle_percent[portNUM_PROCESSORS] = { 0 };
+    int top[TOP_TASKS];
+    double top_percent[TOP_TASKS];
+    int top_len = 0;
+    for (int i = 0; i < len; i++) {
+        TaskStatus_t *task = &system_status->tasks[i];
+        run_time_t run_time
+            = task->ulRunTimeCounter - get_previous_run_time(system_status, task->xTaskNumber);
+        double percent = elapsed > 0 ? 100.0 * run_time / elapsed : 0;
+
+        bool idle = false;
+        for (int core = 0; core < portNUM_PROCESSORS; core++) {
+            if (task->xHandle == get_idle_task(core)) {
+                idle_percent[core] = percent;
+                idle = true;
+            }
+        }
+        if (idle || (top_len == TOP_TASKS && percent <= top_percent[TOP_TASKS - 1])) {
+            continue;
+        }
+        // Insertion in the tasks sorted by decreasing CPU usage
+        int j = top_len < TOP_TASKS ? top_len++ : TOP_TASKS - 1;
+        for (; j > 0 && top_percent[j - 1] < percent; j--) {
+            top[j] = top[j - 1];
+            top_percent[j] = top_percent[j - 1];
+        }
+        top[j] = i;
+        top_percent[j] = percent;
+    }
+
+    const char *top_names[TOP_TASKS];
+    int32_t top_stack[TOP_TASKS];
+    for (int j = 0; j < top_len; j++) {
+        TaskStatus_t *task = &system_status->tasks[top[j]];
+        snprintf(system_status->top_names[j], configMAX_TASK_NAME_LEN, "%s", task->pcTaskName);
+        top_names[j] = system_status->top_names[j];
+        top_stack[j] = (int32_t) task->usStackHighWaterMark;
+    }
+
+    if (len > 0) {
+        for (int i = 0; i < len; i++) {
+            system_status->previous[i].task_number = system_status->tasks[i].xTaskNumber;
+            system_status->previous[i].run_time = system_status->tasks[i].ulRunTimeCounter;
+        }
+        system_status->previous_len = len;
+        system_status->previous_total = total;
+    }
+
+    // Step 3: sample the heap regions
+    const char *heap_names[HEAP_REGIONS];
+    int64_t heap_free[HEAP_REGIONS];
+    int64_t heap_largest[HEAP_REGIONS];
+    int64_t heap_min_free[HEAP_REGIONS];
+    double heap_fragmentation[HEAP_REGIONS];
+    for (int i = 0; i < HEAP_REGIONS; i++) {
+        multi_heap_info_t info;
+        heap_caps_get_info(&info, heap_regions[i].caps);
+        heap_names[i] = heap_regions[i].name;
+        heap_free[i] = info.total_free_bytes;
+        heap_largest[i] = info.largest_free_block;
+        heap_min_free[i] = info.minimum_free_bytes;
+        heap_fragmentation[i] = info.total_free_bytes > 0
+            ? 100.0 * (1.0 - (double) info.largest_free_block / info.total_free_bytes)
+            : 0;
+    }
+
+    // Step 4: publish the status
+    astarte_bson_serializer_handle_t bs = astarte_bson_serializer_new();
+    astarte_bson_serializer_append_int64(
+        bs, "minAvailMemoryBytes", esp_get_minimum_free_heap_size());
+    astarte_bson_serializer_append_double_array(
+        bs, "idlePercent", idle_percent, portNUM_PROCESSORS);
+    astarte_bson_serializer_append_string_array(bs, "heapRegion", heap_names, HEAP_REGIONS);
+    astarte_bson_serializer_append_int64_array(bs, "heapFreeBytes", heap_free, HEAP_REGIONS);
+    astarte_bson_serializer_append_int64_array(
+        bs, "heapLargestFreeBlockBytes", heap_largest, HEAP_REGIONS);
+    astarte_bson_serializer_append_int64_array(
+        bs, "heapMinFreeBytes", heap_min_free, HEAP_REGIONS);
+    astarte_bson_serializer_append_double_array(
+        bs, "heapFragmentationPercent", heap_fragmentation, HEAP_REGIONS);
+    astarte_bson_serializer_append_string_array(bs, "taskName", top_names, top_len);
+    astarte_bson_serializer_append_double_array(bs, "taskCpuPercent", top_percent, top_len);
+    astarte_bson_serializer_append_int32_array(
+        bs, "taskStackHighWaterMarkBytes", top_stack, top_len);
+    astarte_bson_serializer_append_end_of_document(bs);
+    xSemaphoreGive(system_status->mutex);
+
+    const void *doc = astarte_bson_serializer_get_document(bs, NULL);
+    astarte_device_stream_aggregate(edgehog_device->astarte_device,
+        extended_system_status_interface.name, "/systemStatus", doc, 0);
+    astarte_bson_serializer_destroy(bs);
+}
+
+static run_time_t get_previous_run_time(
+    edgehog_system_status_t *system_status, UBaseType_t task_number)
+{
+    for (int i = 0; i < system_status->previous_len; i++) {
+        if (system_status->previous[i].task_number == task_number) {
+            return system_status->previous[i].run_time;
+        }
+    }
+    // A task created after the previous snapshot
+    return 0;
+}
+
+static TaskHandle_t get_idle_task(int core)
+{
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+    return xTaskGetIdleTaskHandleForCore(core);
+#else
+    return xTaskGetIdleTaskHandleForCPU(core);
+#endif
+}
@@ -161,6 +161,10 @@ static void timer_callback(TimerHandle_t timer_handle)
         = (struct timer_ptr_entry_t *) pvTimerGetTimerID(timer_handle);
     telemetry_periodic telemetry_periodic_fn
         = edgehog_device_get_telemetry_periodic(timer_entry->telemetry_type);
+    if (!telemetry_periodic_fn) {
+        // A telemetry type disabled in the configuration
+        return;
+    }
     telemetry_periodic_fn(timer_entry->edgehog_device);
 }
 
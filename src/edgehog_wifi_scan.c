@@ -0,0 +1,827 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "edgehog_wifi_scan.h"
+#include "edgehog_device_private.h"
+#include <astarte_bson_serializer.h>
+#include <esp_event.h>
+#include <esp_idf_version.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_wifi.h>
+#include <esp_wifi_types.h>
+#include <freertos/FreeRTOS.h>
+#include <string.h>
+
+#define WIFI_MAC_STR_LEN 18
+#define WIFI_SCAN_MAX_CHANNEL 14
+#define WIFI_SCAN_MIN_DWELL_MS 10
+#define WIFI_SCAN_MAX_DWELL_MS 1500
+// Time allowed to a scan on top of the time spent on the channels
+#define WIFI_SCAN_TIMEOUT_MARGIN_MS 5000
+// Estimated BSON size of a batch without access points, and of an access point without its ESSID
+#define WIFI_SCAN_BATCH_HEADER_LEN 96
+#define WIFI_SCAN_BATCH_AP_LEN 72
+#if CONFIG_EDGEHOG_WIFI_SCAN_DIFFERENTIAL
+// Room for the access points that disappeared since the previous scan
+#define WIFI_SCAN_EXTRA_RECORDS CONFIG_EDGEHOG_WIFI_SCAN_TABLE_SIZE
+#else
+#define WIFI_SCAN_EXTRA_RECORDS 0
+#endif
+#define WIFI_SCAN_MAX_RECORDS (CONFIG_EDGEHOG_WIFI_SCAN_TOP_N + WIFI_SCAN_EXTRA_RECORDS)
+
+static const char *TAG = "EDGEHOG_WIFI_SCAN";
+
+const astarte_interface_t wifi_scan_result_interface
+    = { .name = "io.edgehog.devicemanager.WiFiScanResults",
+          .major_version = 0,
+          .minor_version = 2,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+
+#if CONFIG_EDGEHOG_WIFI_SCAN_REMOTE_CONFIG
+const astarte_interface_t wifi_scan_config_interface
+    = { .name = "io.edgehog.devicemanager.config.WiFiScan",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_SERVER,
+          .type = TYPE_PROPERTIES };
+#endif
+
+#if CONFIG_EDGEHOG_WIFI_SCAN_BATCHED
+const astarte_interface_t wifi_scan_batch_interface
+    = { .name = "io.edgehog.devicemanager.WiFiScanResultsBatch",
+          .major_version = 0,
+          .minor_version = 1,
+          .ownership = OWNERSHIP_DEVICE,
+          .type = TYPE_DATASTREAM };
+#endif
+
+typedef struct
+{
+    uint32_t messages;
+    uint32_t bytes;
+} wifi_scan_publish_stats_t;
+
+typedef struct
+{
+    bool passive;
+    uint16_t channels; // Bit N set to scan channel N, 0 to scan all the channels
+    uint16_t dwell_ms;
+    uint16_t max_results; // 0 for no limit
+    bool neighbours_only;
+} wifi_scan_policy_t;
+
+typedef struct
+{
+    uint16_t total;
+    // Index 0 counts the access points on an unknown channel or above channel 14
+    uint16_t per_channel[WIFI_SCAN_MAX_CHANNEL + 1];
+} wifi_scan_tail_t;
+
+// Only accessed by the scan done handler, the size does not depend on the access points found
+static wifi_ap_record_t wifi_scan_records[WIFI_SCAN_MAX_RECORDS];
+#if CONFIG_EDGEHOG_WIFI_SCAN_BATCHED
+// Columns of the chunk being published, sized as the records a chunk is taken from
+static struct
+{
+    const char *essid[WIFI_SCAN_MAX_RECORDS];
+    const char *mac[WIFI_SCAN_MAX_RECORDS];
+    int32_t channel[WIFI_SCAN_MAX_RECORDS];
+    int32_t rssi[WIFI_SCAN_MAX_RECORDS];
+    char mac_str[WIFI_SCAN_MAX_RECORDS][WIFI_MAC_STR_LEN];
+    bool connected[WIFI_SCAN_MAX_RECORDS];
+    bool removed[WIFI_SCAN_MAX_RECORDS];
+} wifi_scan_columns;
+#endif
+static portMUX_TYPE wifi_scan_policy_lock = portMUX_INITIALIZER_UNLOCKED;
+static wifi_scan_policy_t wifi_scan_policy;
+static bool wifi_scan_policy_loaded;
+
+typedef struct
+{
+    edgehog_device_handle_t owner; // Device that started the scan in flight, NULL when idle
+    int64_t start_us;
+    int64_t deadline_us;
+    uint32_t coalesced; // Requests served by the scan in flight
+    bool stopped; // A timed out scan was stopped, its failed scan done event may still arrive
+} wifi_scan_state_t;
+
+// The radio runs a single scan at a time, shared by all the devices
+static portMUX_TYPE wifi_scan_state_lock = portMUX_INITIALIZER_UNLOCKED;
+static wifi_scan_state_t wifi_scan_state;
+
+#if CONFIG_EDGEHOG_WIFI_SCAN_DIFFERENTIAL
+typedef struct
+{
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t rssi_bucket;
+    bool seen;
+} wifi_scan_entry_t;
+
+static wifi_scan_entry_t wifi_scan_table[CONFIG_EDGEHOG_WIFI_SCAN_TABLE_SIZE];
+static uint16_t wifi_scan_table_len;
+static uint32_t wifi_scan_count;
+#endif
+
+static void wifi_scan_event_handler(
+    void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data);
+static void publish_wifi_ap(edgehog_device_handle_t edgehog_device, uint32_t duration_ms);
+static uint16_t collect_wifi_ap(wifi_ap_record_t *ap_info, uint16_t max_count,
+    const uint8_t *connected_bssid, wifi_scan_tail_t *tail);
+static bool is_more_relevant(
+    const wifi_ap_record_t *a, const wifi_ap_record_t *b, const uint8_t *connected_bssid);
+static void count_tail(wifi_scan_tail_t *tail, const wifi_ap_record_t *ap_info);
+static void get_scan_policy(wifi_scan_policy_t *policy);
+static void load_default_scan_policy(wifi_scan_policy_t *policy);
+static void configure_scan(const wifi_scan_policy_t *policy, wifi_scan_config_t *config);
+static uint16_t parse_channel_list(const char *list);
+#if CONFIG_EDGEHOG_WIFI_SCAN_REMOTE_CONFIG
+static bool get_int_element(astarte_bson_element_t element, int64_t *value);
+#endif
+#if CONFIG_EDGEHOG_WIFI_SCAN_BATCHED
+static void publish_wifi_ap_batch(edgehog_device_handle_t edgehog_device,
+    const wifi_ap_record_t *ap_info, uint16_t ap_count, uint16_t present_count,
+    const uint8_t *connected_bssid, uint32_t duration_ms, const wifi_scan_tail_t *tail,
+    wifi_scan_publish_stats_t *stats);
+static void publish_wifi_ap_chunk(edgehog_device_handle_t edgehog_device,
+    const wifi_ap_record_t *ap_info, uint16_t ap_count, uint16_t present_count,
+    const uint8_t *connected_bssid, uint64_t timestamp_ms, uint32_t duration_ms,
+    const wifi_scan_tail_t *tail, wifi_scan_publish_stats_t *stats);
+#else
+static void publish_wifi_ap_record(edgehog_device_handle_t edgehog_device,
+    const wifi_ap_record_t *ap_info, const uint8_t *connected_bssid,
+    wifi_scan_publish_stats_t *stats);
+#endif
+#if CONFIG_EDGEHOG_WIFI_SCAN_DIFFERENTIAL
+static uint16_t filter_wifi_ap_changes(
+    wifi_ap_record_t *ap_info, uint16_t ap_count, uint16_t *present_count);
+static wifi_scan_entry_t *find_wifi_scan_entry(const uint8_t bssid[]);
+#endif
+static void format_mac_address(const uint8_t mac[], char *out);
+static inline bool compare_mac_address(const uint8_t a[], const uint8_t b[]);
+
+edgehog_err_t edgehog_wifi_scan_init(edgehog_device_handle_t edgehog_device)
+{
+    // Scan done events of third party scans are told apart by the scan ownership
+    esp_err_t ret = esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_SCAN_DONE,
+        wifi_scan_event_handler, edgehog_device, &edgehog_device->wifi_scan_handler);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG,
+            "Unable to register to default event loop. Be sure to have called "
+            "esp_event_loop_create_default() before calling edgehog_device_new");
+        edgehog_device->wifi_scan_handler = NULL;
+        return EDGEHOG_ERR;
+    }
+
+    return EDGEHOG_OK;
+}
+
+void edgehog_wifi_scan_deinit(edgehog_device_handle_t edgehog_device)
+{
+    if (edgehog_device->wifi_scan_handler) {
+        esp_event_handler_instance_unregister(
+            WIFI_EVENT, WIFI_EVENT_SCAN_DONE, edgehog_device->wifi_scan_handler);
+        edgehog_device->wifi_scan_handler = NULL;
+    }
+
+    portENTER_CRITICAL(&wifi_scan_state_lock);
+    if (wifi_scan_state.owner == edgehog_device) {
+        wifi_scan_state.owner = NULL;
+    }
+    portEXIT_CRITICAL(&wifi_scan_state_lock);
+}
+
+void edgehog_wifi_scan_start(edgehog_device_handle_t edgehog_device)
+{
+    if (!edgehog_device->wifi_scan_handler) {
+        ESP_LOGE(TAG, "Unable to start Wi-Fi scan, scan done handler not registered");
+        return;
+    }
+
+    wifi_scan_policy_t policy;
+    get_scan_policy(&policy);
+    int64_t now_us = esp_timer_get_time();
+
+    // Step 1: coalesce with the scan in flight, or take the ownership of the radio
+    bool in_flight = false;
+    bool timed_out = false;
+    portENTER_CRITICAL(&wifi_scan_state_lock);
+    if (wifi_scan_state.owner && now_us < wifi_scan_state.deadline_us) {
+        in_flight = true;
+        wifi_scan_state.coalesced++;
+    } else {
+        // A scan whose done event never arrived is stopped and replaced by the new one
+        timed_out = wifi_scan_state.owner != NULL;
+        wifi_scan_state.stopped = timed_out;
+        wifi_scan_state.owner = edgehog_device;
+        wifi_scan_state.start_us = now_us;
+        wifi_scan_state.deadline_us = now_us
+            + ((int64_t) WIFI_SCAN_MAX_CHANNEL * policy.dwell_ms + WIFI_SCAN_TIMEOUT_MARGIN_MS)
+                * 1000;
+        wifi_scan_state.coalesced = 0;
+    }
+    portEXIT_CRITICAL(&wifi_scan_state_lock);
+
+    if (in_flight) {
+        ESP_LOGD(TAG, "Wi-Fi scan in flight, request coalesced");
+        return;
+    }
+    if (timed_out) {
+        ESP_LOGW(TAG, "Wi-Fi scan timed out, restarting it");
+        esp_wifi_scan_stop();
+    }
+
+    // Step 2: start the scan
+    wifi_scan_config_t config;
+    configure_scan(&policy, &config);
+    esp_err_t ret = esp_wifi_scan_start(&config, false);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Unable to start Wi-Fi scan: %s", esp_err_to_name(ret));
+        portENTER_CRITICAL(&wifi_scan_state_lock);
+        if (wifi_scan_state.owner == edgehog_device) {
+            wifi_scan_state.owner = NULL;
+        }
+        portEXIT_CRITICAL(&wifi_scan_state_lock);
+    }
+}
+
+#if CONFIG_EDGEHOG_WIFI_SCAN_REMOTE_CONFIG
+edgehog_err_t edgehog_wifi_scan_config_event(astarte_device_data_event_t *event_request)
+{
+    if (!event_request->path) {
+        ESP_LOGW(TAG, "Unable to handle Wi-Fi scan config request path empty");
+        return EDGEHOG_ERR;
+    }
+
+    // Unset properties restore the Kconfig value
+    wifi_scan_policy_t defaults;
+    load_default_scan_policy(&defaults);
+    wifi_scan_policy_t policy;
+    get_scan_policy(&policy);
+    astarte_bson_element_t element = event_request->bson_element;
+    bool unset = !element.value;
+    int64_t value = 0;
+
+    if (strcmp(event_request->path, "/scanType") == 0) {
+        const char *scan_type
+            = !unset && element.type == BSON_TYPE_STRING
+            ? astarte_bson_deserializer_element_to_string(element, NULL)
+            : NULL;
+        if (unset) {
+            policy.passive = defaults.passive;
+        } else if (scan_type && strcmp(scan_type, "passive") == 0) {
+            policy.passive = true;
+        } else if (scan_type && strcmp(scan_type, "active") == 0) {
+            policy.passive = false;
+        } else {
+            goto invalid;
+        }
+    } else if (strcmp(event_request->path, "/channels") == 0) {
+        if (unset) {
+            policy.channels = defaults.channels;
+        } else if (element.type == BSON_TYPE_ARRAY) {
+            astarte_bson_document_t channels = astarte_bson_deserializer_element_to_array(element);
+            astarte_bson_element_t channel_element;
+            policy.channels = 0;
+            astarte_err_t astarte_err
+                = astarte_bson_deserializer_first_element(channels, &channel_element);
+            while (astarte_err == ASTARTE_OK) {
+                if (get_int_element(channel_element, &value) && value >= 1
+                    && value <= WIFI_SCAN_MAX_CHANNEL) {
+                    policy.channels |= 1 << value;
+                }
+                astarte_err = astarte_bson_deserializer_next_element(
+                    channels, channel_element, &channel_element);
+            }
+        } else {
+            goto invalid;
+        }
+    } else if (strcmp(event_request->path, "/dwellMillis") == 0) {
+        if (unset) {
+            policy.dwell_ms = defaults.dwell_ms;
+        } else if (get_int_element(element, &value) && value >= WIFI_SCAN_MIN_DWELL_MS
+            && value <= WIFI_SCAN_MAX_DWELL_MS) {
+            policy.dwell_ms = (uint16_t) value;
+        } else {
+            goto invalid;
+        }
+    } else if (strcmp(event_request->path, "/maxResults") == 0) {
+        if (unset) {
+            policy.max_results = defaults.max_results;
+        } else if (get_int_element(element, &value) && value >= 0 && value <= UINT16_MAX) {
+            policy.max_results = (uint16_t) value;
+        } else {
+            goto invalid;
+        }
+    } else if (strcmp(event_request->path, "/neighboursOnly") == 0) {
+        if (unset) {
+            policy.neighbours_only = defaults.neighbours_only;
+        } else if (element.type == BSON_TYPE_BOOLEAN) {
+            policy.neighbours_only = astarte_bson_deserializer_element_to_bool(element);
+        } else {
+            goto invalid;
+        }
+    } else {
+        goto invalid;
+    }
+
+    portENTER_CRITICAL(&wifi_scan_policy_lock);
+    wifi_scan_policy = policy;
+    portEXIT_CRITICAL(&wifi_scan_policy_lock);
+    return EDGEHOG_OK;
+
+invalid:
+    ESP_LOGE(TAG, "Invalid Wi-Fi scan config on %s", event_request->path);
+    return EDGEHOG_ERR;
+}
+#endif
+
+static void wifi_scan_event_handler(
+    void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
+{
+    if (!arg || !event_data) {
+        return;
+    }
+
+    if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE) {
+        wifi_event_sta_scan_done_t *wifi_event_sta_scan_done
+            = (wifi_event_sta_scan_done_t *) event_data;
+        edgehog_device_handle_t edgehog_device = (edgehog_device_handle_t) arg;
+
+        // Release the ownership, the results of scans started by others are left untouched
+        bool owned = false;
+        int64_t start_us = 0;
+        uint32_t coalesced = 0;
+        portENTER_CRITICAL(&wifi_scan_state_lock);
+        if (wifi_scan_state.owner == edgehog_device && wifi_scan_state.stopped
+            && wifi_event_sta_scan_done->status != 0) {
+            // The event of the stopped scan, the scan in flight is still running
+            wifi_scan_state.stopped = false;
+        } else if (wifi_scan_state.owner == edgehog_device) {
+            owned = true;
+            wifi_scan_state.stopped = false;
+            start_us = wifi_scan_state.start_us;
+            coalesced = wifi_scan_state.coalesced;
+            wifi_scan_state.owner = NULL;
+        }
+        portEXIT_CRITICAL(&wifi_scan_state_lock);
+        if (!owned) {
+            return;
+        }
+
+        if (coalesced > 0) {
+            ESP_LOGD(TAG, "Wi-Fi scan served %u more requests", (unsigned int) coalesced);
+        }
+        // status of scanning APs: 0 — success, 1 - failure
+        if (wifi_event_sta_scan_done->status != 0) {
+            ESP_LOGW(TAG, "Wi-Fi scan failed");
+            esp_wifi_clear_ap_list();
+            return;
+        }
+        uint32_t duration_ms = (uint32_t) ((esp_timer_get_time() - start_us) / 1000);
+        publish_wifi_ap(edgehog_device, duration_ms);
+    }
+}
+
+static void publish_wifi_ap(edgehog_device_handle_t edgehog_device, uint32_t duration_ms)
+{
+    wifi_scan_policy_t policy;
+    get_scan_policy(&policy);
+    uint16_t max_count = CONFIG_EDGEHOG_WIFI_SCAN_TOP_N;
+    if (policy.max_results > 0 && policy.max_results < max_count) {
+        max_count = policy.max_results;
+    }
+
+    wifi_ap_record_t ap_info_connected;
+    bool ap_is_connected = esp_wifi_sta_get_ap_info(&ap_info_connected) == ESP_OK;
+    const uint8_t *connected_bssid = ap_is_connected ? ap_info_connected.bssid : NULL;
+
+    wifi_ap_record_t *ap_info = wifi_scan_records;
+    wifi_scan_tail_t tail = { 0 };
+#if CONFIG_EDGEHOG_WIFI_SCAN_DIFFERENTIAL
+    // Access points still in range are marked while collecting, the ones left have disappeared
+    for (uint16_t i = 0; i < wifi_scan_table_len; i++) {
+        wifi_scan_table[i].seen = false;
+    }
+#endif
+    uint16_t ap_count = collect_wifi_ap(ap_info, max_count, connected_bssid, &tail);
+    if (tail.total > 0) {
+        ESP_LOGD(TAG, "Wi-Fi scan kept %u access points, %u weaker ones only counted",
+            (unsigned int) ap_count, (unsigned int) tail.total);
+        for (int i = 0; i <= WIFI_SCAN_MAX_CHANNEL; i++) {
+            if (tail.per_channel[i] > 0) {
+                ESP_LOGD(TAG, "Channel %d: %u more access points", i,
+                    (unsigned int) tail.per_channel[i]);
+            }
+        }
+    }
+
+    // The access points after the present ones disappeared since the previous scan
+    uint16_t present_count = ap_count;
+#if CONFIG_EDGEHOG_WIFI_SCAN_DIFFERENTIAL
+    uint16_t found_count = ap_count;
+    ap_count = filter_wifi_ap_changes(ap_info, ap_count, &present_count);
+    ESP_LOGD(TAG, "Wi-Fi scan found %u access points, %u changed, %u removed",
+        (unsigned int) found_count, (unsigned int) present_count,
+        (unsigned int) (ap_count - present_count));
+#endif
+
+    wifi_scan_publish_stats_t stats = { 0 };
+#if CONFIG_EDGEHOG_WIFI_SCAN_BATCHED
+    publish_wifi_ap_batch(edgehog_device, ap_info, ap_count, present_count, connected_bssid,
+        duration_ms, &tail, &stats);
+#else
+    // A single access point record can not express a removal
+    ap_count = present_count;
+    for (int i = 0; i < ap_count; i++) {
+        publish_wifi_ap_record(edgehog_device, &ap_info[i], connected_bssid, &stats);
+    }
+#endif
+    ESP_LOGI(TAG, "Wi-Fi scan published: %u ms, %u access points, %u messages, %u bytes",
+        (unsigned int) duration_ms, (unsigned int) ap_count, (unsigned int) stats.messages,
+        (unsigned int) stats.bytes);
+}
+
+static uint16_t collect_wifi_ap(wifi_ap_record_t *ap_info, uint16_t max_count,
+    const uint8_t *connected_bssid, wifi_scan_tail_t *tail)
+{
+    uint16_t count = 0;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+    // Stream the records out of the driver, keeping the most relevant ones sorted and counting
+    // the others by channel
+    wifi_ap_record_t record;
+    while (esp_wifi_scan_get_ap_record(&record) == ESP_OK) {
+        uint16_t pos = count;
+        while (pos > 0 && is_more_relevant(&record, &ap_info[pos - 1], connected_bssid)) {
+            pos--;
+        }
+        if (pos >= max_count) {
+            count_tail(tail, &record);
+            continue;
+        }
+        if (count == max_count) {
+            count--;
+            count_tail(tail, &ap_info[count]);
+        }
+        memmove(&ap_info[pos + 1], &ap_info[pos], (count - pos) * sizeof(wifi_ap_record_t));
+        ap_info[pos] = record;
+        count++;
+    }
+    esp_wifi_clear_ap_list();
+#else
+    // The driver returns the strongest records first and frees the others. The spare records of
+    // the buffer are used to count the weaker access points by channel, for the others only their
+    // number is known.
+    uint16_t found = 0;
+    if (esp_wifi_scan_get_ap_num(&found) != ESP_OK) {
+        esp_wifi_clear_ap_list();
+        return 0;
+    }
+    count = WIFI_SCAN_MAX_RECORDS;
+    if (esp_wifi_scan_get_ap_records(&count, ap_info) != ESP_OK) {
+        return 0;
+    }
+    for (uint16_t i = max_count; i < count; i++) {
+        count_tail(tail, &ap_info[i]);
+    }
+    uint16_t unknown = found > count ? found - count : 0;
+    tail->total += unknown;
+    tail->per_channel[0] += unknown;
+    if (count > max_count) {
+        count = max_count;
+    }
+#endif
+    return count;
+}
+
+static bool is_more_relevant(
+    const wifi_ap_record_t *a, const wifi_ap_record_t *b, const uint8_t *connected_bssid)
+{
+    // The connected access point comes first, then the strongest ones
+    if (connected_bssid && compare_mac_address(b->bssid, connected_bssid)) {
+        return false;
+    }
+    if (connected_bssid && compare_mac_address(a->bssid, connected_bssid)) {
+        return true;
+    }
+    return a->rssi > b->rssi;
+}
+
+static void count_tail(wifi_scan_tail_t *tail, const wifi_ap_record_t *ap_info)
+{
+    tail->total++;
+    tail->per_channel[ap_info->primary <= WIFI_SCAN_MAX_CHANNEL ? ap_info->primary : 0]++;
+#if CONFIG_EDGEHOG_WIFI_SCAN_DIFFERENTIAL
+    // The access point is still in range, it must not be reported as removed
+    wifi_scan_entry_t *entry = find_wifi_scan_entry(ap_info->bssid);
+    if (entry) {
+        entry->seen = true;
+    }
+#endif
+}
+
+static void get_scan_policy(wifi_scan_policy_t *policy)
+{
+    wifi_scan_policy_t defaults;
+    bool loaded = wifi_scan_policy_loaded;
+    if (!loaded) {
+        load_default_scan_policy(&defaults);
+    }
+
+    portENTER_CRITICAL(&wifi_scan_policy_lock);
+    if (!wifi_scan_policy_loaded) {
+        wifi_scan_policy = defaults;
+        wifi_scan_policy_loaded = true;
+    }
+    *policy = wifi_scan_policy;
+    portEXIT_CRITICAL(&wifi_scan_policy_lock);
+}
+
+static void load_default_scan_policy(wifi_scan_policy_t *policy)
+{
+    policy->passive = false;
+#if CONFIG_EDGEHOG_WIFI_SCAN_PASSIVE
+    policy->passive = true;
+#endif
+    policy->neighbours_only = false;
+#if CONFIG_EDGEHOG_WIFI_SCAN_NEIGHBOURS_ONLY
+    policy->neighbours_only = true;
+#endif
+    policy->channels = parse_channel_list(CONFIG_EDGEHOG_WIFI_SCAN_CHANNELS);
+    policy->dwell_ms = CONFIG_EDGEHOG_WIFI_SCAN_DWELL_MS;
+    policy->max_results = CONFIG_EDGEHOG_WIFI_SCAN_MAX_RESULTS;
+}
+
+static void configure_scan(const wifi_scan_policy_t *policy, wifi_scan_config_t *config)
+{
+    memset(config, 0, sizeof(wifi_scan_config_t));
+    config->show_hidden = true;
+    if (policy->passive) {
+        config->scan_type = WIFI_SCAN_TYPE_PASSIVE;
+        config->scan_time.passive = policy->dwell_ms;
+    } else {
+        config->scan_type = WIFI_SCAN_TYPE_ACTIVE;
+        config->scan_time.active.max = policy->dwell_ms;
+    }
+
+    uint16_t channels = policy->channels;
+    wifi_ap_record_t ap_info_connected;
+    if (policy->neighbours_only && esp_wifi_sta_get_ap_info(&ap_info_connected) == ESP_OK) {
+        // The channel of the access point and the adjacent ones
+        uint8_t current = ap_info_connected.primary;
+        uint16_t neighbours = (0x7 << current >> 1) & (((1 << WIFI_SCAN_MAX_CHANNEL) - 1) << 1);
+        channels = channels & neighbours ? channels & neighbours : neighbours;
+    }
+    if (channels == 0) {
+        return;
+    }
+
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0)
+    config->channel_bitmap.ghz_2_channels = channels;
+#else
+    // A single channel or all of them
+    if ((channels & (channels - 1)) == 0) {
+        config->channel = __builtin_ctz(channels);
+    } else {
+        ESP_LOGD(TAG, "Scanning all the channels, a channel subset requires ESP-IDF v5.3");
+    }
+#endif
+}
+
+static uint16_t parse_channel_list(const char *list)
+{
+    uint16_t channels = 0;
+    while (*list) {
+        char *end = NULL;
+        long channel = strtol(list, &end, 10);
+        if (end == list) {
+            list++;
+            continue;
+        }
+        if (channel >= 1 && channel <= WIFI_SCAN_MAX_CHANNEL) {
+            channels |= 1 << channel;
+        }
+        list = end;
+    }
+    return channels;
+}
+
+#if CONFIG_EDGEHOG_WIFI_SCAN_REMOTE_CONFIG
+static bool get_int_element(astarte_bson_element_t element, int64_t *value)
+{
+    if (element.type == BSON_TYPE_INT32) {
+        *value = astarte_bson_deserializer_element_to_int32(element);
+        return true;
+    }
+    if (element.type == BSON_TYPE_INT64) {
+        *value = astarte_bson_deserializer_element_to_int64(element);
+        return true;
+    }
+    return false;
+}
+#endif
+
+#if CONFIG_EDGEHOG_WIFI_SCAN_BATCHED
+static void publish_wifi_ap_batch(edgehog_device_handle_t edgehog_device,
+    const wifi_ap_record_t *ap_info, uint16_t ap_count, uint16_t present_count,
+    const uint8_t *connected_bssid, uint32_t duration_ms, const wifi_scan_tail_t *tail,
+    wifi_scan_publish_stats_t *stats)
+{
+    // All the chunks of a scan share the same timestamp
+    uint64_t timestamp_ms = edgehog_device_get_timestamp_ms();
+    uint16_t first = 0;
+    while (first < ap_count) {
+        // Fill the chunk up to the size limit, with at least one access point
+        size_t chunk_len = WIFI_SCAN_BATCH_HEADER_LEN;
+        uint16_t count = 0;
+        while (first + count < ap_count) {
+            size_t ap_len
+                = WIFI_SCAN_BATCH_AP_LEN + strlen((const char *) ap_info[first + count].ssid);
+            if (count > 0 && chunk_len + ap_len > CONFIG_EDGEHOG_WIFI_SCAN_BATCH_MAX_BYTES) {
+                break;
+            }
+            chunk_len += ap_len;
+            count++;
+        }
+        // The access points not kept are reported once per scan, in the first chunk
+        uint16_t chunk_present = present_count > first ? present_count - first : 0;
+        publish_wifi_ap_chunk(edgehog_device, &ap_info[first], count,
+            chunk_present < count ? chunk_present : count, connected_bssid, timestamp_ms,
+            duration_ms, first == 0 ? tail : NULL, stats);
+        first += count;
+    }
+}
+
+static void publish_wifi_ap_chunk(edgehog_device_handle_t edgehog_device,
+    const wifi_ap_record_t *ap_info, uint16_t ap_count, uint16_t present_count,
+    const uint8_t *connected_bssid, uint64_t timestamp_ms, uint32_t duration_ms,
+    const wifi_scan_tail_t *tail, wifi_scan_publish_stats_t *stats)
+{
+    // The chunk is taken from wifi_scan_records, its columns fit the static ones
+    const char **essid = wifi_scan_columns.essid;
+    const char **mac = wifi_scan_columns.mac;
+    int32_t *channel = wifi_scan_columns.channel;
+    int32_t *rssi = wifi_scan_columns.rssi;
+    bool *connected = wifi_scan_columns.connected;
+    bool *removed = wifi_scan_columns.removed;
+    int32_t tail_channel[WIFI_SCAN_MAX_CHANNEL + 1];
+    int32_t tail_count[WIFI_SCAN_MAX_CHANNEL + 1];
+    int tail_len = 0;
+    for (int i = 0; tail && i <= WIFI_SCAN_MAX_CHANNEL; i++) {
+        if (tail->per_channel[i] > 0) {
+            tail_channel[tail_len] = i;
+            tail_count[tail_len] = tail->per_channel[i];
+            tail_len++;
+        }
+    }
+
+    for (int i = 0; i < ap_count; i++) {
+        format_mac_address(ap_info[i].bssid, wifi_scan_columns.mac_str[i]);
+        essid[i] = (const char *) ap_info[i].ssid;
+        mac[i] = wifi_scan_columns.mac_str[i];
+        channel[i] = ap_info[i].primary;
+        rssi[i] = ap_info[i].rssi;
+        connected[i] = connected_bssid && compare_mac_address(ap_info[i].bssid, connected_bssid);
+        removed[i] = i >= present_count;
+    }
+
+    astarte_bson_serializer_handle_t bs = astarte_bson_serializer_new();
+    astarte_bson_serializer_append_int32_array(bs, "channel", channel, ap_count);
+    astarte_bson_serializer_append_string_array(bs, "essid", essid, ap_count);
+    astarte_bson_serializer_append_string_array(bs, "macAddress", mac, ap_count);
+    astarte_bson_serializer_append_int32_array(bs, "rssi", rssi, ap_count);
+    astarte_bson_serializer_append_boolean_array(bs, "connected", connected, ap_count);
+    astarte_bson_serializer_append_boolean_array(bs, "removed", removed, ap_count);
+    astarte_bson_serializer_append_int32(bs, "scanDurationMillis", (int32_t) duration_ms);
+    astarte_bson_serializer_append_int32_array(bs, "omittedChannel", tail_channel, tail_len);
+    astarte_bson_serializer_append_int32_array(bs, "omittedCount", tail_count, tail_len);
+    astarte_bson_serializer_append_end_of_document(bs);
+
+    int doc_len = 0;
+    const void *doc = astarte_bson_serializer_get_document(bs, &doc_len);
+    if (timestamp_ms > 0) {
+        astarte_device_stream_aggregate_with_timestamp(edgehog_device->astarte_device,
+            wifi_scan_batch_interface.name, "/scan", doc, timestamp_ms, 0);
+    } else {
+        astarte_device_stream_aggregate(
+            edgehog_device->astarte_device, wifi_scan_batch_interface.name, "/scan", doc, 0);
+    }
+    stats->messages++;
+    stats->bytes += doc_len;
+    astarte_bson_serializer_destroy(bs);
+}
+#else
+static void publish_wifi_ap_record(edgehog_device_handle_t edgehog_device,
+    const wifi_ap_record_t *ap_info, const uint8_t *connected_bssid,
+    wifi_scan_publish_stats_t *stats)
+{
+    char mac[WIFI_MAC_STR_LEN];
+    format_mac_address(ap_info->bssid, mac);
+
+    astarte_bson_serializer_handle_t bs = astarte_bson_serializer_new();
+    astarte_bson_serializer_append_int32(bs, "channel", ap_info->primary);
+    astarte_bson_serializer_append_string(bs, "essid", (char *) ap_info->ssid);
+    astarte_bson_serializer_append_string(bs, "macAddress", mac);
+    astarte_bson_serializer_append_int32(bs, "rssi", ap_info->rssi);
+    astarte_bson_serializer_append_boolean(
+        bs, "connected", connected_bssid && compare_mac_address(ap_info->bssid, connected_bssid));
+    astarte_bson_serializer_append_end_of_document(bs);
+
+    int doc_len = 0;
+    const void *doc = astarte_bson_serializer_get_document(bs, &doc_len);
+    astarte_device_stream_aggregate(
+        edgehog_device->astarte_device, wifi_scan_result_interface.name, "/ap", doc, 0);
+    stats->messages++;
+    stats->bytes += doc_len;
+    astarte_bson_serializer_destroy(bs);
+}
+#endif
+
+#if CONFIG_EDGEHOG_WIFI_SCAN_DIFFERENTIAL
+static uint16_t filter_wifi_ap_changes(
+    wifi_ap_record_t *ap_info, uint16_t ap_count, uint16_t *present_count)
+{
+    bool full_snapshot = wifi_scan_count++ % CONFIG_EDGEHOG_WIFI_SCAN_FULL_SNAPSHOT_PERIOD == 0;
+
+    // Step 1 keep the access points that appeared or changed channel or RSSI bucket
+
+    uint16_t kept = 0;
+    for (uint16_t i = 0; i < ap_count; i++) {
+        // The offset keeps the bucket of negative RSSI values positive
+        uint8_t rssi_bucket = (ap_info[i].rssi + 128) / CONFIG_EDGEHOG_WIFI_SCAN_RSSI_BUCKET_DB;
+        wifi_scan_entry_t *entry = find_wifi_scan_entry(ap_info[i].bssid);
+        bool changed = !entry || entry->channel != ap_info[i].primary
+            || entry->rssi_bucket != rssi_bucket;
+        if (!entry && wifi_scan_table_len < CONFIG_EDGEHOG_WIFI_SCAN_TABLE_SIZE) {
+            entry = &wifi_scan_table[wifi_scan_table_len++];
+            memcpy(entry->bssid, ap_info[i].bssid, sizeof(entry->bssid));
+        }
+        // Access points that do not fit in the table are published at every scan
+        if (entry) {
+            entry->channel = ap_info[i].primary;
+            entry->rssi_bucket = rssi_bucket;
+            entry->seen = true;
+        }
+        if (changed || full_snapshot) {
+            ap_info[kept++] = ap_info[i];
+        }
+    }
+
+    // Step 2 append the access points that disappeared, flagged as removed by the caller
+
+    *present_count = kept;
+    for (uint16_t i = 0; i < wifi_scan_table_len;) {
+        if (wifi_scan_table[i].seen) {
+            i++;
+            continue;
+        }
+        memset(&ap_info[kept], 0, sizeof(wifi_ap_record_t));
+        memcpy(ap_info[kept].bssid, wifi_scan_table[i].bssid, sizeof(ap_info[kept].bssid));
+        ap_info[kept].primary = wifi_scan_table[i].channel;
+        kept++;
+        wifi_scan_table[i] = wifi_scan_table[--wifi_scan_table_len];
+    }
+    return kept;
+}
+
+static wifi_scan_entry_t *find_wifi_scan_entry(const uint8_t bssid[])
+{
+    for (uint16_t i = 0; i < wifi_scan_table_len; i++) {
+        if (compare_mac_address(wifi_scan_table[i].bssid, bssid)) {
+            return &wifi_scan_table[i];
+        }
+    }
+    return NULL;
+}
+#endif
+
+static void format_mac_address(const uint8_t mac[], char *out)
+{
+    snprintf(out, WIFI_MAC_STR_LEN, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2],
+        mac[3], mac[4], mac[5]);
+}
+
+static inline bool compare_mac_address(const uint8_t a[], const uint8_t b[])
+{
+    return memcmp(a, b, 6) == 0;
+}
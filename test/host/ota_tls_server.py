@@ -0,0 +1,240 @@
+#!/usr/bin/env python3
+#
+# This file is part of Edgehog.
+#
+# Copyright 2026 SECO Mind Srl
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#    http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# SPDX-License-Identifier: Apache-2.0
+#
+
+"""Stand-in HTTPS server of the OTA images, counting the full and the resumed TLS handshakes.
+
+The server answers the Range requests of the OTA download and can drop the first responses after
+a given number of bytes, so that the client retries from the received offset. At exit it prints the
+number of full and resumed handshakes and fails if there were more full handshakes than expected.
+
+Target test, with the certificate added to CONFIG_MBEDTLS_CUSTOM_CERTIFICATE_BUNDLE_PATH:
+
+    ota_tls_server.py --host 192.168.1.10 --image build/app.bin --drops 2 --requests 2 \\
+        --expect-full 1
+
+then send two OTA requests for https://192.168.1.10:8443/app.bin. With TLS session resumption the
+first connection is the only full handshake, the OTAPerformance records report the same counts.
+
+Host test, the client of the OTA download is emulated with the Python ssl module:
+
+    ota_tls_server.py --self-test
+"""
+
+import argparse
+import hashlib
+import http.client
+import http.server
+import os
+import socket
+import ssl
+import subprocess
+import sys
+import tempfile
+import threading
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.full = 0
+        self.resumed = 0
+        self.completed = 0
+        self.drops_left = 0
+        self.done = threading.Event()
+
+
+class OtaRequestHandler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def setup(self):
+        super().setup()
+        stats = self.server.stats
+        with stats.lock:
+            if self.request.session_reused:
+                stats.resumed += 1
+            else:
+                stats.full += 1
+
+    def do_GET(self):
+        image = self.server.image
+        first = 0
+        range_header = self.headers.get("Range")
+        if range_header and range_header.startswith("bytes="):
+            first = int(range_header[len("bytes=") :].split("-")[0])
+        if first >= len(image):
+            self.send_error(416)
+            return
+
+        if range_header:
+            self.send_response(206)
+            self.send_header("Content-Range", f"bytes {first}-{len(image) - 1}/{len(image)}")
+        else:
+            self.send_response(200)
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Length", str(len(image) - first))
+        self.end_headers()
+
+        stats = self.server.stats
+        with stats.lock:
+            drop = stats.drops_left > 0
+            if drop:
+                stats.drops_left -= 1
+        if drop:
+            # Close the connection in the middle of the body, the client retries with a Range
+            end = first + (len(image) - first) // 2
+            self.wfile.write(image[first:end])
+            self.close_connection = True
+            return
+
+        self.wfile.write(image[first:])
+        with stats.lock:
+            stats.completed += 1
+            if stats.completed >= self.server.requests:
+                stats.done.set()
+
+    def log_message(self, format, *args):
+        if self.server.verbose:
+            super().log_message(format, *args)
+
+
+def make_certificate(openssl, host, directory):
+    cert = os.path.join(directory, "ota_tls_server.crt")
+    key = os.path.join(directory, "ota_tls_server.key")
+    try:
+        socket.inet_pton(socket.AF_INET6 if ":" in host else socket.AF_INET, host)
+        san = f"IP:{host}"
+    except OSError:
+        san = f"DNS:{host}"
+    subprocess.run(
+        [openssl, "req", "-x509", "-newkey", "ec", "-pkeyopt", "ec_paramgen_curve:prime256v1",
+            "-nodes", "-days", "1", "-subj", f"/CN={host}", "-addext", f"subjectAltName={san}",
+            "-keyout", key, "-out", cert],
+        check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return cert, key
+
+
+def start_server(args, cert, key, image):
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(cert, key)
+    # The session tickets of mbedTLS clients are issued by TLS 1.2 servers
+    if not args.tls13:
+        context.maximum_version = ssl.TLSVersion.TLSv1_2
+
+    server = http.server.ThreadingHTTPServer((args.bind, args.port), OtaRequestHandler)
+    server.socket = context.wrap_socket(server.socket, server_side=True)
+    server.daemon_threads = True
+    server.image = image
+    server.requests = args.requests
+    server.verbose = args.verbose
+    server.stats = Stats()
+    server.stats.drops_left = args.drops
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server
+
+
+def download(host, port, context, path, session, image_size):
+    """Download the image as the OTA task does, retrying from the received offset."""
+    data = b""
+    while len(data) < image_size:
+        sock = socket.create_connection((host, port))
+        tls = context.wrap_socket(sock, server_hostname=host, session=session)
+        connection = http.client.HTTPConnection(host, port)
+        connection.sock = tls
+        headers = {"Range": f"bytes={len(data)}-"} if data else {}
+        connection.request("GET", path, headers=headers)
+        response = connection.getresponse()
+        try:
+            data += response.read()
+        except http.client.IncompleteRead as error:
+            data += error.partial
+        session = tls.session
+        connection.close()
+    return data, session
+
+
+def self_test(args, server, cert, image):
+    context = ssl.create_default_context(cafile=cert)
+    context.maximum_version = ssl.TLSVersion.TLSv1_2
+    port = server.server_address[1]
+    session = None
+    for _ in range(args.requests):
+        data, session = download(args.host, port, context, "/image.bin", session, len(image))
+        if hashlib.sha256(data).digest() != hashlib.sha256(image).digest():
+            print("Downloaded image does not match")
+            return False
+    return True
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="localhost", help="name or address in the certificate")
+    parser.add_argument("--bind", default="", help="address to listen on, all by default")
+    parser.add_argument("--port", type=int, default=8443)
+    parser.add_argument("--image", help="image to serve, random data by default")
+    parser.add_argument("--size", type=int, default=256 * 1024, help="size of the random image")
+    parser.add_argument("--cert", help="certificate, generated with --openssl by default")
+    parser.add_argument("--key", help="private key of the certificate")
+    parser.add_argument("--openssl", default="openssl", help="openssl executable")
+    parser.add_argument("--drops", type=int, default=2, help="responses dropped halfway")
+    parser.add_argument("--requests", type=int, default=2, help="downloads to serve")
+    parser.add_argument("--expect-full", type=int, default=1, help="maximum full handshakes")
+    parser.add_argument("--tls13", action="store_true", help="allow TLS 1.3")
+    parser.add_argument("--timeout", type=int, default=600, help="seconds to wait for downloads")
+    parser.add_argument("--self-test", action="store_true", help="download with a local client")
+    parser.add_argument("--verbose", action="store_true")
+    args = parser.parse_args()
+
+    if args.image:
+        with open(args.image, "rb") as image_file:
+            image = image_file.read()
+    else:
+        image = os.urandom(args.size)
+
+    with tempfile.TemporaryDirectory() as directory:
+        cert, key = args.cert, args.key
+        if not cert:
+            cert, key = make_certificate(args.openssl, args.host, directory)
+        if args.self_test:
+            args.bind, args.port = "127.0.0.1", 0
+        server = start_server(args, cert, key, image)
+        print(f"Serving {len(image)} bytes on port {server.server_address[1]}, certificate {cert}")
+        sys.stdout.flush()
+
+        if args.self_test:
+            ok = self_test(args, server, cert, image)
+        else:
+            ok = server.stats.done.wait(args.timeout)
+        server.shutdown()
+
+    stats = server.stats
+    print(f"Full handshakes: {stats.full}, resumed handshakes: {stats.resumed}, "
+        f"downloads: {stats.completed}")
+    if not ok or stats.completed < args.requests:
+        print("Downloads not completed")
+        return 1
+    if stats.full > args.expect_full:
+        print(f"Expected at most {args.expect_full} full handshakes")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
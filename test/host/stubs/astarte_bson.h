@@ -0,0 +1,49 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ASTARTE_BSON_H
+#define ASTARTE_BSON_H
+
+#include "astarte_bson_types.h"
+#include "astarte_device.h"
+
+typedef struct
+{
+    uint32_t size;
+    const uint8_t *list;
+} astarte_bson_document_t;
+
+// Requests are not parsed on the host, the deserializer finds no element
+astarte_bson_document_t astarte_bson_deserializer_element_to_document(
+    astarte_bson_element_t element);
+astarte_bson_document_t astarte_bson_deserializer_element_to_array(astarte_bson_element_t element);
+astarte_err_t astarte_bson_deserializer_element_lookup(
+    astarte_bson_document_t document, const char *key, astarte_bson_element_t *element);
+astarte_err_t astarte_bson_deserializer_first_element(
+    astarte_bson_document_t document, astarte_bson_element_t *element);
+astarte_err_t astarte_bson_deserializer_next_element(astarte_bson_document_t document,
+    astarte_bson_element_t element, astarte_bson_element_t *next);
+const char *astarte_bson_deserializer_element_to_string(
+    astarte_bson_element_t element, uint32_t *len);
+int32_t astarte_bson_deserializer_element_to_int32(astarte_bson_element_t element);
+int64_t astarte_bson_deserializer_element_to_int64(astarte_bson_element_t element);
+int64_t astarte_bson_deserializer_element_to_datetime(astarte_bson_element_t element);
+
+#endif // ASTARTE_BSON_H
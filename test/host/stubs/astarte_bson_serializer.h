@@ -0,0 +1,48 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ASTARTE_BSON_SERIALIZER_H
+#define ASTARTE_BSON_SERIALIZER_H
+
+#include "astarte.h"
+
+// The document is a list of fields instead of BSON, so that the tests can check the values
+typedef struct astarte_bson_serializer_t *astarte_bson_serializer_handle_t;
+
+astarte_bson_serializer_handle_t astarte_bson_serializer_new(void);
+void astarte_bson_serializer_destroy(astarte_bson_serializer_handle_t bs);
+const void *astarte_bson_serializer_get_document(astarte_bson_serializer_handle_t bs, int *size);
+void astarte_bson_serializer_append_end_of_document(astarte_bson_serializer_handle_t bs);
+void astarte_bson_serializer_append_double(
+    astarte_bson_serializer_handle_t bs, const char *name, double value);
+void astarte_bson_serializer_append_int32(
+    astarte_bson_serializer_handle_t bs, const char *name, int32_t value);
+void astarte_bson_serializer_append_int64(
+    astarte_bson_serializer_handle_t bs, const char *name, int64_t value);
+void astarte_bson_serializer_append_boolean(
+    astarte_bson_serializer_handle_t bs, const char *name, int value);
+void astarte_bson_serializer_append_string(
+    astarte_bson_serializer_handle_t bs, const char *name, const char *string);
+void astarte_bson_serializer_append_double_array(
+    astarte_bson_serializer_handle_t bs, const char *name, const double *arr, int count);
+void astarte_bson_serializer_append_datetime_array(
+    astarte_bson_serializer_handle_t bs, const char *name, const int64_t *arr, int count);
+
+#endif // ASTARTE_BSON_SERIALIZER_H
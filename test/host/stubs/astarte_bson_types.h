@@ -0,0 +1,35 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ASTARTE_BSON_TYPES_H
+#define ASTARTE_BSON_TYPES_H
+
+#include "astarte.h"
+
+#define BSON_TYPE_DOUBLE 0x01
+#define BSON_TYPE_STRING 0x02
+#define BSON_TYPE_DOCUMENT 0x03
+#define BSON_TYPE_ARRAY 0x04
+#define BSON_TYPE_BOOLEAN 0x08
+#define BSON_TYPE_DATETIME 0x09
+#define BSON_TYPE_INT32 0x10
+#define BSON_TYPE_INT64 0x12
+
+#endif // ASTARTE_BSON_TYPES_H
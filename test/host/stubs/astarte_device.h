@@ -0,0 +1,72 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ASTARTE_DEVICE_H
+#define ASTARTE_DEVICE_H
+
+#include "astarte.h"
+
+typedef struct astarte_device_t *astarte_device_handle_t;
+
+typedef enum
+{
+    OWNERSHIP_DEVICE = 1,
+    OWNERSHIP_SERVER,
+} astarte_interface_ownership_t;
+
+typedef enum
+{
+    TYPE_DATASTREAM = 1,
+    TYPE_PROPERTIES,
+} astarte_interface_type_t;
+
+typedef struct
+{
+    const char *name;
+    int major_version;
+    int minor_version;
+    astarte_interface_ownership_t ownership;
+    astarte_interface_type_t type;
+} astarte_interface_t;
+
+typedef struct
+{
+    uint8_t type;
+    const void *value;
+} astarte_bson_element_t;
+
+typedef struct
+{
+    astarte_device_handle_t device;
+    const char *interface_name;
+    const char *path;
+    astarte_bson_element_t bson_element;
+} astarte_device_data_event_t;
+
+bool astarte_device_is_connected(astarte_device_handle_t device);
+
+// The publishes are recorded, see host_stubs.h
+astarte_err_t astarte_device_stream_aggregate(astarte_device_handle_t device,
+    const char *interface_name, const char *path, const void *bson_document, int qos);
+astarte_err_t astarte_device_stream_aggregate_with_timestamp(astarte_device_handle_t device,
+    const char *interface_name, const char *path, const void *bson_document,
+    uint64_t ts_epoch_millis, int qos);
+
+#endif // ASTARTE_DEVICE_H
@@ -0,0 +1,51 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ASTARTE_LIST_H
+#define ASTARTE_LIST_H
+
+#include <stddef.h>
+
+typedef struct astarte_list_head_t
+{
+    struct astarte_list_head_t *next;
+    struct astarte_list_head_t *prev;
+} astarte_list_head_t;
+
+#define GET_LIST_ENTRY(item, type, member) ((type *) ((char *) (item) - offsetof(type, member)))
+#define LIST_FOR_EACH(item, head) for (item = (head)->next; item != (head); item = item->next)
+#define MUTABLE_LIST_FOR_EACH(item, tmp, head)                                                     \
+    for (item = (head)->next, tmp = item->next; item != (head); item = tmp, tmp = item->next)
+
+static inline void astarte_list_init(astarte_list_head_t *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static inline void astarte_list_append(astarte_list_head_t *head, astarte_list_head_t *item)
+{
+    item->prev = head->prev;
+    item->next = head;
+    head->prev->next = item;
+    head->prev = item;
+}
+
+#endif // ASTARTE_LIST_H
@@ -0,0 +1,47 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ESP_APP_FORMAT_H
+#define ESP_APP_FORMAT_H
+
+#include <stdint.h>
+
+#define ESP_IMAGE_HEADER_MAGIC 0xE9
+
+typedef struct
+{
+    uint32_t magic_word;
+    uint32_t secure_version;
+    uint32_t reserv1[2];
+    char version[32];
+    char project_name[32];
+    char time[16];
+    char date[16];
+    char idf_ver[32];
+    uint8_t app_elf_sha256[32];
+} esp_app_desc_t;
+
+typedef struct
+{
+    uint8_t magic;
+    uint8_t segment_count;
+} esp_image_header_t;
+
+#endif // ESP_APP_FORMAT_H
@@ -0,0 +1,95 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ESP_HTTP_CLIENT_H
+#define ESP_HTTP_CLIENT_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct esp_http_client *esp_http_client_handle_t;
+
+typedef enum
+{
+    HTTP_EVENT_ERROR = 0,
+    HTTP_EVENT_ON_CONNECTED,
+    HTTP_EVENT_HEADERS_SENT,
+    HTTP_EVENT_HEADER_SENT = HTTP_EVENT_HEADERS_SENT,
+    HTTP_EVENT_ON_HEADER,
+    HTTP_EVENT_ON_DATA,
+    HTTP_EVENT_ON_FINISH,
+    HTTP_EVENT_DISCONNECTED,
+    HTTP_EVENT_REDIRECT,
+} esp_http_client_event_id_t;
+
+typedef struct esp_http_client_event
+{
+    esp_http_client_event_id_t event_id;
+    esp_http_client_handle_t client;
+    void *data;
+    int data_len;
+    void *user_data;
+    char *header_key;
+    char *header_value;
+} esp_http_client_event_t;
+
+typedef esp_err_t (*http_event_handle_cb)(esp_http_client_event_t *evt);
+
+typedef enum
+{
+    HTTP_TRANSPORT_UNKNOWN = 0x0,
+    HTTP_TRANSPORT_OVER_TCP,
+    HTTP_TRANSPORT_OVER_SSL,
+} esp_http_client_transport_t;
+
+typedef struct
+{
+    const char *url;
+    int timeout_ms;
+    bool disable_auto_redirect;
+    http_event_handle_cb event_handler;
+    void *user_data;
+    int buffer_size; // 512 bytes when 0, as the buffer_size_tx
+    int buffer_size_tx;
+    bool keep_alive_enable;
+    esp_err_t (*crt_bundle_attach)(void *conf);
+    bool save_client_session;
+} esp_http_client_config_t;
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config);
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url);
+esp_err_t esp_http_client_get_url(esp_http_client_handle_t client, char *url, const int len);
+esp_err_t esp_http_client_set_header(
+    esp_http_client_handle_t client, const char *key, const char *value);
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key);
+esp_err_t esp_http_client_set_user_data(esp_http_client_handle_t client, void *data);
+esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t client);
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len);
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client);
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len);
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client);
+esp_http_client_transport_t esp_http_client_get_transport_type(esp_http_client_handle_t client);
+esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
+
+#endif // ESP_HTTP_CLIENT_H
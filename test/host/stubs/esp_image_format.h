@@ -0,0 +1,50 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ESP_IMAGE_FORMAT_H
+#define ESP_IMAGE_FORMAT_H
+
+#include "esp_app_format.h"
+#include "esp_err.h"
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t size;
+} esp_partition_pos_t;
+
+typedef struct
+{
+    uint32_t start_addr;
+    esp_image_header_t image;
+    uint32_t image_len;
+} esp_image_metadata_t;
+
+typedef enum
+{
+    ESP_IMAGE_VERIFY,
+    ESP_IMAGE_VERIFY_SILENT,
+    ESP_IMAGE_LOAD,
+} esp_image_load_mode_t;
+
+esp_err_t esp_image_verify(
+    esp_image_load_mode_t mode, const esp_partition_pos_t *part, esp_image_metadata_t *data);
+
+#endif // ESP_IMAGE_FORMAT_H
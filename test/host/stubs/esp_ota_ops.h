@@ -0,0 +1,47 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef ESP_OTA_OPS_H
+#define ESP_OTA_OPS_H
+
+#include "esp_app_format.h"
+#include "esp_partition.h"
+
+typedef enum
+{
+    ESP_OTA_IMG_NEW = 0x0,
+    ESP_OTA_IMG_PENDING_VERIFY = 0x1,
+    ESP_OTA_IMG_VALID = 0x2,
+    ESP_OTA_IMG_INVALID = 0x3,
+    ESP_OTA_IMG_ABORTED = 0x4,
+    ESP_OTA_IMG_UNDEFINED = 0xFFFFFFFF,
+} esp_ota_img_states_t;
+
+const esp_partition_t *esp_ota_get_running_partition(void);
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from);
+esp_err_t esp_ota_get_state_partition(
+    const esp_partition_t *partition, esp_ota_img_states_t *ota_state);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
+esp_err_t esp_ota_get_partition_description(
+    const esp_partition_t *partition, esp_app_desc_t *app_desc);
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void);
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void);
+
+#endif // ESP_OTA_OPS_H
@@ -0,0 +1,53 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+// Included by the ESP-IDF port
+#include "esp_system.h"
+#include "sdkconfig.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY ((TickType_t) 0xFFFFFFFF)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+
+// Critical sections exclude the other threads, as they exclude the other core on the ESP32
+typedef struct
+{
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { PTHREAD_MUTEX_INITIALIZER }
+#define portMUX_INITIALIZE(mux) pthread_mutex_init(&(mux)->mutex, NULL)
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(&(mux)->mutex)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(&(mux)->mutex)
+
+#endif // FREERTOS_H
@@ -0,0 +1,63 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FREERTOS_TASK_H
+#define FREERTOS_TASK_H
+
+#include "freertos/FreeRTOS.h"
+#include <limits.h>
+
+// Tasks run as host threads, only the functions used by the OTA module are provided
+typedef void (*TaskFunction_t)(void *arg);
+typedef struct host_task *TaskHandle_t;
+typedef uint8_t StackType_t;
+typedef struct
+{
+    uint8_t dummy[344]; // Size of the ESP32 control block
+} StaticTask_t;
+
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+#define tskIDLE_PRIORITY 0
+
+typedef enum
+{
+    eNoAction = 0,
+    eSetBits,
+    eIncrement,
+    eSetValueWithOverwrite,
+    eSetValueWithoutOverwrite,
+} eNotifyAction;
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *arg,
+    uint32_t priority, TaskHandle_t *created_task);
+TaskHandle_t xTaskCreateStatic(TaskFunction_t code, const char *name, uint32_t stack_depth,
+    void *arg, uint32_t priority, StackType_t *stack, StaticTask_t *tcb);
+TaskHandle_t xTaskGetHandle(const char *name);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+// The bits to clear are unsigned long, ULONG_MAX is 32 bits on the target
+BaseType_t xTaskNotifyWait(unsigned long clear_on_entry, unsigned long clear_on_exit,
+    uint32_t *value, TickType_t ticks_to_wait);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+
+#endif // FREERTOS_TASK_H
@@ -0,0 +1,36 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FREERTOS_TIMERS_H
+#define FREERTOS_TIMERS_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_timer *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, BaseType_t auto_reload, void *id,
+    TimerCallbackFunction_t callback);
+void *pvTimerGetTimerID(TimerHandle_t timer);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks_to_wait);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks_to_wait);
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t ticks_to_wait);
+
+#endif // FREERTOS_TIMERS_H
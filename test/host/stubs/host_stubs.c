@@ -0,0 +1,323 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "host_stubs.h"
+#include "astarte_bson_serializer.h"
+#include "driver/uart.h"
+#include "edgehog_device_private.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include <time.h>
+
+struct astarte_bson_serializer_t
+{
+    host_field_t fields[HOST_DOCUMENT_MAX_FIELDS];
+    int fields_len;
+};
+
+static pthread_mutex_t publish_lock = PTHREAD_MUTEX_INITIALIZER;
+static host_publish_t *publishes;
+static int publishes_len;
+static int publishes_capacity;
+static astarte_err_t publish_result = ASTARTE_OK;
+static void (*publish_hook)(void);
+static _Atomic int64_t time_offset_us;
+static _Atomic uint64_t epoch_ms = 1767225600000; // 2026-01-01
+
+/************************************************
+ *                   ESP-IDF                    *
+ ***********************************************/
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000 + time_offset_us;
+}
+
+void host_advance_time_us(int64_t us)
+{
+    time_offset_us += us;
+}
+
+void host_set_epoch_ms(uint64_t ms)
+{
+    epoch_ms = ms;
+}
+
+uint64_t edgehog_device_get_timestamp_ms(void)
+{
+    uint64_t epoch = epoch_ms;
+    return epoch > 0 ? epoch + esp_timer_get_time() / 1000 : 0;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+int uart_write_bytes(uart_port_t uart_num, const void *src, size_t size)
+{
+    return -1;
+}
+
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length, TickType_t ticks_to_wait)
+{
+    return -1;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    SemaphoreHandle_t semaphore = malloc(sizeof(pthread_mutex_t));
+    if (semaphore) {
+        pthread_mutex_init(semaphore, NULL);
+    }
+    return semaphore;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    pthread_mutex_destroy(semaphore);
+    free(semaphore);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    return pthread_mutex_lock(semaphore) == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return pthread_mutex_unlock(semaphore) == 0 ? pdTRUE : pdFALSE;
+}
+
+/************************************************
+ *             Astarte device SDK               *
+ ***********************************************/
+
+astarte_bson_serializer_handle_t astarte_bson_serializer_new(void)
+{
+    return calloc(1, sizeof(struct astarte_bson_serializer_t));
+}
+
+static void free_fields(host_field_t *fields, int len)
+{
+    for (int i = 0; i < len; i++) {
+        free(fields[i].string);
+        free(fields[i].numbers);
+        free(fields[i].integers);
+    }
+}
+
+void astarte_bson_serializer_destroy(astarte_bson_serializer_handle_t bs)
+{
+    free_fields(bs->fields, bs->fields_len);
+    free(bs);
+}
+
+const void *astarte_bson_serializer_get_document(astarte_bson_serializer_handle_t bs, int *size)
+{
+    if (size) {
+        *size = (int) sizeof(struct astarte_bson_serializer_t);
+    }
+    return bs;
+}
+
+void astarte_bson_serializer_append_end_of_document(astarte_bson_serializer_handle_t bs)
+{
+}
+
+static host_field_t *append_field(
+    astarte_bson_serializer_handle_t bs, const char *name, host_field_type_t type)
+{
+    HOST_CHECK(bs->fields_len < HOST_DOCUMENT_MAX_FIELDS);
+    host_field_t *field = &bs->fields[bs->fields_len++];
+    snprintf(field->name, sizeof(field->name), "%s", name);
+    field->type = type;
+    return field;
+}
+
+void astarte_bson_serializer_append_double(
+    astarte_bson_serializer_handle_t bs, const char *name, double value)
+{
+    append_field(bs, name, HOST_FIELD_DOUBLE)->number = value;
+}
+
+void astarte_bson_serializer_append_int32(
+    astarte_bson_serializer_handle_t bs, const char *name, int32_t value)
+{
+    append_field(bs, name, HOST_FIELD_INT64)->integer = value;
+}
+
+void astarte_bson_serializer_append_int64(
+    astarte_bson_serializer_handle_t bs, const char *name, int64_t value)
+{
+    append_field(bs, name, HOST_FIELD_INT64)->integer = value;
+}
+
+void astarte_bson_serializer_append_boolean(
+    astarte_bson_serializer_handle_t bs, const char *name, int value)
+{
+    append_field(bs, name, HOST_FIELD_INT64)->integer = value;
+}
+
+void astarte_bson_serializer_append_string(
+    astarte_bson_serializer_handle_t bs, const char *name, const char *string)
+{
+    append_field(bs, name, HOST_FIELD_STRING)->string = strdup(string);
+}
+
+void astarte_bson_serializer_append_double_array(
+    astarte_bson_serializer_handle_t bs, const char *name, const double *arr, int count)
+{
+    host_field_t *field = append_field(bs, name, HOST_FIELD_DOUBLE_ARRAY);
+    field->numbers = malloc(count * sizeof(double));
+    HOST_CHECK(field->numbers);
+    memcpy(field->numbers, arr, count * sizeof(double));
+    field->count = count;
+}
+
+void astarte_bson_serializer_append_datetime_array(
+    astarte_bson_serializer_handle_t bs, const char *name, const int64_t *arr, int count)
+{
+    host_field_t *field = append_field(bs, name, HOST_FIELD_INT64_ARRAY);
+    field->integers = malloc(count * sizeof(int64_t));
+    HOST_CHECK(field->integers);
+    memcpy(field->integers, arr, count * sizeof(int64_t));
+    field->count = count;
+}
+
+static host_field_t copy_field(const host_field_t *field)
+{
+    host_field_t copy = *field;
+    if (field->string) {
+        copy.string = strdup(field->string);
+    }
+    if (field->numbers) {
+        copy.numbers = malloc(field->count * sizeof(double));
+        HOST_CHECK(copy.numbers);
+        memcpy(copy.numbers, field->numbers, field->count * sizeof(double));
+    }
+    if (field->integers) {
+        copy.integers = malloc(field->count * sizeof(int64_t));
+        HOST_CHECK(copy.integers);
+        memcpy(copy.integers, field->integers, field->count * sizeof(int64_t));
+    }
+    return copy;
+}
+
+astarte_err_t astarte_device_stream_aggregate_with_timestamp(astarte_device_handle_t device,
+    const char *interface_name, const char *path, const void *bson_document,
+    uint64_t ts_epoch_millis, int qos)
+{
+    const struct astarte_bson_serializer_t *document = bson_document;
+
+    pthread_mutex_lock(&publish_lock);
+    astarte_err_t res = publish_result;
+    if (res == ASTARTE_OK) {
+        if (publishes_len == publishes_capacity) {
+            publishes_capacity = publishes_capacity ? 2 * publishes_capacity : 16;
+            publishes = realloc(publishes, publishes_capacity * sizeof(host_publish_t));
+            HOST_CHECK(publishes);
+        }
+        host_publish_t *publish = &publishes[publishes_len++];
+        memset(publish, 0, sizeof(host_publish_t));
+        snprintf(publish->interface_name, sizeof(publish->interface_name), "%s", interface_name);
+        snprintf(publish->path, sizeof(publish->path), "%s", path);
+        publish->timestamp_ms = ts_epoch_millis;
+        for (int i = 0; i < document->fields_len; i++) {
+            publish->fields[i] = copy_field(&document->fields[i]);
+        }
+        publish->fields_len = document->fields_len;
+    }
+    void (*hook)(void) = res == ASTARTE_OK ? publish_hook : NULL;
+    pthread_mutex_unlock(&publish_lock);
+    if (hook) {
+        hook();
+    }
+    return res;
+}
+
+astarte_err_t astarte_device_stream_aggregate(astarte_device_handle_t device,
+    const char *interface_name, const char *path, const void *bson_document, int qos)
+{
+    return astarte_device_stream_aggregate_with_timestamp(
+        device, interface_name, path, bson_document, 0, qos);
+}
+
+/************************************************
+ *                Test controls                 *
+ ***********************************************/
+
+void host_set_publish_result(astarte_err_t res)
+{
+    pthread_mutex_lock(&publish_lock);
+    publish_result = res;
+    pthread_mutex_unlock(&publish_lock);
+}
+
+void host_set_publish_hook(void (*hook)(void))
+{
+    pthread_mutex_lock(&publish_lock);
+    publish_hook = hook;
+    pthread_mutex_unlock(&publish_lock);
+}
+
+int host_publish_count(void)
+{
+    pthread_mutex_lock(&publish_lock);
+    int len = publishes_len;
+    pthread_mutex_unlock(&publish_lock);
+    return len;
+}
+
+const host_publish_t *host_publish_get(int index)
+{
+    HOST_CHECK(index >= 0 && index < host_publish_count());
+    return &publishes[index];
+}
+
+const host_field_t *host_publish_field(const host_publish_t *publish, const char *name)
+{
+    for (int i = 0; i < publish->fields_len; i++) {
+        if (strcmp(publish->fields[i].name, name) == 0) {
+            return &publish->fields[i];
+        }
+    }
+    return NULL;
+}
+
+void host_publish_reset(void)
+{
+    pthread_mutex_lock(&publish_lock);
+    for (int i = 0; i < publishes_len; i++) {
+        free_fields(publishes[i].fields, publishes[i].fields_len);
+    }
+    publishes_len = 0;
+    pthread_mutex_unlock(&publish_lock);
+}
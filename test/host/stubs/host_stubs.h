@@ -0,0 +1,121 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/**
+ * @file host_stubs.h
+ * @brief Controls of the host stubs of ESP-IDF and of the Astarte device SDK.
+ */
+
+#ifndef HOST_STUBS_H
+#define HOST_STUBS_H
+
+#include "astarte_device.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#define HOST_FIELD_NAME_MAX_LEN 32
+#define HOST_DOCUMENT_MAX_FIELDS 16
+
+typedef enum
+{
+    HOST_FIELD_DOUBLE,
+    HOST_FIELD_INT64,
+    HOST_FIELD_STRING,
+    HOST_FIELD_DOUBLE_ARRAY,
+    HOST_FIELD_INT64_ARRAY,
+} host_field_type_t;
+
+typedef struct
+{
+    char name[HOST_FIELD_NAME_MAX_LEN];
+    host_field_type_t type;
+    double number; // HOST_FIELD_DOUBLE
+    int64_t integer; // HOST_FIELD_INT64, also booleans and datetimes
+    char *string; // HOST_FIELD_STRING
+    double *numbers; // HOST_FIELD_DOUBLE_ARRAY
+    int64_t *integers; // HOST_FIELD_INT64_ARRAY, also booleans and datetimes
+    int count; // Array length
+} host_field_t;
+
+typedef struct
+{
+    char interface_name[64];
+    char path[64];
+    uint64_t timestamp_ms; // 0 when published without timestamp
+    host_field_t fields[HOST_DOCUMENT_MAX_FIELDS];
+    int fields_len;
+} host_publish_t;
+
+/**
+ * @brief move the time returned by esp_timer_get_time forward.
+ */
+void host_advance_time_us(int64_t us);
+
+/**
+ * @brief set the epoch returned by edgehog_device_get_timestamp_ms, 0 for an invalid clock.
+ *
+ * @details The timestamp advances with esp_timer_get_time.
+ */
+void host_set_epoch_ms(uint64_t epoch_ms);
+
+/**
+ * @brief set the result of the next publishes, ASTARTE_OK by default.
+ *
+ * @details Failed publishes are not recorded.
+ */
+void host_set_publish_result(astarte_err_t res);
+
+/**
+ * @brief set a function called after each recorded publish, NULL for none.
+ *
+ * @details The function is called by the publishing task, as an update of another task that runs
+ * while the publish is in progress.
+ */
+void host_set_publish_hook(void (*hook)(void));
+
+/**
+ * @brief get the number of recorded publishes.
+ */
+int host_publish_count(void);
+
+/**
+ * @brief get a recorded publish.
+ */
+const host_publish_t *host_publish_get(int index);
+
+/**
+ * @brief get a field of a recorded publish, NULL if it is missing.
+ */
+const host_field_t *host_publish_field(const host_publish_t *publish, const char *name);
+
+/**
+ * @brief forget the recorded publishes.
+ */
+void host_publish_reset(void);
+
+#define HOST_CHECK(cond)                                                                           \
+    do {                                                                                           \
+        if (!(cond)) {                                                                             \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);               \
+            exit(1);                                                                               \
+        }                                                                                          \
+    } while (0)
+
+#endif // HOST_STUBS_H
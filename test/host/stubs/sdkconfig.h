@@ -0,0 +1,95 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Host configuration of the component, the Kconfig defaults. Tests enable the optional modules and
+ * change the values through compile definitions.
+ */
+
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+#ifndef CONFIG_EDGEHOG_BATTERY_SLOTS
+#define CONFIG_EDGEHOG_BATTERY_SLOTS 8
+#endif
+#ifndef CONFIG_EDGEHOG_BATTERY_SLOT_NAME_MAX_LEN
+#define CONFIG_EDGEHOG_BATTERY_SLOT_NAME_MAX_LEN 32
+#endif
+#ifndef CONFIG_EDGEHOG_BATTERY_ANALYTICS_WINDOW
+#define CONFIG_EDGEHOG_BATTERY_ANALYTICS_WINDOW 30
+#endif
+#ifndef CONFIG_EDGEHOG_BATTERY_ANALYTICS_SAMPLE_INTERVAL_S
+#define CONFIG_EDGEHOG_BATTERY_ANALYTICS_SAMPLE_INTERVAL_S 60
+#endif
+#ifndef CONFIG_EDGEHOG_GEOLOCATION_MIN_DISTANCE_M
+#define CONFIG_EDGEHOG_GEOLOCATION_MIN_DISTANCE_M 0
+#endif
+#ifndef CONFIG_EDGEHOG_GEOLOCATION_MIN_HEADING_DEG
+#define CONFIG_EDGEHOG_GEOLOCATION_MIN_HEADING_DEG 0
+#endif
+#ifndef CONFIG_EDGEHOG_GEOLOCATION_MIN_SPEED_CHANGE_CM_S
+#define CONFIG_EDGEHOG_GEOLOCATION_MIN_SPEED_CHANGE_CM_S 0
+#endif
+#ifndef CONFIG_EDGEHOG_GEOLOCATION_HEARTBEAT_S
+#define CONFIG_EDGEHOG_GEOLOCATION_HEARTBEAT_S 0
+#endif
+#ifndef CONFIG_EDGEHOG_GEOLOCATION_TRACK_SIZE
+#define CONFIG_EDGEHOG_GEOLOCATION_TRACK_SIZE 64
+#endif
+#ifndef CONFIG_EDGEHOG_GEOLOCATION_TRACK_TOLERANCE_M
+#define CONFIG_EDGEHOG_GEOLOCATION_TRACK_TOLERANCE_M 5
+#endif
+#ifndef CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE
+#define CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE 0
+#endif
+#ifndef CONFIG_EDGEHOG_OTA_PROGRESS_MIN_INTERVAL_MS
+#define CONFIG_EDGEHOG_OTA_PROGRESS_MIN_INTERVAL_MS 5000
+#endif
+#ifndef CONFIG_EDGEHOG_OTA_PROGRESS_MIN_BYTES
+#define CONFIG_EDGEHOG_OTA_PROGRESS_MIN_BYTES 16384
+#endif
+#ifndef CONFIG_EDGEHOG_OTA_HEALTH_CHECK_TIMEOUT_S
+#define CONFIG_EDGEHOG_OTA_HEALTH_CHECK_TIMEOUT_S 300
+#endif
+#ifndef CONFIG_EDGEHOG_OTA_REBOOT_DRAIN_TIMEOUT_MS
+#define CONFIG_EDGEHOG_OTA_REBOOT_DRAIN_TIMEOUT_MS 5000
+#endif
+#ifndef CONFIG_EDGEHOG_OTA_JOURNAL_INTERVAL_BYTES
+#define CONFIG_EDGEHOG_OTA_JOURNAL_INTERVAL_BYTES 65536
+#endif
+#ifndef CONFIG_EDGEHOG_OTA_TASK_STACK_SIZE
+#define CONFIG_EDGEHOG_OTA_TASK_STACK_SIZE 4096
+#endif
+#ifndef CONFIG_EDGEHOG_OTA_STATIC_STRINGS_SIZE
+#define CONFIG_EDGEHOG_OTA_STATIC_STRINGS_SIZE 2048
+#endif
+#ifndef CONFIG_EDGEHOG_OTA_FAILOVER_MIN_BYTES_PER_SEC
+#define CONFIG_EDGEHOG_OTA_FAILOVER_MIN_BYTES_PER_SEC 0
+#endif
+
+// ESP-IDF options
+#ifndef CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN
+#define CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN 16384
+#endif
+#ifndef CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN
+#define CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN 4096
+#endif
+
+#endif // SDKCONFIG_H
@@ -0,0 +1,198 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Battery analytics: rate, time to empty or full and charge cycles estimated from simulated charge
+ * and discharge runs.
+ */
+
+#include "edgehog_battery_status.h"
+#include "edgehog_device_private.h"
+#include "host_stubs.h"
+#include <math.h>
+
+#define SAMPLE_INTERVAL_US ((int64_t) CONFIG_EDGEHOG_BATTERY_ANALYTICS_SAMPLE_INTERVAL_S * 1000000)
+#define SAMPLES_PER_HOUR (3600.0 / CONFIG_EDGEHOG_BATTERY_ANALYTICS_SAMPLE_INTERVAL_S)
+#define WINDOW_S                                                                                   \
+    ((CONFIG_EDGEHOG_BATTERY_ANALYTICS_WINDOW - 1)                                                 \
+        * CONFIG_EDGEHOG_BATTERY_ANALYTICS_SAMPLE_INTERVAL_S)
+
+typedef struct
+{
+    double rate;
+    int64_t time_to_empty_s;
+    int64_t time_to_full_s;
+    double cycles;
+    int64_t window_s;
+} analytics_t;
+
+static struct edgehog_device_t device;
+
+static void update(double level, edgehog_battery_state state)
+{
+    edgehog_battery_status_t status = {
+        .battery_slot = "main",
+        .level_percentage = level,
+        .level_absolute_error = 0.5,
+        .battery_state = state,
+    };
+    edgehog_battery_status_update(&device, &status);
+}
+
+// Samples a run at the sample interval, returns the last level
+static double run(double level, double rate_per_hour, int samples, edgehog_battery_state state)
+{
+    for (int i = 0; i < samples; i++) {
+        host_advance_time_us(SAMPLE_INTERVAL_US);
+        level += rate_per_hour / SAMPLES_PER_HOUR;
+        update(level, state);
+    }
+    return level;
+}
+
+static bool publish(analytics_t *analytics)
+{
+    host_publish_reset();
+    edgehog_battery_status_publish_analytics(&device);
+    if (host_publish_count() == 0) {
+        return false;
+    }
+
+    HOST_CHECK(host_publish_count() == 1);
+    const host_publish_t *publish = host_publish_get(0);
+    HOST_CHECK(strcmp(publish->interface_name, "io.edgehog.devicemanager.BatteryAnalytics") == 0);
+    HOST_CHECK(strcmp(publish->path, "/main") == 0);
+    analytics->rate = host_publish_field(publish, "ratePercentPerHour")->number;
+    analytics->time_to_empty_s = host_publish_field(publish, "timeToEmptySeconds")->integer;
+    analytics->time_to_full_s = host_publish_field(publish, "timeToFullSeconds")->integer;
+    analytics->cycles = host_publish_field(publish, "chargeCycles")->number;
+    analytics->window_s = host_publish_field(publish, "windowSeconds")->integer;
+    host_publish_reset();
+    return true;
+}
+
+static void test_discharge(void)
+{
+    analytics_t analytics;
+    update(80, BATTERY_DISCHARGING);
+    HOST_CHECK(!publish(&analytics));
+
+    // 10% per hour, the window is full
+    double level = run(80, -10, CONFIG_EDGEHOG_BATTERY_ANALYTICS_WINDOW - 1, BATTERY_DISCHARGING);
+    HOST_CHECK(publish(&analytics));
+    HOST_CHECK(fabs(analytics.rate + 10) < 0.01);
+    HOST_CHECK(llabs(analytics.time_to_empty_s - llround(level * 360)) <= 5);
+    HOST_CHECK(analytics.time_to_full_s == -1);
+    HOST_CHECK(analytics.window_s == WINDOW_S);
+    HOST_CHECK(fabs(analytics.cycles - (80 - level) / 100) < 1e-4);
+
+    // Updates between samples are ignored, the oldest samples leave the window
+    host_advance_time_us(SAMPLE_INTERVAL_US / 2);
+    update(level - 20, BATTERY_DISCHARGING);
+    level = run(level, -20, CONFIG_EDGEHOG_BATTERY_ANALYTICS_WINDOW, BATTERY_DISCHARGING);
+    HOST_CHECK(publish(&analytics));
+    HOST_CHECK(fabs(analytics.rate + 20) < 0.01);
+    HOST_CHECK(llabs(analytics.time_to_empty_s - llround(level * 180)) <= 5);
+    HOST_CHECK(analytics.window_s == WINDOW_S);
+    printf("discharge: %.3f %%/h, %lld s to empty, %.4f cycles\n", analytics.rate,
+        (long long) analytics.time_to_empty_s, analytics.cycles);
+}
+
+static void test_charge(void)
+{
+    // The window restarts when the state changes
+    analytics_t analytics;
+    update(20, BATTERY_CHARGING);
+    HOST_CHECK(!publish(&analytics));
+
+    double level = run(20, 30, 10, BATTERY_CHARGING);
+    HOST_CHECK(publish(&analytics));
+    HOST_CHECK(fabs(analytics.rate - 30) < 0.01);
+    HOST_CHECK(analytics.time_to_empty_s == -1);
+    HOST_CHECK(llabs(analytics.time_to_full_s - llround((100 - level) * 120)) <= 5);
+    HOST_CHECK(analytics.window_s == 10 * CONFIG_EDGEHOG_BATTERY_ANALYTICS_SAMPLE_INTERVAL_S);
+    printf("charge: %.3f %%/h, %lld s to full\n", analytics.rate,
+        (long long) analytics.time_to_full_s);
+}
+
+static void test_noisy_cycles(void)
+{
+    // Full cycles sampled with a noisy level
+    analytics_t analytics;
+    HOST_CHECK(publish(&analytics));
+    double cycles = analytics.cycles;
+    uint32_t noise = 7;
+    for (int cycle = 0; cycle < 2; cycle++) {
+        for (int i = 0; i <= 200; i++) {
+            noise = noise * 1664525 + 1013904223;
+            double level = fmin(fmax(100 - i / 2.0 + ((noise >> 8) % 100) / 200.0, 0), 100);
+            host_advance_time_us(SAMPLE_INTERVAL_US);
+            update(level, BATTERY_DISCHARGING);
+        }
+        run(0, 50, 200, BATTERY_CHARGING);
+    }
+
+    HOST_CHECK(publish(&analytics));
+    HOST_CHECK(analytics.rate > 0);
+    // The noise adds to the discharged level, but less than a cycle
+    printf("cycles: %.3f counted over 2 noisy cycles\n", analytics.cycles - cycles);
+    HOST_CHECK(analytics.cycles - cycles >= 2 && analytics.cycles - cycles < 3);
+}
+
+static void test_slope_against_state(void)
+{
+    // A level rising while discharging has no estimate
+    analytics_t analytics;
+    update(60, BATTERY_DISCHARGING);
+    run(60, 5, 10, BATTERY_DISCHARGING);
+    HOST_CHECK(publish(&analytics));
+    HOST_CHECK(fabs(analytics.rate - 5) < 0.01);
+    HOST_CHECK(analytics.time_to_empty_s == -1);
+    HOST_CHECK(analytics.time_to_full_s == -1);
+
+    // A level falling while charging has no estimate
+    update(70, BATTERY_CHARGING);
+    run(70, -5, 10, BATTERY_CHARGING);
+    HOST_CHECK(publish(&analytics));
+    HOST_CHECK(fabs(analytics.rate + 5) < 0.01);
+    HOST_CHECK(analytics.time_to_empty_s == -1);
+    HOST_CHECK(analytics.time_to_full_s == -1);
+
+    // Nor has an idle battery
+    update(70, BATTERY_IDLE);
+    run(70, -1, 10, BATTERY_IDLE);
+    HOST_CHECK(publish(&analytics));
+    HOST_CHECK(analytics.time_to_empty_s == -1);
+    HOST_CHECK(analytics.time_to_full_s == -1);
+}
+
+int main(void)
+{
+    device.battery_table = edgehog_battery_status_table_new();
+    HOST_CHECK(device.battery_table);
+
+    test_discharge();
+    test_charge();
+    test_noisy_cycles();
+    test_slope_against_state();
+
+    edgehog_battery_status_table_destroy(device.battery_table);
+    return 0;
+}
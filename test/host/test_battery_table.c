@@ -0,0 +1,169 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Battery slot table: functional checks and a microbenchmark of the update path, whose cost should
+ * not depend on the number of slots in use.
+ */
+
+#include "edgehog_battery_status.h"
+#include "edgehog_device_private.h"
+#include "host_stubs.h"
+#include <esp_timer.h>
+
+#define BENCHMARK_UPDATES 2000000
+#define BENCHMARK_SLOTS 16
+
+static struct edgehog_device_t device;
+
+static void update(const char *slot, double level, edgehog_battery_state state)
+{
+    edgehog_battery_status_t status = {
+        .battery_slot = slot,
+        .level_percentage = level,
+        .level_absolute_error = 0.5,
+        .battery_state = state,
+    };
+    edgehog_battery_status_update(&device, &status);
+}
+
+static void check_level(int index, const char *path, double level, const char *status)
+{
+    const host_publish_t *publish = host_publish_get(index);
+    HOST_CHECK(strcmp(publish->interface_name, "io.edgehog.devicemanager.BatteryStatus") == 0);
+    HOST_CHECK(strcmp(publish->path, path) == 0);
+    HOST_CHECK(host_publish_field(publish, "levelPercentage")->number == level);
+    HOST_CHECK(host_publish_field(publish, "levelAbsoluteError")->number == 0.5);
+    HOST_CHECK(strcmp(host_publish_field(publish, "status")->string, status) == 0);
+}
+
+static void test_latest_update_published(void)
+{
+    host_publish_reset();
+    update("main", 50, BATTERY_DISCHARGING);
+    update("main", 49.5, BATTERY_DISCHARGING);
+    update("main", 49, BATTERY_DISCHARGING);
+    edgehog_battery_status_publish(&device);
+
+    // The replaced updates are published first when they are kept
+    int expected = CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE >= 2 ? 3 : 1;
+    HOST_CHECK(host_publish_count() == expected);
+    for (int i = 0; i < expected; i++) {
+        check_level(i, "/main", 49 + 0.5 * (expected - 1 - i), "Discharging");
+        HOST_CHECK(host_publish_get(i)->timestamp_ms > 0);
+    }
+
+    // Nothing changed since the last publish
+    edgehog_battery_status_publish(&device);
+    update("main", 49, BATTERY_DISCHARGING);
+    edgehog_battery_status_publish(&device);
+    HOST_CHECK(host_publish_count() == expected);
+}
+
+static void test_failed_publish_retried(void)
+{
+    host_publish_reset();
+    update("main", 48, BATTERY_DISCHARGING);
+    host_set_publish_result(ASTARTE_ERR);
+    edgehog_battery_status_publish(&device);
+    host_set_publish_result(ASTARTE_OK);
+    HOST_CHECK(host_publish_count() == 0);
+
+    edgehog_battery_status_publish(&device);
+    HOST_CHECK(host_publish_count() == 1);
+    check_level(0, "/main", 48, "Discharging");
+}
+
+static void test_invalid_clock(void)
+{
+    host_publish_reset();
+    host_set_epoch_ms(0);
+    update("main", 100, BATTERY_IDLE);
+    host_set_epoch_ms(1767225600000);
+    edgehog_battery_status_publish(&device);
+    HOST_CHECK(host_publish_count() == 1);
+    check_level(0, "/main", 100, "Idle");
+    HOST_CHECK(host_publish_get(0)->timestamp_ms == 0);
+}
+
+static void test_capacity(void)
+{
+    char name[CONFIG_EDGEHOG_BATTERY_SLOT_NAME_MAX_LEN + 2];
+    memset(name, 'x', sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    update(name, 10, BATTERY_CHARGING);
+
+    // The "main" slot is already in use
+    for (int i = 1; i <= CONFIG_EDGEHOG_BATTERY_SLOTS; i++) {
+        snprintf(name, sizeof(name), "cell%d", i);
+        update(name, i, BATTERY_CHARGING);
+    }
+    host_publish_reset();
+    edgehog_battery_status_publish(&device);
+    HOST_CHECK(host_publish_count() == CONFIG_EDGEHOG_BATTERY_SLOTS - 1);
+    for (int i = 1; i < CONFIG_EDGEHOG_BATTERY_SLOTS; i++) {
+        snprintf(name, sizeof(name), "/cell%d", i);
+        check_level(i - 1, name, i, "Charging");
+    }
+}
+
+static int64_t benchmark_update(int slots)
+{
+    edgehog_battery_table_t *battery_table = device.battery_table;
+    device.battery_table = edgehog_battery_status_table_new();
+    HOST_CHECK(device.battery_table);
+
+    char names[BENCHMARK_SLOTS][16];
+    for (int i = 0; i < slots; i++) {
+        snprintf(names[i], sizeof(names[i]), "pack/cell%02d", i);
+    }
+
+    // Every update changes the level, as a cell sampled at a high rate does
+    int64_t start_us = esp_timer_get_time();
+    for (int i = 0; i < BENCHMARK_UPDATES; i++) {
+        update(names[i % slots], (i / slots) % 2 ? 80 : 79.5, BATTERY_DISCHARGING);
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+
+    edgehog_battery_status_table_destroy(device.battery_table);
+    device.battery_table = battery_table;
+    return elapsed_us;
+}
+
+int main(void)
+{
+    device.battery_table = edgehog_battery_status_table_new();
+    HOST_CHECK(device.battery_table);
+
+    test_latest_update_published();
+    test_failed_publish_retried();
+    test_invalid_clock();
+    test_capacity();
+
+    int64_t one_slot_us = benchmark_update(1);
+    int64_t all_slots_us = benchmark_update(BENCHMARK_SLOTS);
+    printf("%d updates: %.1f ns per update with 1 slot, %.1f ns with %d slots\n",
+        BENCHMARK_UPDATES, one_slot_us * 1000.0 / BENCHMARK_UPDATES,
+        all_slots_us * 1000.0 / BENCHMARK_UPDATES, BENCHMARK_SLOTS);
+
+    edgehog_battery_status_table_destroy(device.battery_table);
+    host_publish_reset();
+    return 0;
+}
@@ -0,0 +1,321 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Geolocation tracks: checks of the publishes and a benchmark replaying a GPS trace, either a
+ * recorded one passed as CSV file (timestamp in ms, latitude, longitude per line) or a synthetic
+ * drive. The replayed fixes must be within the simplification tolerance of the published track.
+ */
+
+#include "edgehog_device_private.h"
+#include "edgehog_geolocation.h"
+#include "edgehog_geolocation_p.h"
+#include "host_stubs.h"
+#include <esp_timer.h>
+#include <math.h>
+#include <time.h>
+
+#define EARTH_MEAN_RADIUS_M 6371008.8
+#define DEG_TO_RAD(deg) ((deg) * (M_PI / 180.0))
+#define TRACK_INTERFACE "io.edgehog.devicemanager.GeolocationTrack"
+#define GEOLOCATION_INTERFACE "io.edgehog.devicemanager.Geolocation"
+#define SYNTHETIC_TRACE_S 7200
+#define PUBLISH_PERIOD_FIXES 30
+#define TIMESTAMP_TOLERANCE_MS 100
+
+typedef struct
+{
+    int64_t timestamp_ms;
+    double latitude;
+    double longitude;
+} fix_t;
+
+typedef struct
+{
+    fix_t *fixes;
+    int len;
+    int capacity;
+} trace_t;
+
+static struct edgehog_device_t device;
+
+static int64_t now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+static void trace_append(trace_t *trace, int64_t timestamp_ms, double latitude, double longitude)
+{
+    if (trace->len == trace->capacity) {
+        trace->capacity = trace->capacity ? 2 * trace->capacity : 1024;
+        trace->fixes = realloc(trace->fixes, trace->capacity * sizeof(fix_t));
+        HOST_CHECK(trace->fixes);
+    }
+    trace->fixes[trace->len++] = (fix_t) { timestamp_ms, latitude, longitude };
+}
+
+static void load_trace(trace_t *trace, const char *file_name)
+{
+    FILE *file = fopen(file_name, "r");
+    HOST_CHECK(file);
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        long long timestamp_ms;
+        double latitude;
+        double longitude;
+        if (sscanf(line, "%lld,%lf,%lf", &timestamp_ms, &latitude, &longitude) == 3) {
+            trace_append(trace, timestamp_ms, latitude, longitude);
+        }
+    }
+    fclose(file);
+}
+
+static double noise_m(uint32_t *state)
+{
+    // Sum of uniform values, about normal with 1 m standard deviation
+    double sum = 0;
+    for (int i = 0; i < 4; i++) {
+        *state = *state * 1664525 + 1013904223;
+        sum += (*state >> 8) / (double) (1 << 24) - 0.5;
+    }
+    return sum * sqrt(3);
+}
+
+static void generate_trace(trace_t *trace)
+{
+    // A drive at 1 Hz repeating straight roads, bends, a roundabout and a stop at the lights
+    static const struct
+    {
+        int duration_s;
+        double speed_m_s;
+        double turn_deg_s;
+    } legs[] = { { 240, 14, 0 }, { 30, 10, 3 }, { 420, 25, 0 }, { 60, 20, 0.5 }, { 40, 8, 9 },
+        { 90, 0, 0 }, { 180, 12, -1 }, { 300, 30, 0 } };
+    uint32_t noise = 42;
+    double north_m = 0;
+    double east_m = 0;
+    double heading_deg = 30;
+    int64_t timestamp_ms = 1767225600000;
+    for (int s = 0, leg = 0, leg_s = 0; s < SYNTHETIC_TRACE_S; s++, leg_s++) {
+        if (leg_s == legs[leg].duration_s) {
+            leg = (leg + 1) % (sizeof(legs) / sizeof(legs[0]));
+            leg_s = 0;
+        }
+        heading_deg += legs[leg].turn_deg_s;
+        north_m += legs[leg].speed_m_s * cos(DEG_TO_RAD(heading_deg));
+        east_m += legs[leg].speed_m_s * sin(DEG_TO_RAD(heading_deg));
+        double latitude = 45.07 + (north_m + noise_m(&noise)) / EARTH_MEAN_RADIUS_M * 180 / M_PI;
+        double longitude = 7.68
+            + (east_m + noise_m(&noise)) / (EARTH_MEAN_RADIUS_M * cos(DEG_TO_RAD(45.07))) * 180
+                / M_PI;
+        trace_append(trace, timestamp_ms + s * 1000, latitude, longitude);
+    }
+}
+
+static void update(const char *id, const fix_t *fix)
+{
+    // The fix is timestamped with the time of the trace
+    host_set_epoch_ms(fix->timestamp_ms - esp_timer_get_time() / 1000);
+    edgehog_geolocation_data_t data = {
+        .id = id,
+        .latitude = fix->latitude,
+        .longitude = fix->longitude,
+        .accuracy = 3,
+    };
+    edgehog_geolocation_update(&device, &data);
+}
+
+static int count_publishes(const char *interface_name, const char *path)
+{
+    int count = 0;
+    for (int i = 0; i < host_publish_count(); i++) {
+        const host_publish_t *publish = host_publish_get(i);
+        if (strcmp(publish->interface_name, interface_name) == 0
+            && strcmp(publish->path, path) == 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Appends the published track fixes to the trace
+static void collect_track(trace_t *published, const char *path)
+{
+    for (int i = 0; i < host_publish_count(); i++) {
+        const host_publish_t *publish = host_publish_get(i);
+        if (strcmp(publish->interface_name, TRACK_INTERFACE) != 0
+            || strcmp(publish->path, path) != 0) {
+            continue;
+        }
+        const host_field_t *latitude = host_publish_field(publish, "latitude");
+        const host_field_t *longitude = host_publish_field(publish, "longitude");
+        const host_field_t *timestamp = host_publish_field(publish, "timestamp");
+        HOST_CHECK(latitude && longitude && timestamp);
+        HOST_CHECK(latitude->count == longitude->count && latitude->count == timestamp->count);
+        for (int j = 0; j < latitude->count; j++) {
+            trace_append(published, timestamp->integers[j], latitude->numbers[j],
+                longitude->numbers[j]);
+        }
+    }
+    host_publish_reset();
+}
+
+static double segment_distance_m(const fix_t *point, const fix_t *first, const fix_t *last)
+{
+    double scale_x = EARTH_MEAN_RADIUS_M * cos(DEG_TO_RAD(first->latitude));
+    double last_x = DEG_TO_RAD(last->longitude - first->longitude) * scale_x;
+    double last_y = DEG_TO_RAD(last->latitude - first->latitude) * EARTH_MEAN_RADIUS_M;
+    double point_x = DEG_TO_RAD(point->longitude - first->longitude) * scale_x;
+    double point_y = DEG_TO_RAD(point->latitude - first->latitude) * EARTH_MEAN_RADIUS_M;
+    double length_squared = last_x * last_x + last_y * last_y;
+    double t = length_squared > 0 ? (point_x * last_x + point_y * last_y) / length_squared : 0;
+    t = fmin(fmax(t, 0), 1);
+    return hypot(point_x - t * last_x, point_y - t * last_y);
+}
+
+static void test_failed_publish_kept(void)
+{
+    // Fixes 100 m apart in zigzag, none of them is simplified
+    fix_t fix = { 1767225600000, 45, 7 };
+    for (int i = 0; i < 10; i++, fix.timestamp_ms += 1000) {
+        fix.latitude = 45 + i * 0.001;
+        fix.longitude = 7 + (i % 2) * 0.001;
+        update("retry", &fix);
+    }
+
+    host_set_publish_result(ASTARTE_ERR);
+    edgehog_geolocation_publish(&device);
+    host_set_publish_result(ASTARTE_OK);
+    HOST_CHECK(host_publish_count() == 0);
+
+    edgehog_geolocation_publish(&device);
+    HOST_CHECK(count_publishes(GEOLOCATION_INTERFACE, "/retry") == 1);
+    trace_t published = { 0 };
+    collect_track(&published, "/retry");
+    HOST_CHECK(published.len == 10);
+    free(published.fixes);
+}
+
+static void test_unchanged_record(void)
+{
+    // The receiver moves less than the minimum distance, the record is not updated
+    fix_t fix = { 1767225600000, 45, 7 };
+    update("walk", &fix);
+    edgehog_geolocation_publish(&device);
+    host_publish_reset();
+    for (int i = 0; i < 10; i++) {
+        fix.timestamp_ms += 1000;
+        fix.latitude += 0.00002 * (i % 2 ? 1 : -1);
+        fix.longitude += 0.00002;
+        update("walk", &fix);
+    }
+
+    edgehog_geolocation_publish(&device);
+    HOST_CHECK(count_publishes(GEOLOCATION_INTERFACE, "/walk") == 0);
+    HOST_CHECK(count_publishes(TRACK_INTERFACE, "/walk") == 1);
+    host_publish_reset();
+}
+
+static void replay_trace(const trace_t *trace)
+{
+    trace_t published = { 0 };
+    int64_t update_us = 0;
+    int64_t publish_us = 0;
+    for (int i = 0; i < trace->len; i++) {
+        int64_t start_us = now_us();
+        update("replay", &trace->fixes[i]);
+        update_us += now_us() - start_us;
+        if ((i + 1) % PUBLISH_PERIOD_FIXES == 0 || i + 1 == trace->len) {
+            start_us = now_us();
+            edgehog_geolocation_publish(&device);
+            publish_us += now_us() - start_us;
+            collect_track(&published, "/replay");
+        }
+    }
+
+    // The published fixes are fixes of the trace, in order and never published twice
+    HOST_CHECK(published.len >= 2);
+    HOST_CHECK(llabs(published.fixes[0].timestamp_ms - trace->fixes[0].timestamp_ms)
+        <= TIMESTAMP_TOLERANCE_MS);
+    HOST_CHECK(llabs(published.fixes[published.len - 1].timestamp_ms
+                   - trace->fixes[trace->len - 1].timestamp_ms)
+        <= TIMESTAMP_TOLERANCE_MS);
+    int next = 0;
+    for (int i = 0; i < published.len; i++) {
+        HOST_CHECK(i == 0 || published.fixes[i].timestamp_ms > published.fixes[i - 1].timestamp_ms);
+        while (next < trace->len
+            && trace->fixes[next].timestamp_ms
+                < published.fixes[i].timestamp_ms - TIMESTAMP_TOLERANCE_MS) {
+            next++;
+        }
+        HOST_CHECK(next < trace->len);
+        HOST_CHECK(fabs(trace->fixes[next].latitude - published.fixes[i].latitude) < 1e-6);
+        HOST_CHECK(fabs(trace->fixes[next].longitude - published.fixes[i].longitude) < 1e-6);
+    }
+
+    // Distance of every fix of the trace from the published track
+    double max_distance_m = 0;
+    int segment = 0;
+    for (int i = 0; i < trace->len; i++) {
+        int64_t timestamp_ms = trace->fixes[i].timestamp_ms;
+        while (segment + 2 < published.len
+            && published.fixes[segment + 1].timestamp_ms < timestamp_ms - TIMESTAMP_TOLERANCE_MS) {
+            segment++;
+        }
+        double distance_m = segment_distance_m(
+            &trace->fixes[i], &published.fixes[segment], &published.fixes[segment + 1]);
+        max_distance_m = fmax(max_distance_m, distance_m);
+    }
+
+    printf("%d fixes replayed, %d published (%.1f%%), at most %.2f m from the track, "
+           "%.2f us per update, %.1f us per publish\n",
+        trace->len, published.len, 100.0 * published.len / trace->len, max_distance_m,
+        (double) update_us / trace->len,
+        (double) publish_us / ((trace->len + PUBLISH_PERIOD_FIXES - 1) / PUBLISH_PERIOD_FIXES));
+    // Fixes are simplified once when the track holds all the fixes between two publishes
+    if (CONFIG_EDGEHOG_GEOLOCATION_TRACK_SIZE >= PUBLISH_PERIOD_FIXES) {
+        HOST_CHECK(max_distance_m <= CONFIG_EDGEHOG_GEOLOCATION_TRACK_TOLERANCE_M + 0.01);
+    }
+    free(published.fixes);
+}
+
+int main(int argc, char **argv)
+{
+    device.battery_table = NULL;
+    astarte_list_init(&device.geolocation_list);
+
+    test_failed_publish_kept();
+    test_unchanged_record();
+
+    trace_t trace = { 0 };
+    if (argc > 1) {
+        load_trace(&trace, argv[1]);
+    } else {
+        generate_trace(&trace);
+    }
+    replay_trace(&trace);
+    free(trace.fixes);
+
+    edgehog_geolocation_delete_list(&device.geolocation_list);
+    host_publish_reset();
+    return 0;
+}
@@ -0,0 +1,438 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * OTA serial sink over a pseudo-terminal: a thread stands in for the target on the other end,
+ * receives the frames, validates the image and answers as the target firmware does. Frames and
+ * acknowledgements are lost on purpose to exercise the retransmissions. The throughput is measured
+ * sending at the rate of a UART to a target that writes each frame to its flash before the
+ * acknowledgement.
+ */
+
+#define _GNU_SOURCE
+#include "edgehog_ota_serial_sink.h"
+#include "host_stubs.h"
+#include <esp_rom_crc.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SOF 0xA5
+#define FRAME_BEGIN 0x01
+#define FRAME_DATA 0x02
+#define FRAME_END 0x03
+#define FRAME_ABORT 0x04
+#define FRAME_ACK 0x81
+#define FRAME_NAK 0x82
+#define FRAME_ERROR 0x83
+#define FRAME_OVERHEAD 7
+#define UNKNOWN_SIZE 0xFFFFFFFF
+#define POLL_INTERVAL_MS 20
+#define DOWNLOAD_CHUNK_SIZE 4096
+#define UART_BAUD_RATE 921600
+#define FLASH_WRITE_US 1000
+
+typedef struct
+{
+    int fd;
+    uint32_t baud_rate; // Rate at which the bytes are sent, 0 for unlimited
+    int64_t line_free_us; // End of the transmission of the bytes already sent
+} link_t;
+
+typedef struct
+{
+    int fd;
+    pthread_t thread;
+    atomic_bool stop;
+    // Faults
+    int drop_every; // Every n-th data frame is lost, 0 for none
+    bool drop_end_ack; // The first acknowledgement of the end frame is lost
+    bool reject; // The image is refused
+    uint32_t frame_processing_us; // Time to write a data frame to the flash
+    // Received image
+    uint8_t *image;
+    size_t image_len;
+    size_t image_capacity;
+    uint32_t announced_size;
+    uint8_t expected_seq;
+    bool nak_sent;
+    atomic_bool completed;
+    atomic_bool aborted;
+    unsigned int data_frames;
+    unsigned int dropped;
+    bool end_ack_dropped;
+} target_t;
+
+static uint16_t crc16_ccitt(uint16_t crc, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t) data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static uint32_t get_u32_le(const uint8_t *buffer)
+{
+    return buffer[0] | buffer[1] << 8 | buffer[2] << 16 | (uint32_t) buffer[3] << 24;
+}
+
+static int64_t now_us(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+/************************************************
+ *       Device side of the pseudo-terminal     *
+ ***********************************************/
+
+static int pty_send(void *ctx, const uint8_t *data, size_t len)
+{
+    link_t *link = ctx;
+    if (link->baud_rate > 0) {
+        // The bytes reach the target once sent on the line, 10 bits per byte
+        int64_t now = now_us();
+        int64_t start_us = link->line_free_us > now ? link->line_free_us : now;
+        link->line_free_us = start_us + len * 10 * 1000000LL / link->baud_rate;
+        if (link->line_free_us > now) {
+            usleep(link->line_free_us - now);
+        }
+    }
+
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t ret = write(link->fd, data + sent, len - sent);
+        if (ret < 0) {
+            return -1;
+        }
+        sent += ret;
+    }
+    return (int) sent;
+}
+
+static int pty_recv(void *ctx, uint8_t *data, size_t len, uint32_t timeout_ms)
+{
+    struct pollfd pollfd = { .fd = ((link_t *) ctx)->fd, .events = POLLIN };
+    int ret = poll(&pollfd, 1, (int) timeout_ms);
+    if (ret <= 0) {
+        return ret;
+    }
+    return (int) read(pollfd.fd, data, len);
+}
+
+/************************************************
+ *       Target side of the pseudo-terminal     *
+ ***********************************************/
+
+// Returns false when the target is stopped
+static bool target_read(target_t *target, uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        struct pollfd pollfd = { .fd = target->fd, .events = POLLIN };
+        if (atomic_load(&target->stop)) {
+            return false;
+        }
+        if (poll(&pollfd, 1, POLL_INTERVAL_MS) <= 0) {
+            continue;
+        }
+        ssize_t ret = read(target->fd, data, len);
+        HOST_CHECK(ret > 0);
+        data += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+static void target_reply(target_t *target, uint8_t type, uint8_t seq)
+{
+    uint8_t frame[FRAME_OVERHEAD] = { SOF, type, seq, 0, 0 };
+    uint16_t crc = crc16_ccitt(0xFFFF, &frame[1], 4);
+    frame[5] = crc & 0xFF;
+    frame[6] = crc >> 8;
+    HOST_CHECK(write(target->fd, frame, sizeof(frame)) == sizeof(frame));
+}
+
+static void target_data(target_t *target, uint8_t seq, const uint8_t *payload, uint16_t len)
+{
+    if (target->drop_every > 0 && ++target->data_frames % target->drop_every == 0) {
+        target->dropped++;
+        return;
+    }
+    if (target->frame_processing_us > 0) {
+        usleep(target->frame_processing_us);
+    }
+    if (target->image_len + len > target->image_capacity) {
+        target->image_capacity = 2 * (target->image_len + len);
+        target->image = realloc(target->image, target->image_capacity);
+        HOST_CHECK(target->image);
+    }
+    memcpy(target->image + target->image_len, payload, len);
+    target->image_len += len;
+    target->expected_seq++;
+    target->nak_sent = false;
+    target_reply(target, FRAME_ACK, seq);
+}
+
+static void target_end(target_t *target, uint8_t seq, const uint8_t *payload, uint16_t len)
+{
+    HOST_CHECK(len == 8);
+    uint32_t image_len = get_u32_le(payload);
+    uint32_t image_crc = get_u32_le(&payload[4]);
+    if (target->reject || image_len != target->image_len
+        || image_crc != esp_rom_crc32_le(0, target->image, target->image_len)
+        || (target->announced_size != UNKNOWN_SIZE && target->announced_size != image_len)) {
+        target_reply(target, FRAME_ERROR, seq);
+        return;
+    }
+
+    atomic_store(&target->completed, true);
+    target->expected_seq++;
+    if (target->drop_end_ack && !target->end_ack_dropped) {
+        target->end_ack_dropped = true;
+        return;
+    }
+    target_reply(target, FRAME_ACK, seq);
+}
+
+static void *target_task(void *arg)
+{
+    target_t *target = arg;
+    uint8_t header[4];
+    uint8_t payload[EDGEHOG_OTA_SERIAL_PAYLOAD_SIZE];
+    uint8_t trailer[2];
+
+    while (1) {
+        uint8_t sof = 0;
+        if (!target_read(target, &sof, 1)) {
+            return NULL;
+        }
+        if (sof != SOF) {
+            continue;
+        }
+        uint16_t len = 0;
+        if (!target_read(target, header, sizeof(header))
+            || (len = header[2] | header[3] << 8) > EDGEHOG_OTA_SERIAL_PAYLOAD_SIZE
+            || !target_read(target, payload, len) || !target_read(target, trailer, 2)) {
+            return NULL;
+        }
+        uint16_t crc = crc16_ccitt(crc16_ccitt(0xFFFF, header, sizeof(header)), payload, len);
+        HOST_CHECK(crc == (trailer[0] | trailer[1] << 8));
+
+        uint8_t type = header[0];
+        uint8_t seq = header[1];
+        if (type == FRAME_BEGIN) {
+            HOST_CHECK(seq == 0 && len == 4);
+            target->announced_size = get_u32_le(payload);
+            target->image_len = 0;
+            target->expected_seq = 1;
+            target->nak_sent = false;
+            target_reply(target, FRAME_ACK, seq);
+        } else if (type == FRAME_ABORT) {
+            atomic_store(&target->aborted, true);
+            target->image_len = 0;
+        } else if (seq == target->expected_seq && type == FRAME_DATA) {
+            target_data(target, seq, payload, len);
+        } else if (seq == target->expected_seq && type == FRAME_END) {
+            target_end(target, seq, payload, len);
+        } else if ((uint8_t) (target->expected_seq - 1 - seq) < 128) {
+            // Sent again, the acknowledgement was lost or late
+            target_reply(target, FRAME_ACK, target->expected_seq - 1);
+        } else if (!target->nak_sent) {
+            // A frame was lost, the following ones are discarded until it is sent again
+            target->nak_sent = true;
+            target_reply(target, FRAME_NAK, target->expected_seq);
+        }
+    }
+}
+
+static void target_start(target_t *target, int *device_fd)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    HOST_CHECK(master >= 0 && grantpt(master) == 0 && unlockpt(master) == 0);
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    HOST_CHECK(slave >= 0);
+    struct termios termios;
+    HOST_CHECK(tcgetattr(slave, &termios) == 0);
+    cfmakeraw(&termios);
+    HOST_CHECK(tcsetattr(slave, TCSANOW, &termios) == 0);
+
+    *device_fd = master;
+    target->fd = slave;
+    target->expected_seq = 1;
+    atomic_store(&target->stop, false);
+    HOST_CHECK(pthread_create(&target->thread, NULL, target_task, target) == 0);
+}
+
+static void target_stop(target_t *target, int device_fd)
+{
+    atomic_store(&target->stop, true);
+    pthread_join(target->thread, NULL);
+    close(target->fd);
+    close(device_fd);
+    free(target->image);
+}
+
+/************************************************
+ *                    Tests                     *
+ ***********************************************/
+
+static edgehog_err_t transfer(target_t *target, const edgehog_ota_serial_sink_config_t *config,
+    uint32_t baud_rate, const uint8_t *image, size_t image_len, int announced_size,
+    int64_t *elapsed_us, uint32_t *retransmissions)
+{
+    link_t link = { .baud_rate = baud_rate };
+    target_start(target, &link.fd);
+    edgehog_ota_serial_sink_config_t sink_config = *config;
+    sink_config.transport.send = pty_send;
+    sink_config.transport.recv = pty_recv;
+    sink_config.transport.ctx = &link;
+    edgehog_ota_serial_sink_t serial_sink;
+    edgehog_ota_sink_t sink;
+    HOST_CHECK(edgehog_ota_serial_sink_init(&serial_sink, &sink_config, &sink) == EDGEHOG_OK);
+    HOST_CHECK(strcmp(sink.target, "coprocessor") == 0);
+
+    // The image is written in the chunks of the download
+    int64_t start_us = now_us();
+    edgehog_err_t edgehog_err = sink.begin(sink.user_data, announced_size);
+    for (size_t sent = 0; sent < image_len && edgehog_err == EDGEHOG_OK;
+         sent += DOWNLOAD_CHUNK_SIZE) {
+        size_t len
+            = image_len - sent < DOWNLOAD_CHUNK_SIZE ? image_len - sent : DOWNLOAD_CHUNK_SIZE;
+        edgehog_err = sink.write(sink.user_data, image + sent, len);
+    }
+    if (edgehog_err == EDGEHOG_OK) {
+        edgehog_err = sink.finish(sink.user_data);
+    } else {
+        sink.abort(sink.user_data);
+    }
+    *elapsed_us = now_us() - start_us;
+    *retransmissions = serial_sink.retransmissions;
+
+    // The last frames may still be in flight
+    if (edgehog_err != EDGEHOG_OK) {
+        usleep(100000);
+    }
+    if (edgehog_err == EDGEHOG_OK) {
+        HOST_CHECK(target->image_len == image_len);
+        HOST_CHECK(memcmp(target->image, image, image_len) == 0);
+    }
+    target_stop(target, link.fd);
+    return edgehog_err;
+}
+
+static void test_lossy_link(const uint8_t *image, size_t image_len)
+{
+    edgehog_ota_serial_sink_config_t config = {
+        .target = "coprocessor",
+        .window = 8,
+        .ack_timeout_ms = 100,
+        .max_retries = 5,
+    };
+    target_t target = { .drop_every = 97, .drop_end_ack = true };
+    int64_t elapsed_us;
+    uint32_t retransmissions;
+    HOST_CHECK(transfer(&target, &config, 0, image, image_len, (int) image_len, &elapsed_us,
+                   &retransmissions)
+        == EDGEHOG_OK);
+    HOST_CHECK(atomic_load(&target.completed));
+    HOST_CHECK(target.dropped > 0 && target.end_ack_dropped && retransmissions > 0);
+    printf("lossy link: %zu bytes, %u frames lost, %u frames sent again\n", image_len,
+        target.dropped, (unsigned int) retransmissions);
+
+    // The size is unknown when the server does not report it
+    target_t unknown_size = { 0 };
+    HOST_CHECK(
+        transfer(&unknown_size, &config, 0, image, image_len, -1, &elapsed_us, &retransmissions)
+        == EDGEHOG_OK);
+    HOST_CHECK(unknown_size.announced_size == UNKNOWN_SIZE);
+}
+
+static void test_refused_image(const uint8_t *image, size_t image_len)
+{
+    edgehog_ota_serial_sink_config_t config = {
+        .target = "coprocessor",
+        .window = 4,
+        .ack_timeout_ms = 100,
+        .max_retries = 3,
+    };
+    int64_t elapsed_us;
+    uint32_t retransmissions;
+    target_t target = { .reject = true };
+    HOST_CHECK(transfer(&target, &config, 0, image, image_len, (int) image_len, &elapsed_us,
+                   &retransmissions)
+        == EDGEHOG_ERR_OTA_INVALID_IMAGE);
+    HOST_CHECK(!atomic_load(&target.completed));
+
+    // A target that stops answering, the partial image is aborted
+    target_t silent = { .drop_every = 1 };
+    HOST_CHECK(transfer(&silent, &config, 0, image, image_len, (int) image_len, &elapsed_us,
+                   &retransmissions)
+        == EDGEHOG_ERR_OTA_INTERNAL);
+    HOST_CHECK(atomic_load(&silent.aborted));
+}
+
+static void benchmark_throughput(const uint8_t *image, size_t image_len)
+{
+    static const uint8_t windows[] = { 1, 4, EDGEHOG_OTA_SERIAL_MAX_WINDOW };
+    for (int i = 0; i < sizeof(windows); i++) {
+        edgehog_ota_serial_sink_config_t config = {
+            .target = "coprocessor",
+            .window = windows[i],
+            .ack_timeout_ms = 500,
+            .max_retries = 5,
+        };
+        target_t target = { .frame_processing_us = FLASH_WRITE_US };
+        int64_t elapsed_us;
+        uint32_t retransmissions;
+        HOST_CHECK(transfer(&target, &config, UART_BAUD_RATE, image, image_len, (int) image_len,
+                       &elapsed_us, &retransmissions)
+            == EDGEHOG_OK);
+        double throughput = image_len * 1e6 / elapsed_us;
+        printf("window %u at %d baud: %zu bytes in %lld ms, %.0f B/s, %.0f%% of the line rate\n",
+            windows[i], UART_BAUD_RATE, image_len, (long long) (elapsed_us / 1000), throughput,
+            100 * throughput / (UART_BAUD_RATE / 10.0));
+    }
+}
+
+int main(void)
+{
+    size_t image_len = 256 * 1024 + 123;
+    uint8_t *image = malloc(image_len);
+    HOST_CHECK(image);
+    uint32_t state = 1;
+    for (size_t i = 0; i < image_len; i++) {
+        state = state * 1664525 + 1013904223;
+        image[i] = state >> 24;
+    }
+
+    test_lossy_link(image, image_len);
+    test_refused_image(image, 16 * 1024);
+    benchmark_throughput(image, 64 * 1024);
+
+    free(image);
+    return 0;
+}
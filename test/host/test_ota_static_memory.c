@@ -0,0 +1,774 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Memory of an OTA update: the module is built together with the test, so that its static areas
+ * can be sized and its heap allocations counted apart from the ones of ESP-IDF. A stand-in HTTPS
+ * client serves the image, dropping the first response halfway, and allocates the blocks ESP-IDF
+ * allocates for the client and for the mbedTLS records. With CONFIG_EDGEHOG_OTA_STATIC_MEMORY the
+ * module must not allocate during a request and the largest block must fit the requirement of the
+ * Kconfig help, CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN plus about 1 KB.
+ */
+
+#include "host_stubs.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Inline, as the module does not call them with CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+static inline void *module_malloc(size_t size);
+static inline char *module_strdup(const char *str);
+
+// Allocations of the module, the stubs below use the host allocator
+#define malloc(size) module_malloc(size)
+#define strdup(str) module_strdup(str)
+#include "../../src/edgehog_ota.c"
+#undef malloc
+#undef strdup
+
+// Requirement of the Kconfig help of CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+#define HEAP_REQUIREMENT (CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN + 1024)
+// Blocks of esp_http_client_init: client, request and response, and the buffers
+#define HTTP_CLIENT_SIZE 512
+#define HTTP_BUFFER_SIZE 512
+// mbedTLS record buffers: header, IV, MAC and CBC padding around the content
+#define TLS_RECORD_OVERHEAD (13 + 16 + 48 + 256)
+#define TLS_CONTEXT_SIZE 1024
+#define TLS_SESSION_SIZE 256
+#define PARTITION_SIZE (1024 * 1024)
+#define NVS_MAX_KEYS 32
+
+typedef struct
+{
+    size_t count;
+    size_t bytes;
+    size_t largest;
+} heap_usage_t;
+
+struct esp_http_client
+{
+    http_event_handle_cb event_handler;
+    void *user_data;
+    char *url;
+    char *buffers[2];
+    char *tls_buffers[2];
+    char *tls_context;
+    char *tls_session;
+    char range[32];
+    int status;
+    int body_first;
+    int body_end; // The response is cut here when the connection drops
+    int position;
+};
+
+typedef struct
+{
+    char key[OTA_SOURCE_KEY_LEN];
+    void *value;
+    size_t len;
+} nvs_entry_t;
+
+static heap_usage_t module_heap;
+static heap_usage_t sdk_heap;
+static const uint8_t *served_image;
+static int served_image_len;
+static int drops_left;
+static nvs_entry_t nvs_entries[NVS_MAX_KEYS];
+static const esp_partition_t running_partition = { ESP_PARTITION_TYPE_APP,
+    ESP_PARTITION_SUBTYPE_APP_OTA_MIN, 0x10000, PARTITION_SIZE, "ota_0" };
+static const esp_partition_t update_partition = { ESP_PARTITION_TYPE_APP,
+    ESP_PARTITION_SUBTYPE_APP_OTA_MIN + 1, 0x110000, PARTITION_SIZE, "ota_1" };
+static const esp_partition_t *boot_partition = &running_partition;
+static uint8_t flash[PARTITION_SIZE];
+
+ESP_EVENT_DEFINE_BASE(EDGEHOG_EVENTS);
+
+/************************************************
+ *              Heap accounting                 *
+ ***********************************************/
+
+static void account(heap_usage_t *heap, size_t size)
+{
+    heap->count++;
+    heap->bytes += size;
+    if (size > heap->largest) {
+        heap->largest = size;
+    }
+}
+
+static inline void *module_malloc(size_t size)
+{
+    account(&module_heap, size);
+    return malloc(size);
+}
+
+static inline char *module_strdup(const char *str)
+{
+    account(&module_heap, strlen(str) + 1);
+    return strdup(str);
+}
+
+static void *sdk_malloc(size_t size)
+{
+    account(&sdk_heap, size);
+    void *block = calloc(1, size);
+    HOST_CHECK(block);
+    return block;
+}
+
+/************************************************
+ *          HTTPS client of ESP-IDF             *
+ ***********************************************/
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t client = sdk_malloc(HTTP_CLIENT_SIZE);
+    client->event_handler = config->event_handler;
+    client->user_data = config->user_data;
+    client->buffers[0]
+        = sdk_malloc(config->buffer_size > 0 ? config->buffer_size : HTTP_BUFFER_SIZE);
+    client->buffers[1]
+        = sdk_malloc(config->buffer_size_tx > 0 ? config->buffer_size_tx : HTTP_BUFFER_SIZE);
+    return esp_http_client_set_url(client, config->url) == ESP_OK ? client : NULL;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url)
+{
+    free(client->url);
+    client->url = sdk_malloc(strlen(url) + 1);
+    strcpy(client->url, url);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_get_url(esp_http_client_handle_t client, char *url, const int len)
+{
+    snprintf(url, len, "%s", client->url);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(
+    esp_http_client_handle_t client, const char *key, const char *value)
+{
+    HOST_CHECK(strcmp(key, "Range") == 0);
+    snprintf(client->range, sizeof(client->range), "%s", value);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key)
+{
+    client->range[0] = '\0';
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_user_data(esp_http_client_handle_t client, void *data)
+{
+    client->user_data = data;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t client)
+{
+    return ESP_FAIL;
+}
+
+esp_http_client_transport_t esp_http_client_get_transport_type(esp_http_client_handle_t client)
+{
+    return strncmp(client->url, "https://", 8) == 0 ? HTTP_TRANSPORT_OVER_SSL
+                                                     : HTTP_TRANSPORT_OVER_TCP;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    // The record buffers live as long as the connection, the session is kept by the client
+    if (esp_http_client_get_transport_type(client) == HTTP_TRANSPORT_OVER_SSL) {
+        client->tls_context = sdk_malloc(TLS_CONTEXT_SIZE);
+        client->tls_buffers[0]
+            = sdk_malloc(CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN + TLS_RECORD_OVERHEAD);
+        client->tls_buffers[1]
+            = sdk_malloc(CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN + TLS_RECORD_OVERHEAD);
+        if (!client->tls_session) {
+            client->tls_session = sdk_malloc(TLS_SESSION_SIZE);
+        }
+    }
+    esp_http_client_event_t event
+        = { .event_id = HTTP_EVENT_ON_CONNECTED, .client = client, .user_data = client->user_data };
+    return client->event_handler(&event);
+}
+
+int64_t esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    client->body_first = 0;
+    if (client->range[0] != '\0') {
+        HOST_CHECK(sscanf(client->range, "bytes=%d-", &client->body_first) == 1);
+    }
+    client->status = client->body_first > 0 ? 206 : 200;
+    client->position = client->body_first;
+    client->body_end = served_image_len;
+    if (drops_left > 0) {
+        drops_left--;
+        client->body_end = client->body_first + (served_image_len - client->body_first) / 2;
+    }
+    if (client->status == 206) {
+        char value[64];
+        snprintf(value, sizeof(value), "bytes %d-%d/%d", client->body_first,
+            served_image_len - 1, served_image_len);
+        esp_http_client_event_t event = { .event_id = HTTP_EVENT_ON_HEADER,
+            .client = client,
+            .user_data = client->user_data,
+            .header_key = "Content-Range",
+            .header_value = value };
+        client->event_handler(&event);
+    }
+    return served_image_len - client->body_first;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client)
+{
+    return served_image_len - client->body_first;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len)
+{
+    int read_len = client->body_end - client->position < len ? client->body_end - client->position
+                                                             : len;
+    memcpy(buffer, served_image + client->position, read_len);
+    client->position += read_len;
+    return read_len;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client)
+{
+    return client->position == served_image_len;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    free(client->tls_context);
+    free(client->tls_buffers[0]);
+    free(client->tls_buffers[1]);
+    client->tls_context = client->tls_buffers[0] = client->tls_buffers[1] = NULL;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    esp_http_client_close(client);
+    free(client->tls_session);
+    free(client->url);
+    free(client->buffers[0]);
+    free(client->buffers[1]);
+    free(client);
+    return ESP_OK;
+}
+
+/************************************************
+ *            Flash and partitions              *
+ ***********************************************/
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+    return &running_partition;
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+    return &update_partition;
+}
+
+esp_err_t esp_ota_get_state_partition(
+    const esp_partition_t *partition, esp_ota_img_states_t *ota_state)
+{
+    *ota_state = ESP_OTA_IMG_VALID;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    boot_partition = partition;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_get_partition_description(
+    const esp_partition_t *partition, esp_app_desc_t *app_desc)
+{
+    memset(app_desc, 0, sizeof(esp_app_desc_t));
+    strcpy(app_desc->version, "1.0.0");
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void)
+{
+    esp_restart();
+}
+
+esp_err_t esp_image_verify(
+    esp_image_load_mode_t mode, const esp_partition_pos_t *part, esp_image_metadata_t *data)
+{
+    HOST_CHECK(part->offset == update_partition.address);
+    return memcmp(flash, served_image, served_image_len) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_partition_iterator_t esp_partition_find(
+    esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    return NULL;
+}
+
+const esp_partition_t *esp_partition_get(esp_partition_iterator_t iterator)
+{
+    return NULL;
+}
+
+esp_partition_iterator_t esp_partition_next(esp_partition_iterator_t iterator)
+{
+    return NULL;
+}
+
+void esp_partition_iterator_release(esp_partition_iterator_t iterator) { }
+
+esp_err_t esp_partition_read(
+    const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    HOST_CHECK(partition == &update_partition && src_offset + size <= PARTITION_SIZE);
+    memcpy(dst, flash + src_offset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(
+    const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    HOST_CHECK(partition == &update_partition && dst_offset + size <= PARTITION_SIZE);
+    memcpy(flash + dst_offset, src, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    HOST_CHECK(partition == &update_partition && offset % SPI_FLASH_SEC_SIZE == 0
+        && size % SPI_FLASH_SEC_SIZE == 0 && offset + size <= PARTITION_SIZE);
+    memset(flash + offset, 0xFF, size);
+    return ESP_OK;
+}
+
+/************************************************
+ *                     NVS                      *
+ ***********************************************/
+
+static nvs_entry_t *nvs_find(const char *key, bool create)
+{
+    nvs_entry_t *free_entry = NULL;
+    for (int i = 0; i < NVS_MAX_KEYS; i++) {
+        if (nvs_entries[i].value && strcmp(nvs_entries[i].key, key) == 0) {
+            return &nvs_entries[i];
+        }
+        if (!nvs_entries[i].value && !free_entry) {
+            free_entry = &nvs_entries[i];
+        }
+    }
+    HOST_CHECK(!create || free_entry);
+    return create ? free_entry : NULL;
+}
+
+static esp_err_t nvs_set(const char *key, const void *value, size_t len)
+{
+    HOST_CHECK(strlen(key) < sizeof(nvs_entries[0].key));
+    nvs_entry_t *entry = nvs_find(key, true);
+    free(entry->value);
+    strcpy(entry->key, key);
+    entry->value = malloc(len);
+    HOST_CHECK(entry->value);
+    memcpy(entry->value, value, len);
+    entry->len = len;
+    return ESP_OK;
+}
+
+static esp_err_t nvs_get(const char *key, void *value, size_t len)
+{
+    nvs_entry_t *entry = nvs_find(key, false);
+    if (!entry) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    HOST_CHECK(entry->len == len);
+    memcpy(value, entry->value, len);
+    return ESP_OK;
+}
+
+esp_err_t edgehog_device_nvs_open(
+    edgehog_device_handle_t edgehog_device, char *name, nvs_handle_t *out_handle)
+{
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    return nvs_set(key, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+{
+    return nvs_get(key, out_value, sizeof(*out_value));
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char *key, uint32_t value)
+{
+    return nvs_set(key, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char *key, uint32_t *out_value)
+{
+    return nvs_get(key, out_value, sizeof(*out_value));
+}
+
+esp_err_t nvs_set_i64(nvs_handle_t handle, const char *key, int64_t value)
+{
+    return nvs_set(key, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_i64(nvs_handle_t handle, const char *key, int64_t *out_value)
+{
+    return nvs_get(key, out_value, sizeof(*out_value));
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return nvs_set(key, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+    nvs_entry_t *entry = nvs_find(key, false);
+    if (!entry) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (out_value && *length < entry->len) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    if (out_value) {
+        memcpy(out_value, entry->value, entry->len);
+    }
+    *length = entry->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return nvs_set(key, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    nvs_entry_t *entry = nvs_find(key, false);
+    if (!entry || *length < entry->len) {
+        return entry ? ESP_ERR_NVS_INVALID_LENGTH : ESP_ERR_NVS_NOT_FOUND;
+    }
+    memcpy(out_value, entry->value, entry->len);
+    *length = entry->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    nvs_entry_t *entry = nvs_find(key, false);
+    if (!entry) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    free(entry->value);
+    entry->value = NULL;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) { }
+
+/************************************************
+ *      FreeRTOS, events and requests parsing   *
+ ***********************************************/
+
+// The test runs the OTA update on its own thread, no task is spawned
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *arg,
+    uint32_t priority, TaskHandle_t *created_task)
+{
+    return pdFAIL;
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t code, const char *name, uint32_t stack_depth,
+    void *arg, uint32_t priority, StackType_t *stack, StaticTask_t *tcb)
+{
+    return NULL;
+}
+
+TaskHandle_t xTaskGetHandle(const char *name)
+{
+    return NULL;
+}
+
+void vTaskDelete(TaskHandle_t task) { }
+
+void vTaskDelay(TickType_t ticks) { }
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(unsigned long clear_on_entry, unsigned long clear_on_exit,
+    uint32_t *value, TickType_t ticks_to_wait)
+{
+    return pdFALSE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    return 0;
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, BaseType_t auto_reload, void *id,
+    TimerCallbackFunction_t callback)
+{
+    return NULL;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return NULL;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    return pdFAIL;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    return pdFAIL;
+}
+
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    return pdFAIL;
+}
+
+void esp_restart(void)
+{
+    fprintf(stderr, "unexpected restart\n");
+    exit(1);
+}
+
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id, const void *event_data,
+    size_t event_data_size, uint32_t ticks_to_wait)
+{
+    return ESP_OK;
+}
+
+bool astarte_device_is_connected(astarte_device_handle_t device)
+{
+    return true;
+}
+
+astarte_bson_document_t astarte_bson_deserializer_element_to_document(
+    astarte_bson_element_t element)
+{
+    return (astarte_bson_document_t) { 0 };
+}
+
+astarte_bson_document_t astarte_bson_deserializer_element_to_array(astarte_bson_element_t element)
+{
+    return (astarte_bson_document_t) { 0 };
+}
+
+astarte_err_t astarte_bson_deserializer_element_lookup(
+    astarte_bson_document_t document, const char *key, astarte_bson_element_t *element)
+{
+    return ASTARTE_ERR;
+}
+
+astarte_err_t astarte_bson_deserializer_first_element(
+    astarte_bson_document_t document, astarte_bson_element_t *element)
+{
+    return ASTARTE_ERR;
+}
+
+astarte_err_t astarte_bson_deserializer_next_element(
+    astarte_bson_document_t document, astarte_bson_element_t element, astarte_bson_element_t *next)
+{
+    return ASTARTE_ERR;
+}
+
+const char *astarte_bson_deserializer_element_to_string(
+    astarte_bson_element_t element, uint32_t *len)
+{
+    return NULL;
+}
+
+int32_t astarte_bson_deserializer_element_to_int32(astarte_bson_element_t element)
+{
+    return 0;
+}
+
+int64_t astarte_bson_deserializer_element_to_int64(astarte_bson_element_t element)
+{
+    return 0;
+}
+
+int64_t astarte_bson_deserializer_element_to_datetime(astarte_bson_element_t element)
+{
+    return 0;
+}
+
+/************************************************
+ *                    Tests                     *
+ ***********************************************/
+
+static void print_static_areas(void)
+{
+    size_t total = sizeof(ota_task_data);
+    printf("request data: %zu bytes\n", sizeof(ota_task_data));
+#if CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    size_t stacks = sizeof(ota_task_stack) + sizeof(ota_apply_task_stack);
+    size_t tcbs = sizeof(ota_task_tcb) + sizeof(ota_apply_task_tcb);
+#if CONFIG_EDGEHOG_OTA_HEALTH_CHECK
+    stacks += sizeof(ota_health_task_stack);
+    tcbs += sizeof(ota_health_task_tcb);
+#endif
+    size_t buffers = sizeof(ota_redirect_url) + sizeof(ota_buffer);
+    printf("task stacks: %zu bytes, control blocks: %zu bytes\n", stacks, tcbs);
+    printf("request strings: %zu bytes, buffers: %zu bytes\n", sizeof(ota_strings), buffers);
+    total += stacks + tcbs + sizeof(ota_strings) + buffers;
+
+    // Documented in the Kconfig help
+#if CONFIG_EDGEHOG_OTA_HEALTH_CHECK
+    HOST_CHECK(stacks == 3 * CONFIG_EDGEHOG_OTA_TASK_STACK_SIZE);
+#else
+    HOST_CHECK(stacks == 2 * CONFIG_EDGEHOG_OTA_TASK_STACK_SIZE);
+#endif
+    HOST_CHECK(sizeof(ota_strings) == CONFIG_EDGEHOG_OTA_STATIC_STRINGS_SIZE);
+    HOST_CHECK(buffers <= 3 * 1024);
+#endif
+    printf("static memory: %zu bytes\n", total);
+}
+
+static void test_download(const uint8_t *image, int image_len)
+{
+    static struct edgehog_device_t edgehog_dev;
+    nvs_handle_t handle_nvs = 1;
+    served_image = image;
+    served_image_len = image_len;
+    drops_left = 1;
+    memset(flash, 0xFF, sizeof(flash));
+    module_heap = (heap_usage_t) { 0 };
+    sdk_heap = (heap_usage_t) { 0 };
+
+    memset(&ota_task_data, 0, sizeof(ota_task_data));
+    ota_task_data.edgehog_dev = &edgehog_dev;
+    ota_task_data.req_uuid = ota_strdup("b5bf39e3-1c0e-4e6a-bd63-7a3f0f5b9d52");
+    ota_task_data.sources[0].url = ota_strdup("https://images.example.com/app.bin");
+    ota_task_data.sources_count = 1;
+    edgehog_ota_perf_init(&ota_task_data.perf);
+    HOST_CHECK(perform_ota(&ota_task_data, &handle_nvs) == EDGEHOG_OK);
+    HOST_CHECK(boot_partition == &update_partition);
+    HOST_CHECK(ota_task_data.perf.retries == 1);
+    release_ota_http_client(get_ota_http_client());
+
+    printf("module: %zu allocations, %zu bytes, largest %zu bytes\n", module_heap.count,
+        module_heap.bytes, module_heap.largest);
+    printf("ESP-IDF: %zu allocations, %zu bytes, largest %zu bytes\n", sdk_heap.count,
+        sdk_heap.bytes, sdk_heap.largest);
+#if CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    HOST_CHECK(module_heap.count == 0);
+#else
+    HOST_CHECK(module_heap.count > 0);
+#endif
+    HOST_CHECK(module_heap.largest <= HEAP_REQUIREMENT && sdk_heap.largest <= HEAP_REQUIREMENT);
+    ota_free_request(&ota_task_data);
+}
+
+static void test_resume_request(void)
+{
+    static const char *urls[] = { "https://images.example.com/app.bin",
+        "https://mirror-1.example.com/app.bin", "http://192.168.1.10:8080/app.bin" };
+    static struct edgehog_device_t edgehog_dev;
+
+    memset(&ota_task_data, 0, sizeof(ota_task_data));
+    ota_task_data.req_uuid = ota_strdup("7f0c1a52-5d0e-4c55-9b59-4f4b2f6f3a10");
+    for (int i = 0; i < 3; i++) {
+        ota_task_data.sources[i].url = ota_strdup(urls[i]);
+    }
+    ota_task_data.sources_count = 3;
+    ota_task_data.req_max_bytes_per_sec = 65536;
+    module_heap = (heap_usage_t) { 0 };
+    save_ota_request(&ota_task_data, 1);
+    ota_journal_t journal = { .partition_addr = update_partition.address };
+    nvs_set_blob(1, OTA_JOURNAL_KEY, &journal, sizeof(journal));
+    ota_free_request(&ota_task_data);
+
+    // A reset interrupted the download, the request is loaded again
+    HOST_CHECK(load_ota_request(&edgehog_dev, 1, "7f0c1a52-5d0e-4c55-9b59-4f4b2f6f3a10")
+        == EDGEHOG_OK);
+    HOST_CHECK(ota_task_data.resume && ota_task_data.sources_count == 3);
+    for (int i = 0; i < 3; i++) {
+        HOST_CHECK(strcmp(ota_task_data.sources[i].url, urls[i]) == 0);
+    }
+    HOST_CHECK(ota_task_data.req_max_bytes_per_sec == 65536);
+#if CONFIG_EDGEHOG_OTA_STATIC_MEMORY
+    HOST_CHECK(module_heap.count == 0);
+#endif
+    ota_free_request(&ota_task_data);
+    nvs_erase_key(1, OTA_JOURNAL_KEY);
+}
+
+int main(void)
+{
+    int image_len = 300 * 1024 + 77;
+    uint8_t *image = malloc(image_len);
+    HOST_CHECK(image);
+    uint32_t state = 1;
+    for (int i = 0; i < image_len; i++) {
+        state = state * 1664525 + 1013904223;
+        image[i] = state >> 24;
+    }
+    image[0] = ESP_IMAGE_HEADER_MAGIC;
+
+    print_static_areas();
+    test_download(image, image_len);
+    test_resume_request();
+
+    free(image);
+    return 0;
+}
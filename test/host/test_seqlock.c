@@ -0,0 +1,324 @@
+/*
+ * This file is part of Edgehog.
+ *
+ * Copyright 2026 SECO Mind Srl
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Stress test of the sequence locks: writer threads update the same records while a reader
+ * publishes them, every record read must be one of the records written. An update written while
+ * a record is being published must be published once.
+ */
+
+#include "edgehog_battery_status.h"
+#include "edgehog_device_private.h"
+#include "edgehog_geolocation.h"
+#include "edgehog_geolocation_p.h"
+#include "edgehog_seqlock.h"
+#include "host_stubs.h"
+
+#define WRITERS 4
+#define WRITES_PER_WRITER 200000
+#define SHARED_SLOTS (CONFIG_EDGEHOG_BATTERY_SLOTS - 1)
+
+typedef struct
+{
+    uint64_t values[8]; // All equal in a consistent record
+} stress_record_t;
+
+static struct edgehog_device_t device;
+static edgehog_seqlock_t record_seqlock;
+static stress_record_t record;
+static atomic_int writers_running;
+
+static void *write_records(void *arg)
+{
+    uint64_t value = (uintptr_t) arg;
+    for (int i = 0; i < WRITES_PER_WRITER; i++, value += WRITERS) {
+        edgehog_seqlock_lock(&record_seqlock);
+        edgehog_seqlock_write_begin(&record_seqlock);
+        for (int j = 0; j < 8; j++) {
+            record.values[j] = value;
+        }
+        edgehog_seqlock_write_end(&record_seqlock);
+        edgehog_seqlock_unlock(&record_seqlock);
+    }
+    atomic_fetch_sub(&writers_running, 1);
+    return NULL;
+}
+
+static void test_seqlock(void)
+{
+    pthread_t writers[WRITERS];
+    edgehog_seqlock_init(&record_seqlock);
+    atomic_store(&writers_running, WRITERS);
+    for (uintptr_t i = 0; i < WRITERS; i++) {
+        HOST_CHECK(pthread_create(&writers[i], NULL, write_records, (void *) i) == 0);
+    }
+
+    unsigned long reads = 0;
+    unsigned long retries = 0;
+    while (atomic_load(&writers_running) > 0) {
+        stress_record_t copy;
+        unsigned int seq;
+        do {
+            seq = edgehog_seqlock_read_begin(&record_seqlock);
+            copy = record;
+            retries++;
+        } while (edgehog_seqlock_read_retry(&record_seqlock, seq));
+        retries--;
+        reads++;
+        for (int j = 1; j < 8; j++) {
+            HOST_CHECK(copy.values[j] == copy.values[0]);
+        }
+    }
+
+    for (int i = 0; i < WRITERS; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    HOST_CHECK(edgehog_seqlock_sequence(&record_seqlock) == 2 * WRITERS * WRITES_PER_WRITER);
+    printf("seqlock: %lu consistent reads, %lu retried\n", reads, retries);
+}
+
+static void *update_batteries(void *arg)
+{
+    uintptr_t writer = (uintptr_t) arg;
+    char name[16];
+    for (int i = 0; i < WRITES_PER_WRITER; i++) {
+        // Each writer adds the shared slots in a different order
+        snprintf(name, sizeof(name), "shared%d", (int) ((i + writer) % SHARED_SLOTS));
+        // The error and the state are derived from the level, the values are exact also in
+        // fixed point
+        int level = (i * WRITERS + writer) % 101;
+        edgehog_battery_status_t status = {
+            .battery_slot = i % 2 ? "pack" : name,
+            .level_percentage = level,
+            .level_absolute_error = level * 0.5,
+            .battery_state = level % 2 ? BATTERY_CHARGING : BATTERY_DISCHARGING,
+        };
+        edgehog_battery_status_update(&device, &status);
+    }
+    atomic_fetch_sub(&writers_running, 1);
+    return NULL;
+}
+
+static void check_battery_publishes(void)
+{
+    for (int i = 0; i < host_publish_count(); i++) {
+        const host_publish_t *publish = host_publish_get(i);
+        double level = host_publish_field(publish, "levelPercentage")->number;
+        HOST_CHECK(host_publish_field(publish, "levelAbsoluteError")->number == level * 0.5);
+        HOST_CHECK(strcmp(host_publish_field(publish, "status")->string,
+                       (int) level % 2 ? "Charging" : "Discharging")
+            == 0);
+    }
+}
+
+static void test_battery_status(void)
+{
+    pthread_t writers[WRITERS];
+    atomic_store(&writers_running, WRITERS);
+    for (uintptr_t i = 0; i < WRITERS; i++) {
+        HOST_CHECK(pthread_create(&writers[i], NULL, update_batteries, (void *) i) == 0);
+    }
+
+    unsigned long publishes = 0;
+    while (atomic_load(&writers_running) > 0) {
+        edgehog_battery_status_publish(&device);
+        publishes += host_publish_count();
+        check_battery_publishes();
+        host_publish_reset();
+    }
+    for (int i = 0; i < WRITERS; i++) {
+        pthread_join(writers[i], NULL);
+    }
+
+    // Every slot has been added once, also when added by more writers at the same time
+    edgehog_battery_status_t status = { .level_absolute_error = 0, .battery_state = BATTERY_IDLE };
+    char name[16];
+    for (int i = 0; i <= SHARED_SLOTS; i++) {
+        snprintf(name, sizeof(name), "shared%d", i);
+        status.battery_slot = i < SHARED_SLOTS ? name : "pack";
+        status.level_percentage = 100;
+        edgehog_battery_status_update(&device, &status);
+    }
+    edgehog_battery_status_publish(&device);
+    int expected = SHARED_SLOTS + 1;
+#if CONFIG_EDGEHOG_UPDATE_HISTORY_SIZE > 0
+    // The last update of each writer may also be published, as replaced update
+    HOST_CHECK(host_publish_count() >= expected);
+#else
+    HOST_CHECK(host_publish_count() == expected);
+#endif
+    int idle = 0;
+    for (int i = 0; i < host_publish_count(); i++) {
+        const host_publish_t *publish = host_publish_get(i);
+        if (strcmp(host_publish_field(publish, "status")->string, "Idle") == 0) {
+            idle++;
+        }
+    }
+    HOST_CHECK(idle == expected);
+    host_publish_reset();
+    printf("battery status: %lu consistent publishes\n", publishes);
+}
+
+static void *update_geolocation(void *arg)
+{
+    uintptr_t writer = (uintptr_t) arg;
+    for (int i = 0; i < WRITES_PER_WRITER; i++) {
+        // Every value is derived from the latitude
+        double latitude = (i * WRITERS + writer) % 90;
+        edgehog_geolocation_data_t data = {
+            .id = "gps",
+            .latitude = latitude,
+            .longitude = 2 * latitude,
+            .accuracy = latitude,
+            .altitude = latitude,
+            .altitude_accuracy = latitude,
+            .heading = latitude,
+            .speed = latitude,
+        };
+        edgehog_geolocation_update(&device, &data);
+    }
+    atomic_fetch_sub(&writers_running, 1);
+    return NULL;
+}
+
+static void check_geolocation_publishes(void)
+{
+    static const char *const fields[]
+        = { "accuracy", "altitude", "altitudeAccuracy", "heading", "speed" };
+    for (int i = 0; i < host_publish_count(); i++) {
+        const host_publish_t *publish = host_publish_get(i);
+        HOST_CHECK(strcmp(publish->path, "/gps") == 0);
+        double latitude = host_publish_field(publish, "latitude")->number;
+        HOST_CHECK(host_publish_field(publish, "longitude")->number == 2 * latitude);
+        for (int j = 0; j < sizeof(fields) / sizeof(fields[0]); j++) {
+            HOST_CHECK(host_publish_field(publish, fields[j])->number == latitude);
+        }
+    }
+}
+
+static void test_geolocation(void)
+{
+    pthread_t writers[WRITERS];
+    atomic_store(&writers_running, WRITERS);
+    for (uintptr_t i = 0; i < WRITERS; i++) {
+        HOST_CHECK(pthread_create(&writers[i], NULL, update_geolocation, (void *) i) == 0);
+    }
+
+    unsigned long publishes = 0;
+    while (atomic_load(&writers_running) > 0) {
+        edgehog_geolocation_publish(&device);
+        publishes += host_publish_count();
+        check_geolocation_publishes();
+        host_publish_reset();
+    }
+    for (int i = 0; i < WRITERS; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    edgehog_geolocation_publish(&device);
+    check_geolocation_publishes();
+    host_publish_reset();
+    printf("geolocation: %lu consistent publishes\n", publishes);
+}
+
+static void update_battery_level(double level)
+{
+    // The slots are all in use after the stress test, "pack" has nothing left to publish
+    edgehog_battery_status_t status = {
+        .battery_slot = "pack",
+        .level_percentage = level,
+        .level_absolute_error = level * 0.5,
+        .battery_state = BATTERY_DISCHARGING,
+    };
+    edgehog_battery_status_update(&device, &status);
+}
+
+static void update_battery_during_publish(void)
+{
+    host_set_publish_hook(NULL);
+    update_battery_level(30);
+}
+
+static void test_battery_update_during_publish(void)
+{
+    host_publish_reset();
+    update_battery_level(31);
+    host_set_publish_hook(update_battery_during_publish);
+    edgehog_battery_status_publish(&device);
+    edgehog_battery_status_publish(&device);
+
+    // The update written meanwhile follows the published one, neither is published again
+    HOST_CHECK(host_publish_count() == 2);
+    HOST_CHECK(host_publish_field(host_publish_get(0), "levelPercentage")->number == 31);
+    HOST_CHECK(host_publish_field(host_publish_get(1), "levelPercentage")->number == 30);
+    host_publish_reset();
+}
+
+static void update_geolocation_latitude(double latitude)
+{
+    edgehog_geolocation_data_t data = {
+        .id = "during",
+        .latitude = latitude,
+        .longitude = 2 * latitude,
+        .accuracy = latitude,
+        .altitude = latitude,
+        .altitude_accuracy = latitude,
+        .heading = latitude,
+        .speed = latitude,
+    };
+    edgehog_geolocation_update(&device, &data);
+}
+
+static void update_geolocation_during_publish(void)
+{
+    host_set_publish_hook(NULL);
+    update_geolocation_latitude(30);
+}
+
+static void test_geolocation_update_during_publish(void)
+{
+    host_publish_reset();
+    update_geolocation_latitude(31);
+    host_set_publish_hook(update_geolocation_during_publish);
+    edgehog_geolocation_publish(&device);
+    edgehog_geolocation_publish(&device);
+
+    // The update written meanwhile follows the published one, neither is published again
+    HOST_CHECK(host_publish_count() == 2);
+    HOST_CHECK(host_publish_field(host_publish_get(0), "latitude")->number == 31);
+    HOST_CHECK(host_publish_field(host_publish_get(1), "latitude")->number == 30);
+    host_publish_reset();
+}
+
+int main(void)
+{
+    device.battery_table = edgehog_battery_status_table_new();
+    HOST_CHECK(device.battery_table);
+    astarte_list_init(&device.geolocation_list);
+
+    test_seqlock();
+    test_battery_status();
+    test_geolocation();
+    test_battery_update_during_publish();
+    test_geolocation_update_during_publish();
+
+    edgehog_geolocation_delete_list(&device.geolocation_list);
+    edgehog_battery_status_table_destroy(device.battery_table);
+    return 0;
+}